@@ -0,0 +1,77 @@
+#ifndef _PIXZO_AFFINITY_HPP_
+#define _PIXZO_AFFINITY_HPP_
+
+#include <stdbool.h>
+
+#include <sched.h>
+
+#define AFFINITY_CPUS_STRING_SIZE			256
+
+#define AFFINITY_NUMA_NODE_NONE				-1
+
+#define AFFINITY_SCHED_MAP(XX)				\
+	XX(0,	NONE, 		none)				\
+	XX(1,	OTHER, 		other)				\
+	XX(2,	FIFO, 		fifo)				\
+	XX(3,	RR, 		rr)
+
+typedef enum AffinitySched {
+
+	#define XX(num, name, string) AFFINITY_SCHED_##name = num,
+	AFFINITY_SCHED_MAP (XX)
+	#undef XX
+
+} AffinitySched;
+
+extern const char *affinity_sched_to_string (AffinitySched sched);
+
+// returns NONE for NULL or unknown values
+extern AffinitySched affinity_sched_from_string (const char *string);
+
+// where a thread runs & allocates its memory
+// NONE sched keeps the thread's inherited policy
+struct _ThreadAffinity {
+
+	bool has_cpus;
+	cpu_set_t cpus;
+
+	int numa_node;				// preferred node for the thread's memory
+
+	AffinitySched sched;
+	int priority;				// only used by fifo & rr
+
+};
+
+typedef struct _ThreadAffinity ThreadAffinity;
+
+extern void thread_affinity_init (ThreadAffinity *affinity);
+
+// parses a cpu list like "0-3,8"
+// returns 0 on success, 1 on error
+extern unsigned int thread_affinity_set_cpus (
+	ThreadAffinity *affinity, const char *cpu_list
+);
+
+// the thread's memory is allocated from this node
+// and it runs in the node's cpus if none were set
+extern void thread_affinity_set_numa_node (
+	ThreadAffinity *affinity, int numa_node
+);
+
+extern void thread_affinity_set_sched (
+	ThreadAffinity *affinity, AffinitySched sched, int priority
+);
+
+// applies the affinity to the calling thread
+// and logs where it has actually been placed
+// returns 0 on success, 1 if any value could not be applied
+extern unsigned int thread_affinity_apply (
+	const ThreadAffinity *affinity, const char *thread_name
+);
+
+// writes the set's cpus as a cpu list like "0-3,8"
+extern void affinity_cpus_to_string (
+	const cpu_set_t *cpus, char *buffer, size_t size
+);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef _PIXZO_BUDGET_HPP_
+#define _PIXZO_BUDGET_HPP_
+
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#define MEMORY_BUDGET_WAIT_TIMEOUT				100		// ms
+#define MEMORY_BUDGET_BLOCK_TIMEOUT				1000	// ms, then the frame is dropped
+
+#define MEMORY_BUDGET_DECIMATE_PERCENT			75		// of max bytes
+
+#define MEMORY_BUDGET_POLICY_MAP(XX)					\
+	XX(0,	NONE, 			none)						\
+	XX(1,	DROP_OLDEST, 	drop_oldest)				\
+	XX(2,	DROP_NEWEST, 	drop_newest)				\
+	XX(3,	DECIMATE, 		decimate)					\
+	XX(4,	BLOCK, 			block)
+
+// what to do with new frames when the budget is exceeded
+typedef enum MemoryBudgetPolicy {
+
+	#define XX(num, name, string) MEMORY_BUDGET_POLICY_##name = num,
+	MEMORY_BUDGET_POLICY_MAP (XX)
+	#undef XX
+
+} MemoryBudgetPolicy;
+
+extern const char *memory_budget_policy_to_string (
+	MemoryBudgetPolicy policy
+);
+
+// returns NONE for NULL or unknown values
+extern MemoryBudgetPolicy memory_budget_policy_from_string (
+	const char *string
+);
+
+// bytes used by the live frames of every stream
+// and by their actions memories
+struct _MemoryBudget {
+
+	u64 max_bytes;				// 0 for no limit
+	MemoryBudgetPolicy policy;
+
+	u64 used_bytes;
+	u64 high_water;
+
+	u64 n_waits;				// times that capture was blocked
+
+	pthread_mutex_t *mutex;
+	pthread_cond_t *cond;		// signaled when bytes are released
+
+};
+
+typedef struct _MemoryBudget MemoryBudget;
+
+extern MemoryBudget *memory_budget_create (
+	u64 max_bytes, MemoryBudgetPolicy policy
+);
+
+extern void memory_budget_delete (void *budget_ptr);
+
+// returns true if the bytes don't fit in the budget
+extern bool memory_budget_exceeded (
+	const MemoryBudget *budget, u64 bytes
+);
+
+// returns true if the bytes would take the budget
+// over the percent of its max bytes
+extern bool memory_budget_above (
+	const MemoryBudget *budget, u64 bytes, unsigned int percent
+);
+
+// adds the bytes to the budget & to the owner's account
+extern void memory_budget_charge (
+	MemoryBudget *budget, u64 *account, u64 bytes
+);
+
+// removes the bytes from the budget & from the owner's account
+extern void memory_budget_release (
+	MemoryBudget *budget, u64 *account, u64 bytes
+);
+
+// waits up to MEMORY_BUDGET_WAIT_TIMEOUT for the bytes to fit
+// returns true if they fit
+extern bool memory_budget_wait (MemoryBudget *budget, u64 bytes);
+
+// wakes up any thread that is waiting for the budget
+extern void memory_budget_wake (MemoryBudget *budget);
+
+extern void memory_budget_print (const MemoryBudget *budget);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _PIXZO_CAMERA_HPP_
 #define _PIXZO_CAMERA_HPP_
 
+#include <pthread.h>
+
 #include <opencv2/videoio.hpp>
 
 #include <client/types/types.h>
@@ -21,6 +23,22 @@
 #define CAMERA_DEFAULT_EXPOSURE			155
 #define CAMERA_DEFAULT_SHARPNESS		0
 
+#define CAMERA_V4L2_DEFAULT_BUFFERS		4
+#define CAMERA_V4L2_MAX_BUFFERS			32
+#define CAMERA_V4L2_POLL_TIMEOUT		2000
+#define CAMERA_V4L2_CLOSE_TIMEOUT		2
+
+#define CAMERA_MODES_CACHE_SIZE			32
+
+// smaller rois can't be scaled for movement or pose
+#define CAMERA_MIN_CROP_SIZE			64
+
+#define CAMERA_MAX_FAILURES				10		// consecutive failed grabs
+#define CAMERA_RECONNECT_MIN_DELAY		250		// ms
+#define CAMERA_RECONNECT_MAX_DELAY		30000	// ms
+
+struct _PixzoFrame;
+
 #define CAMERA_TYPE_MAP(XX)				\
 	XX(0,	NONE, 		None)			\
 	XX(1,	MEDIA, 		Media)			\
@@ -38,6 +56,38 @@ typedef enum CameraType {
 
 extern const char *camera_type_to_string (CameraType type);
 
+#define CAMERA_BACKEND_MAP(XX)			\
+	XX(0,	OPENCV, 	OpenCV)			\
+	XX(1,	V4L2, 		V4L2)
+
+typedef enum CameraBackend {
+
+	#define XX(num, name, string) CAMERA_BACKEND_##name = num,
+	CAMERA_BACKEND_MAP (XX)
+	#undef XX
+
+} CameraBackend;
+
+extern const char *camera_backend_to_string (CameraBackend backend);
+
+extern CameraBackend camera_backend_from_string (const char *backend);
+
+#define CAMERA_STATE_MAP(XX)				\
+	XX(0,	NONE, 			None)			\
+	XX(1,	CONNECTED, 		Connected)		\
+	XX(2,	DISCONNECTED, 	Disconnected)	\
+	XX(3,	RECONNECTING, 	Reconnecting)
+
+typedef enum CameraState {
+
+	#define XX(num, name, string) CAMERA_STATE_##name = num,
+	CAMERA_STATE_MAP (XX)
+	#undef XX
+
+} CameraState;
+
+extern const char *camera_state_to_string (CameraState state);
+
 typedef enum CameraRotation {
 
 	CAMERA_ROTATION_NONE					= 0,
@@ -47,9 +97,41 @@ typedef enum CameraRotation {
 
 } CameraRotation;
 
+// a region of the captured frame (before rotation)
+struct _CameraRoi {
+
+	unsigned int x, y;
+	unsigned int width, height;
+
+};
+
+typedef struct _CameraRoi CameraRoi;
+
+// a capture mode supported by a device
+struct _CameraMode {
+
+	u32 pixel_format;
+	unsigned int width, height;
+	unsigned int fps;
+
+};
+
+typedef struct _CameraMode CameraMode;
+
+// a driver buffer mapped into our address space
+struct _CameraBuffer {
+
+	void *start;
+	size_t length;
+
+};
+
+typedef struct _CameraBuffer CameraBuffer;
+
 struct _Camera {
 
 	CameraType type;
+	CameraBackend backend;
 
 	u8 device_idx;				// open normal devices (webcam)
 
@@ -64,10 +146,17 @@ struct _Camera {
 
 	unsigned int preferred_width, preferred_height;
 	unsigned int real_width, real_height;
+	unsigned int capture_width, capture_height;	// before rotation & roi
+
+	CameraRoi roi;				// the requested region (0 width for the whole frame)
+	CameraRoi crop;				// the roi clamped to the captured size
 
 	unsigned int preferred_fps;
 	unsigned int real_fps;
 
+	u32 preferred_pixel_format;	// 0 to negotiate the best one
+	CameraMode mode;			// the best supported mode for our preferences
+
 	double auto_exposure;
 	double brightness;
 	double contrast;
@@ -79,6 +168,35 @@ struct _Camera {
 	u64 total_frames;
 	cv::VideoCapture *capture;
 
+	// connection state - set by the thread that grabs
+	// and read by the stream's thread to reconnect
+	CameraState state;
+	unsigned int n_failures;	// consecutive failed grabs
+	unsigned int reconnect_delay;	// ms to wait before the next attempt
+	u64 n_reconnects;
+
+	// values of the last grabbed frame
+	time_t grab_time;
+	u64 grab_ns;
+	u64 grab_driver_ns;
+	bool passthrough;			// keep the compressed MJPEG frames
+	bool passthrough_mjpeg;		// the capture confirmed that it sends MJPEG frames
+
+	// V4L2 backend - frames wrap the mmap'd driver buffers
+	int fd;
+	u32 pixel_format;
+	unsigned int bytes_per_line;
+	unsigned int n_buffers;
+	CameraBuffer buffers[CAMERA_V4L2_MAX_BUFFERS];
+	unsigned int n_queued;		// owned by the driver
+	unsigned int n_dequeued;	// owned by us (grabbed or wrapped by frames)
+	bool streaming;
+	u32 generation;				// incremented every time the device is closed
+	int grabbed_idx;
+	u32 grabbed_bytes;
+	pthread_mutex_t *buffers_mutex;
+	pthread_cond_t *buffers_cond;
+
 };
 
 typedef struct _Camera Camera;
@@ -106,11 +224,46 @@ extern void camera_set_source (
 	Camera *cam, const char *device_name
 );
 
+// sets the backend to be used to capture frames
+// CAMERA_BACKEND_V4L2 is only available for CAMERA_TYPE_MEDIA
+extern void camera_set_backend (
+	Camera *cam, CameraBackend backend
+);
+
+// sets the preferred V4L2 pixel format using its fourcc string (like "YUYV")
+// if it is not set, the best format for the resolution is negotiated
+extern void camera_set_pixel_format (
+	Camera *cam, const char *fourcc
+);
+
+// keeps the compressed MJPEG bitstream of each frame
+// so it is only decoded when its pixels are requested
+extern void camera_set_passthrough (
+	Camera *cam, bool passthrough
+);
+
+// sets how many driver buffers to request with the V4L2 backend
+extern void camera_set_n_buffers (
+	Camera *cam, unsigned int n_buffers
+);
+
 // set the rotation to be applied to every new frame
 extern void camera_set_rotation (
 	Camera *cam, CameraRotation rotation
 );
 
+// only keeps this region of every captured frame
+// coordinates are relative to the frame before being rotated
+// the cropped size becomes the camera's real size
+extern void camera_set_roi (
+	Camera *cam,
+	unsigned int x, unsigned int y,
+	unsigned int width, unsigned int height
+);
+
+// returns true if the camera only keeps a region of its frames
+extern bool camera_is_cropped (const Camera *cam);
+
 // sets the prefered resolution
 // returns 0 on success, 1 on error
 extern unsigned int camera_set_resolution (
@@ -138,6 +291,40 @@ extern u8 camera_get (Camera *cam, cv::Mat *frame);
 
 extern cv::Mat *camera_get (Camera *cam);
 
+// grabs the next frame from the device without decoding it
+// so that many cameras can be grabbed back to back
+// returns 0 on success, 1 on error
+extern u8 camera_grab (Camera *cam);
+
+// gets the last grabbed frame into a pixzo frame
+// with the V4L2 backend, the frame wraps the driver buffer
+// until it is returned with camera_buffer_release ()
+// returns 0 on success, 1 on error
+extern u8 camera_retrieve (Camera *cam, struct _PixzoFrame *pixzo_frame);
+
+// gets the next camera frame into a pixzo frame
+// with the V4L2 backend, the frame wraps the driver buffer
+// until it is returned with camera_buffer_release ()
+// returns 0 on success, 1 on error
+extern u8 camera_get (Camera *cam, struct _PixzoFrame *pixzo_frame);
+
+// returns a dequeued V4L2 buffer back to the driver
+// buffers from a previous session (before a reconnect) are ignored
+extern void camera_buffer_release (
+	Camera *cam, int buffer_idx, u32 generation
+);
+
+// returns the camera's current connection state
+extern CameraState camera_get_state (const Camera *cam);
+
+// returns how many ms to wait before trying to reconnect
+// doubles after every failed attempt up to CAMERA_RECONNECT_MAX_DELAY
+extern unsigned int camera_get_reconnect_delay (const Camera *cam);
+
+// closes & opens again a disconnected camera
+// returns true on success, false on error
+extern bool camera_reconnect (Camera *cam);
+
 // closes the camera's video capture
 extern void camera_close (Camera *cam);
 
@@ -10,6 +10,8 @@
 #define CONFIG_DEFAULT_NO_MOVEMENT_FRAMES      	60
 
 #define CONFIG_DEFAULT_MAX_ACTIONS_MEM_SIZE		2
+#define CONFIG_DEFAULT_MAX_ACTION_FRAMES		240		// 10 seconds at 24 fps
+#define CONFIG_DEFAULT_MEMORY_COMPRESSION		"none"
 
 #define CONFIG_DEFAULT_VIDEOS_N_LOOPS			1
 
@@ -18,6 +20,23 @@
 
 #define CONFIG_DEFAULT_RECORD					false
 
+#define CONFIG_DEFAULT_SYNC_CAPTURE				false
+
+#define CONFIG_DEFAULT_HUGE_PAGES				false
+
+#define CONFIG_DEFAULT_MEMORY_BUDGET			0		// MB, no limit
+#define CONFIG_DEFAULT_MEMORY_POLICY			"drop_oldest"
+
+#define CONFIG_DEFAULT_SPILL_SEGMENT_SIZE		64		// MB
+#define CONFIG_DEFAULT_SPILL_SEGMENTS			8
+
+#define CONFIG_DEFAULT_WORKERS					0		// one per online cpu
+
+#define CONFIG_DEFAULT_SHUTDOWN_TIMEOUT			3000	// ms
+
+#define CONFIG_DEFAULT_CAPTURE_SCHED			"none"
+#define CONFIG_DEFAULT_CAPTURE_PRIORITY			50
+
 #define CONFIG_DEFAULT_CAMS_SETTINGS			"config/cams.json"
 
 #define CONFIG_DEFAULT_CONNECT					true
@@ -41,6 +60,8 @@ typedef struct Config {
 	unsigned int max_no_movement_frames;
 
 	unsigned int max_actions_memory_size;
+	unsigned int max_action_frames;
+	const char *memory_compression;
 
 	unsigned int videos_n_loops;
 
@@ -50,6 +71,25 @@ typedef struct Config {
 	bool record;
 	const char *output_path;
 
+	bool sync_capture;
+
+	bool huge_pages;
+
+	unsigned int memory_budget;
+	const char *memory_policy;
+
+	const char *spill_path;
+	unsigned int spill_segment_size;
+	unsigned int spill_segments;
+
+	unsigned int workers;
+	const char *workers_cpus;
+
+	unsigned int shutdown_timeout;
+
+	const char *capture_sched;
+	unsigned int capture_priority;
+
 	const char *cams_settings_filename;
 
 	bool connect;
@@ -0,0 +1,107 @@
+#ifndef _PIXZO_EXECUTOR_HPP_
+#define _PIXZO_EXECUTOR_HPP_
+
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#include "affinity.hpp"
+
+#define EXECUTOR_CACHE_LINE						64
+
+#define EXECUTOR_MAX_WORKERS					64
+#define EXECUTOR_WORKER_QUEUE_SIZE				256		// power of 2
+
+#define EXECUTOR_IDLE_TIMEOUT					100		// ms
+
+typedef void (*ExecutorWork) (void *args);
+
+struct _ExecutorTask {
+
+	ExecutorWork work;
+	void *args;
+
+};
+
+typedef struct _ExecutorTask ExecutorTask;
+
+struct _Executor;
+
+// every worker runs the tasks from its own queue (newest first)
+// and steals the oldest ones from the others when it is empty
+struct _ExecutorWorker {
+
+	alignas (EXECUTOR_CACHE_LINE) pthread_mutex_t *mutex;
+	u64 head;					// the oldest task, taken by thieves
+	u64 tail;					// the next free slot, used by its owner
+	ExecutorTask *tasks;
+
+	struct _Executor *executor;
+	unsigned int idx;
+	pthread_t thread_id;
+
+	// stats
+	u64 n_tasks;
+	u64 n_stolen;				// tasks taken from other workers
+	u64 n_sleeps;
+
+};
+
+typedef struct _ExecutorWorker ExecutorWorker;
+
+// a fixed set of worker threads shared by every stream
+struct _Executor {
+
+	ExecutorWorker *workers;
+	unsigned int n_workers;
+
+	bool running;
+	unsigned int next_worker;	// for tasks submitted outside the workers
+
+	u64 pending;				// tasks waiting in every queue
+	unsigned int n_idle;
+
+	pthread_mutex_t *idle_mutex;
+	pthread_cond_t *idle_cond;
+
+	ThreadAffinity affinity;	// applied to every worker
+
+	// stats
+	u64 n_inline;				// tasks run by the submitter as every queue was full
+
+};
+
+typedef struct _Executor Executor;
+
+// creates a new executor with n_workers threads
+// 0 to use one worker for each online cpu
+extern Executor *executor_create (unsigned int n_workers);
+
+// stops the executor if it was still running
+extern void executor_delete (void *executor_ptr);
+
+// sets where the workers run
+// must be called before the executor is started
+extern void executor_set_affinity (
+	Executor *executor, const ThreadAffinity *affinity
+);
+
+// creates the workers' threads
+// returns 0 on success, 1 on error
+extern unsigned int executor_start (Executor *executor);
+
+// queues a new task to be run by any worker
+// tasks submitted by a worker are added to its own queue
+extern void executor_submit (
+	Executor *executor, ExecutorWork work, void *args
+);
+
+// waits for the workers to finish their queued tasks
+// and then stops them
+extern void executor_stop (Executor *executor);
+
+extern void executor_print (const Executor *executor);
+
+#endif
@@ -5,25 +5,86 @@
 
 #include <time.h>
 
+#include <pthread.h>
+
 #include <vector>
 
 #include <opencv2/core/mat.hpp>
 
 #include <client/types/types.h>
 
+#include "camera.hpp"
+
+struct _MemoryBudget;
+
 #define DEFAULT_FRAMES_POOL_INIT			64
 
-extern unsigned int pixzo_frames_init (void);
+#define FRAMES_HUGE_PAGE_SIZE				(2 * 1024 * 1024)
+#define FRAMES_ARENA_CACHE_SIZE				64
+
+#define FRAMES_ARENA_BLOCK_HUGETLB			1
+#define FRAMES_ARENA_BLOCK_THP				2
+
+#define FRAMES_COMPRESS_PNG_LEVEL			1		// fastest
+#define FRAMES_COMPRESS_JPEG_QUALITY		95
+
+// the frames' pixels are allocated from huge pages when enabled
+extern unsigned int pixzo_frames_init (bool huge_pages);
 
 extern void pixzo_frames_end (void);
 
+struct _PixzoFramesArenaStats {
+
+	u64 hugetlb_bytes;			// backed by reserved huge pages (MAP_HUGETLB)
+	u64 thp_bytes;				// advised to use transparent huge pages
+	u64 n_blocks;				// mapped blocks (in use & cached)
+	u64 n_reused;				// allocations served by a cached block
+	u64 n_small;				// allocations left to the default allocator
+
+};
+
+typedef struct _PixzoFramesArenaStats PixzoFramesArenaStats;
+
+// returns the allocator to be used for the frames' pixels
+// or NULL to use OpenCV's default one
+extern cv::MatAllocator *pixzo_frames_allocator (void);
+
+// gets the current arena values
+extern void pixzo_frames_arena_get_stats (PixzoFramesArenaStats *stats);
+
+extern void pixzo_frames_arena_print (void);
+
+#define PIXZO_FRAME_FORMAT_MAP(XX)		\
+	XX(0,	NONE, 		None)			\
+	XX(1,	BGR, 		BGR)			\
+	XX(2,	YUYV, 		YUYV)			\
+	XX(3,	MJPEG, 		MJPEG)			\
+	XX(4,	PNG, 		PNG)
+
+typedef enum PixzoFrameFormat {
+
+	#define XX(num, name, string) PIXZO_FRAME_FORMAT_##name = num,
+	PIXZO_FRAME_FORMAT_MAP (XX)
+	#undef XX
+
+} PixzoFrameFormat;
+
+extern const char *pixzo_frame_format_to_string (
+	PixzoFrameFormat format
+);
+
 struct _PixzoFrameInfo {
 
 	char store_id[32];			// the store this frame belongs to
 	u32 stream_id;				// the stream this frame belongs to
 	u64 frame_id;         		// the unique id of this frame
-	u32 action_id;				// thec action this frame belongs to
-	time_t timestamp;           // the time when the frame was taken
+	u32 action_id;				// the action this frame belongs to (only set when read back from the spill log)
+	time_t timestamp;           // the wall clock time when the frame was captured
+	u64 capture_ns;				// monotonic time when the frame was captured
+	u64 driver_ns;				// the driver's buffer timestamp (0 if not available)
+	u64 capture_tick;			// the store's capture tick (synchronized capture)
+
+	CameraRotation rotation;	// still needs to be applied to the pixels
 
 	unsigned int width;
 	unsigned int height;
@@ -34,14 +95,85 @@ typedef struct _PixzoFrameInfo PixzoFrameInfo;
 
 struct _PixzoFrame {
 
+	// set when the frame is captured
+	// it is never changed after the frame has been shared
 	PixzoFrameInfo info;
 
+	PixzoFrameFormat format;	// the format of the captured data
+	cv::Mat *raw;				// captured data, may wrap a driver buffer
+	CameraRoi crop;				// to be applied when the data is decoded (0 width for none)
+
+	bool decoded;				// frame has the BGR pixels
 	cv::Mat *frame;				// the original frame that we read from media device
+	cv::Mat *pixels;			// the BGR buffer that frame references, kept between uses
+
+	struct _Camera *cam;		// the camera that owns the raw driver buffer
+	int buffer_idx;				// the driver buffer to return on delete
+	u32 buffer_generation;		// the camera session the buffer belongs to
+
+	struct _PixzoFramesPool *pool;	// the pool to return to on delete
+	struct _PixzoFrame *next;		// used by the pool lists
+
+	// every consumer shares the same frame
+	// it is deleted when the last one releases it
+	unsigned int ref_count;
+	pthread_mutex_t *decode_mutex;	// only one consumer decodes the frame
+
+	// the memory budget the frame is charged to until it is deleted
+	struct _MemoryBudget *budget;
+	u64 *budget_account;			// the owner's (stream) bytes
+	u64 budget_bytes;
 
 };
 
 typedef struct _PixzoFrame PixzoFrame;
 
+// a pool of frames owned by a single thread (the stream's capture)
+// frames are only taken by the owner & can be returned by any thread
+// without locks through the returned stack, that the owner drains at once
+struct _PixzoFramesPool {
+
+	unsigned int width, height;		// the size of the frames' pixels
+
+	PixzoFrame *available;			// only used by the owner
+	PixzoFrame *returned;			// lock-free stack for the returns
+
+	// stats
+	unsigned int size;				// frames created by this pool
+	unsigned int in_use;
+	unsigned int high_water;		// max frames in use at the same time
+	u64 misses;						// gets that had to create a new frame
+
+};
+
+typedef struct _PixzoFramesPool PixzoFramesPool;
+
+// creates a new pool with n frames that already have
+// (touched) pixel buffers of the captured size
+// so that capturing does not need to allocate them
+extern PixzoFramesPool *pixzo_frames_pool_create (
+	unsigned int width, unsigned int height, unsigned int n_frames
+);
+
+// all the frames must have been returned before
+extern void pixzo_frames_pool_delete (void *pool_ptr);
+
+// gets an available frame, or creates a new one
+// must only be called by the pool's owner
+extern PixzoFrame *pixzo_frames_pool_get (PixzoFramesPool *pool);
+
+// gets a frame from the returned ones, or creates a new one
+// can be called from any thread, unlike pixzo_frames_pool_get ()
+extern PixzoFrame *pixzo_frames_pool_get_shared (PixzoFramesPool *pool);
+
+// returns a frame to its pool
+// can be called from any thread
+extern void pixzo_frames_pool_return (
+	PixzoFramesPool *pool, PixzoFrame *pixzo_frame
+);
+
+extern void pixzo_frames_pool_print (const PixzoFramesPool *pool);
+
 extern PixzoFrame *pixzo_frame_new (void);
 
 extern void pixzo_frame_delete_internal (
@@ -62,6 +194,98 @@ extern void *pixzo_frame_create (void);
 
 extern PixzoFrame *pixzo_frame_get (void);
 
+// sets how many consumers are going to release the frame
+// must be called before the frame is shared
+extern void pixzo_frame_set_refs (
+	PixzoFrame *pixzo_frame, unsigned int ref_count
+);
+
+// adds a reference for a new consumer of an already shared frame
+extern void pixzo_frame_ref (PixzoFrame *pixzo_frame);
+
+// releases a consumer's reference
+// the frame is deleted when it was the last one
+extern void pixzo_frame_release (PixzoFrame *pixzo_frame);
+
+// gets a new reference to a frame that can be held for a long time
+// frames that wrap a driver buffer are detached from it
+// by copying their captured data (compressed data stays compressed)
+// or copied if other consumers are still using the buffer
+// the new memory is charged to the frame's budget & account
+// must be released with pixzo_frame_release ()
+extern PixzoFrame *pixzo_frame_keep (PixzoFrame *pixzo_frame);
+
+// creates a new frame with the compressed version of the frame's data
+// already compressed frames (MJPEG or PNG) keep their original data
+// any other one is encoded into format (PNG or MJPEG)
+// must be released with pixzo_frame_release ()
+extern PixzoFrame *pixzo_frame_compress (
+	PixzoFrame *pixzo_frame, PixzoFrameFormat format
+);
+
+// creates a new frame that references the same captured data
+// to be decoded on its own (the original one stays compressed)
+// must be released with pixzo_frame_release ()
+extern PixzoFrame *pixzo_frame_share (const PixzoFrame *pixzo_frame);
+
+// returns the size in bytes of the frame's captured data
+extern size_t pixzo_frame_data_size (const PixzoFrame *pixzo_frame);
+
+// returns the bytes of memory that the frame is using
+// driver buffers are not counted as they are always mapped
+extern u64 pixzo_frame_memory_size (const PixzoFrame *pixzo_frame);
+
+// charges the frame's memory to the budget & the owner's account
+// until it is deleted, only the first charge is counted
+// any memory the frame grows when it is decoded is charged after it
+extern void pixzo_frame_charge (
+	PixzoFrame *pixzo_frame, struct _MemoryBudget *budget, u64 *account
+);
+
+// returns the current CLOCK_MONOTONIC time in nanoseconds
+extern u64 pixzo_frame_time_ns (void);
+
+// returns the nanoseconds that have passed since the frame was captured
+extern u64 pixzo_frame_latency_ns (const PixzoFrame *pixzo_frame);
+
+// returns true if the frame has no captured data
+extern bool pixzo_frame_empty (const PixzoFrame *pixzo_frame);
+
+// converts captured data in the given format into BGR pixels
+extern void pixzo_frame_decode_data (
+	PixzoFrameFormat format, const cv::Mat &raw, cv::Mat &frame
+);
+
+// gets the frame's BGR pixels
+// converting (or decoding) the captured data
+// only the first time it is requested
+// the pixels are NOT rotated, info.rotation still needs to be applied
+extern cv::Mat *pixzo_frame_decode (PixzoFrame *pixzo_frame);
+
+// gets the frame's full resolution BGR pixels with its rotation applied
+// only use when the rotated full resolution pixels are really needed
+// and the frame has not been shared with other consumers
+extern cv::Mat *pixzo_frame_decode_rotated (PixzoFrame *pixzo_frame);
+
+// resizes the frame's pixels to size, which is already rotated
+// the rotation is applied to the resized frame instead of the full one
+// scaled is used as a working buffer and can be reused between calls
+// dst is left empty if the frame could not be decoded
+extern void pixzo_frame_resize (
+	PixzoFrame *pixzo_frame, const cv::Size &size,
+	cv::Mat &scaled, cv::Mat &dst
+);
+
+// creates a reduced gray scale version of the frame with the requested size
+// MJPEG frames are decoded straight at 1/2, 1/4 or 1/8 scale with DCT scaling
+// so the full resolution frame is never decoded for this
+// scaled & reduced are used as working buffers and can be reused between calls
+// returns 0 on success, 1 on error (gray is left empty)
+extern u8 pixzo_frame_gray_scaled (
+	PixzoFrame *pixzo_frame, const cv::Size &size,
+	cv::Mat &scaled, cv::Mat &reduced, cv::Mat &gray
+);
+
 // encodes a cv::Mat input image into a jpeg image
 // that can be sent to the pose cerver
 extern std::vector <uchar> *pixzo_frame_encode_input (
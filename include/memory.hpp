@@ -0,0 +1,160 @@
+#ifndef _PIXZO_MEMORY_HPP_
+#define _PIXZO_MEMORY_HPP_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <time.h>
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#include "spill.hpp"
+
+// max frames in an action's index when they can be spilled
+#define MEMORY_ACTION_MAX_INDEX				(1 << 16)
+
+struct _PixzoFrame;
+struct _MemoryBudget;
+
+#define MEMORY_COMPRESSION_MAP(XX)			\
+	XX(0,	NONE, 		none)				\
+	XX(1,	PNG, 		png)				\
+	XX(2,	JPEG, 		jpeg)
+
+typedef enum MemoryCompression {
+
+	#define XX(num, name, string) MEMORY_COMPRESSION_##name = num,
+	MEMORY_COMPRESSION_MAP (XX)
+	#undef XX
+
+} MemoryCompression;
+
+extern const char *memory_compression_to_string (
+	MemoryCompression compression
+);
+
+// returns NONE for NULL or unknown values
+extern MemoryCompression memory_compression_from_string (
+	const char *string
+);
+
+// a frame is either held in memory or spilled to the log
+struct _MemoryFrame {
+
+	struct _PixzoFrame *frame;
+	SpillLocation spilled;
+
+};
+
+typedef struct _MemoryFrame MemoryFrame;
+
+// a stream's action (movement) and the frames that belong to it
+// frames are indexed by their offset from the action's first frame id
+struct _MemoryAction {
+
+	u32 action_id;				// 0 if the slot is empty
+	bool active;				// still receiving frames
+
+	time_t start;
+	time_t end;
+
+	u64 first_frame_id;
+	MemoryFrame *frames;		// empty for frames that were not kept
+	unsigned int n_slots;		// frame ids covered from the first one
+	unsigned int capacity;
+
+	unsigned int n_frames;		// frames that are being held
+	unsigned int n_spilled;		// frames that were written to the log
+	unsigned int n_dropped;		// frames that did not fit
+	size_t n_bytes;				// captured data held by the frames
+
+};
+
+typedef struct _MemoryAction MemoryAction;
+
+// ring with the last actions of a stream
+// an action's slot is its id modulo the ring's size
+struct _ActionsMemory {
+
+	u32 next_action_id;
+
+	unsigned int max_actions;
+	MemoryAction *actions;
+
+	unsigned int max_action_frames;
+	unsigned int batch_size;	// an action's first frame slots, doubled as it grows
+
+	// frames are held compressed & decoded when requested
+	// MJPEG frames always keep their original bitstream
+	MemoryCompression compression;
+
+	// the held frames are charged to the budget
+	struct _MemoryBudget *budget;
+	u64 *budget_account;
+
+	// frames that don't fit in memory are written here
+	SpillLog *spill;
+
+	pthread_mutex_t *mutex;
+
+};
+
+typedef struct _ActionsMemory ActionsMemory;
+
+extern ActionsMemory *actions_memory_create (
+	unsigned int max_actions,
+	unsigned int max_action_frames, unsigned int batch_size,
+	MemoryCompression compression
+);
+
+extern void actions_memory_delete (void *memory_ptr);
+
+// the held frames are charged to the budget & the owner's account
+// older ended actions are evicted first for the frames that don't fit
+// and the ones that still don't fit are not kept
+extern void actions_memory_set_budget (
+	ActionsMemory *memory,
+	struct _MemoryBudget *budget, u64 *budget_account
+);
+
+// evicts the oldest ended actions until the bytes fit in the budget
+// returns 0 on success, 1 if they still don't fit
+extern unsigned int actions_memory_evict (
+	ActionsMemory *memory, u64 bytes
+);
+
+// frames that don't fit in memory (too many for an action or over budget)
+// are written to the log instead of being dropped
+// the log is owned by the caller & must outlive the memory's use
+extern void actions_memory_set_spill (
+	ActionsMemory *memory, SpillLog *spill
+);
+
+// starts a new action, replacing the oldest one in the ring
+// returns the new action's id
+extern u32 actions_memory_action_start (ActionsMemory *memory);
+
+// marks the action as ended, its frames are kept
+extern void actions_memory_action_end (
+	ActionsMemory *memory, u32 action_id
+);
+
+// keeps a reference to the frame in the action
+// the frame is shared so it is never changed
+// returns 0 on success, 1 if the frame was not kept
+extern unsigned int actions_memory_push (
+	ActionsMemory *memory, struct _PixzoFrame *pixzo_frame, u32 action_id
+);
+
+// gets a frame from its action in O(1)
+// compressed & spilled frames are returned as a new frame that decodes on demand
+// returns a new reference that must be released
+// with pixzo_frame_release (), NULL if not found
+extern struct _PixzoFrame *actions_memory_get_frame (
+	ActionsMemory *memory, u32 action_id, u64 frame_id
+);
+
+extern void actions_memory_print (const ActionsMemory *memory);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _PIXZO_MOVEMENT_HPP_
+#define _PIXZO_MOVEMENT_HPP_
+
+#include <opencv2/core/mat.hpp>
+
+#include <client/types/types.h>
+
+#define MOVEMENT_KERNEL_MAP(XX)					\
+	XX(0,	SCALAR, 		scalar)				\
+	XX(1,	SSE2, 			sse2)				\
+	XX(2,	AVX2, 			avx2)
+
+typedef enum MovementKernel {
+
+	#define XX(num, name, string) MOVEMENT_KERNEL_##name = num,
+	MOVEMENT_KERNEL_MAP (XX)
+	#undef XX
+
+} MovementKernel;
+
+extern const char *movement_kernel_to_string (MovementKernel kernel);
+
+// selects the best kernel that the running cpu supports
+// must be called once before any frame is compared
+extern void movement_init (void);
+
+extern MovementKernel movement_get_kernel (void);
+
+// counts the pixels that differ more than threshold from the previous frame
+// the absolute difference, the threshold & the count are done in a single sweep
+// returns 0 if the images' sizes do not match
+extern unsigned int movement_count (
+	const cv::Mat &gray, const cv::Mat &previous, u8 threshold
+);
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef _PIXZO_PIPELINE_HPP_
+#define _PIXZO_PIPELINE_HPP_
+
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#define PIPELINE_MAX_STAGES						8
+#define PIPELINE_STAGE_MAX_THREADS				8
+#define PIPELINE_STAGE_NAME_SIZE				64
+
+#define DEFAULT_PIPELINE_QUEUE_SIZE				16
+
+// how long the cancelled items have to go through the last stage
+#define PIPELINE_CANCEL_TIMEOUT					1000	// ms
+
+// items that an executor's task works on before
+// giving the other pipelines' stages a chance to run
+#define PIPELINE_DRAIN_BATCH					8
+
+#define PIPELINE_STAGE_TYPE_MAP(XX)				\
+	XX(0,	NONE, 			none)				\
+	XX(1,	CAPTURE, 		capture)			\
+	XX(2,	DECODE, 		decode)				\
+	XX(3,	PREPROCESS, 	preprocess)			\
+	XX(4,	MOVEMENT, 		movement)			\
+	XX(5,	ENCODE, 		encode)				\
+	XX(6,	SINK, 			sink)
+
+#define PIPELINE_STAGE_TYPES					7
+
+typedef enum PipelineStageType {
+
+	#define XX(num, name, string) PIPELINE_STAGE_TYPE_##name = num,
+	PIPELINE_STAGE_TYPE_MAP (XX)
+	#undef XX
+
+} PipelineStageType;
+
+extern const char *pipeline_stage_type_to_string (
+	PipelineStageType type
+);
+
+// returns NONE for NULL or unknown values
+extern PipelineStageType pipeline_stage_type_from_string (
+	const char *string
+);
+
+// bounded queue between two stages
+// items are taken in the same order they entered the pipeline
+// even if the previous stage finished them out of order
+struct _PipelineQueue {
+
+	void **items;				// indexed by the item's sequence
+	bool *used;
+	unsigned int capacity;
+
+	u64 next;					// the sequence of the next item to take
+	bool closed;
+
+	pthread_mutex_t *mutex;
+	pthread_cond_t *has_items;
+	pthread_cond_t *has_room;
+
+	// the executor's tasks that are taking items
+	unsigned int n_active;
+	unsigned int max_active;
+
+	// stats
+	unsigned int max_size;
+
+};
+
+typedef struct _PipelineQueue PipelineQueue;
+
+struct _Pipeline;
+struct _Executor;
+
+// works on an item, that is then passed to the next stage
+typedef void (*PipelineStageWork) (void *args, void *item);
+
+// called after an item has gone through the last stage
+typedef void (*PipelineDone) (void *args);
+
+struct _PipelineStage {
+
+	PipelineStageType type;
+	char name[PIPELINE_STAGE_NAME_SIZE];
+
+	struct _Pipeline *pipeline;
+
+	PipelineStageWork work;
+	PipelineQueue *queue;		// the stage's input
+
+	unsigned int n_threads;		// or the executor's tasks at the same time
+	pthread_t threads[PIPELINE_STAGE_MAX_THREADS];
+
+	// stats
+	u64 n_items;
+	u64 busy_ns;				// time spent in work
+
+};
+
+typedef struct _PipelineStage PipelineStage;
+
+// stages connected by bounded queues
+// every item goes through every stage in the order they were added
+// so stages that need to see the items in order must have a single thread
+// the stages either have their own threads or run as an executor's tasks
+struct _Pipeline {
+
+	void *args;					// passed to every stage's work
+
+	PipelineStage stages[PIPELINE_MAX_STAGES];
+	unsigned int n_stages;
+
+	struct _Executor *executor;
+
+	u64 next_seq;				// only used by the producer
+	bool running;
+	bool cancelled;				// the items that are left skip their work
+
+	// items that have not gone through the last stage
+	unsigned int n_in_flight;
+	unsigned int max_in_flight;
+
+	PipelineDone done;
+	void *done_args;
+
+	pthread_mutex_t *mutex;
+	pthread_cond_t *drained;
+
+};
+
+typedef struct _Pipeline Pipeline;
+
+extern Pipeline *pipeline_create (void *args);
+
+// the pipeline must have been stopped before
+extern void pipeline_delete (void *pipeline_ptr);
+
+// adds a stage after the last one
+// returns 0 on success, 1 on error
+extern unsigned int pipeline_add_stage (
+	Pipeline *pipeline, PipelineStageType type, const char *name,
+	PipelineStageWork work, unsigned int n_threads, unsigned int queue_size
+);
+
+// runs the stages as the executor's tasks instead of their own threads
+// where each stage's threads are the max tasks that run at the same time
+// must be called before the pipeline is started
+extern void pipeline_set_executor (
+	Pipeline *pipeline, struct _Executor *executor
+);
+
+// sets the method to call every time an item leaves the pipeline
+// so the producer knows that there is room for a new one
+// must be called before the pipeline is started
+extern void pipeline_set_done (
+	Pipeline *pipeline, PipelineDone done, void *done_args
+);
+
+// creates every stage's threads, unless they run in an executor
+// returns 0 on success, 1 on error
+extern unsigned int pipeline_start (Pipeline *pipeline);
+
+// adds a new item to the first stage
+// with its own threads, it waits if the stage is full
+// with an executor, it never waits and full pipelines don't take the item
+// returns 0 on success, 1 if the item was not taken
+extern unsigned int pipeline_push (Pipeline *pipeline, void *item);
+
+// returns true if the running pipeline can take a new item right away
+extern bool pipeline_has_room (const Pipeline *pipeline);
+
+// waits up to timeout ms (0 for no limit) until every item has gone
+// through every stage, after it the items that are left only go through
+// the last one for up to PIPELINE_CANCEL_TIMEOUT, so it can still release them,
+// and then stops the stages' threads
+// returns 0 if every item was handled, 1 if some were cancelled
+extern unsigned int pipeline_stop (Pipeline *pipeline, unsigned int timeout);
+
+// the pipeline was stopped before its items were handled
+// so the last stage should only release them
+extern bool pipeline_is_cancelled (const Pipeline *pipeline);
+
+extern void pipeline_print (const Pipeline *pipeline);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _PIXZO_RING_HPP_
+#define _PIXZO_RING_HPP_
+
+#include <stdbool.h>
+
+#include <client/types/types.h>
+
+#define FRAMES_RING_CACHE_LINE				64
+
+struct _PixzoFrame;
+
+// fixed size single producer / single consumer ring of frames
+// the producer & consumer indexes live in their own cache lines
+struct _FramesRing {
+
+	// written by the producer
+	alignas (FRAMES_RING_CACHE_LINE) u64 head;
+
+	// written by the consumer
+	alignas (FRAMES_RING_CACHE_LINE) u64 tail;
+
+	// frames that the consumer has to drop before handling a new one
+	alignas (FRAMES_RING_CACHE_LINE) unsigned int drop_requests;
+
+	alignas (FRAMES_RING_CACHE_LINE) unsigned int capacity;	// power of 2
+	unsigned int mask;
+	struct _PixzoFrame **frames;
+
+	// stats
+	u64 n_full;					// pushes that found the ring full
+	u64 n_dropped;				// frames dropped by request (only written by the consumer)
+
+};
+
+typedef struct _FramesRing FramesRing;
+
+// creates a new ring that can hold at least capacity frames
+extern FramesRing *frames_ring_create (unsigned int capacity);
+
+// the ring must be empty, frames are not released
+extern void frames_ring_delete (void *ring_ptr);
+
+// returns the number of frames in the ring
+extern unsigned int frames_ring_size (const FramesRing *ring);
+
+// adds a frame to the ring
+// must only be called by the producer
+// returns true on success, false if the ring was full
+extern bool frames_ring_push (FramesRing *ring, struct _PixzoFrame *frame);
+
+// removes the oldest frame from the ring without waiting
+// must only be called by the consumer
+// returns NULL if the ring is empty
+extern struct _PixzoFrame *frames_ring_pop (FramesRing *ring);
+
+// asks the consumer to drop (release) the oldest frame
+// as the producer can't remove frames from the ring
+// must only be called by the producer
+// returns true if the request was accepted
+// false if every frame in the ring is already going to be dropped
+extern bool frames_ring_request_drop (FramesRing *ring);
+
+extern void frames_ring_print (const FramesRing *ring);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef _PIXZO_SPILL_HPP_
+#define _PIXZO_SPILL_HPP_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#define SPILL_LOG_PATH_SIZE					1024
+
+#define SPILL_LOG_RECORD_MAGIC				0x46585a50		// PZXF
+
+struct _PixzoFrame;
+
+// where a frame was written in the log
+// a generation of 0 means that the frame was never spilled
+struct _SpillLocation {
+
+	u32 segment;
+	u32 generation;			// the segment's generation when it was written
+	u64 offset;
+
+};
+
+typedef struct _SpillLocation SpillLocation;
+
+// a fixed size file that is mapped into memory
+struct _SpillSegment {
+
+	char filename[SPILL_LOG_PATH_SIZE];
+	int fd;
+
+	unsigned char *data;
+	size_t size;
+
+	u32 generation;			// incremented every time it is recycled
+
+};
+
+typedef struct _SpillSegment SpillSegment;
+
+// append-only log of compressed frames on local disk
+// segments are reused in a ring, so the oldest frames are lost first
+struct _SpillLog {
+
+	SpillSegment *segments;
+	unsigned int n_segments;
+	size_t segment_size;
+
+	unsigned int current;	// the segment being written
+	size_t offset;			// next write position in the current one
+	u32 next_generation;
+
+	// stats
+	u64 n_spilled;
+	u64 n_recycled;			// segments that were overwritten
+	u64 n_bytes;
+
+	pthread_mutex_t *mutex;
+
+};
+
+typedef struct _SpillLog SpillLog;
+
+// creates & maps the log's segments in path
+// using name to create their filenames
+// returns NULL on error
+extern SpillLog *spill_log_create (
+	const char *path, const char *name,
+	size_t segment_size, unsigned int n_segments
+);
+
+// unmaps & removes the log's segments
+extern void spill_log_delete (void *log_ptr);
+
+// writes the frame's compressed data to the log
+// with the action it belongs to in the record's info
+// the frame's data must already be compressed (MJPEG or PNG)
+// returns 0 on success, 1 on error
+extern unsigned int spill_log_append (
+	SpillLog *log, const struct _PixzoFrame *pixzo_frame,
+	u32 action_id, SpillLocation *location
+);
+
+// reads a frame back from the log into a new frame
+// that decodes its data on demand
+// returns NULL if the frame's segment has already been recycled
+// or a new reference that must be released with pixzo_frame_release ()
+extern struct _PixzoFrame *spill_log_read (
+	SpillLog *log, const SpillLocation *location,
+	u32 action_id, u64 frame_id
+);
+
+extern void spill_log_print (const SpillLog *log);
+
+#endif
@@ -14,8 +14,12 @@
 #define STORE_NAME_SIZE				1024
 #define STORE_LOCATION_SIZE			1024
 
+#define STORE_THREAD_NAME_SIZE		64
+
 struct _Camera;
 struct _Stream;
+struct _MemoryBudget;
+struct _Executor;
 
 #define STORE_STATUS_MAP(XX)			\
 	XX(0,	NONE, 		None)			\
@@ -41,11 +45,27 @@ struct _Store {
 
     StoreStatus status;
 
-	bool active;
+	bool active;				// only accessed with store_is_active ()
+	u64 stop_deadline_ns;		// the pending frames are handled until then
+	unsigned int n_detached;	// threads that did not exit in time
 
 	// our camera streams
 	u32 next_stream_id;
 	DoubleList *streams;
+
+	// synchronized capture of all the streams' cameras
+	bool sync_capture;
+	pthread_t capture_thread_id;
+	u64 capture_tick;
+	unsigned int pending_retrieves;
+	pthread_mutex_t *capture_mutex;
+	pthread_cond_t *capture_cond;
+
+	// bounds the memory used by all the streams' frames
+	struct _MemoryBudget *budget;
+
+	// runs every stream's frames pipeline
+	struct _Executor *executor;
 	
     pthread_mutex_t *mutex;
 
@@ -125,7 +145,31 @@ extern unsigned int store_open (Store *store);
 extern unsigned int store_start (void *store_ptr);
 
 // correctly closes the store
-extern void store_close (Store *store);
+// the streams handle their pending frames until the shutdown deadline
+// returns 0 on success, 1 if any thread did not exit in time
+extern unsigned int store_close (Store *store);
+
+// the store is running until it is closed
+extern bool store_is_active (const Store *store);
+
+// ms left until the store's shutdown deadline, at least 1
+// or 0 if there is no deadline
+extern unsigned int store_shutdown_remaining (const Store *store);
+
+#pragma endregion
+
+#pragma region capture
+
+// dedicated thread that grabs every stream's camera back to back
+// so that all the frames from the same tick are time aligned
+extern void *store_capture_thread (void *store_ptr);
+
+// waits until the store's capture thread has grabbed a new tick
+// returns the new tick or 0 if the store is no longer active
+extern u64 store_capture_wait (Store *store, u64 last_tick);
+
+// signals that a stream has retrieved its frame for the current tick
+extern void store_capture_done (Store *store);
 
 #pragma endregion
 
@@ -9,11 +9,13 @@
 #include <client/types/string.h>
 
 #include <client/threads/thread.h>
-#include <client/threads/jobs.h>
 
 #include <client/collections/dlist.h>
 
+#include "affinity.hpp"
 #include "camera.hpp"
+#include "pipeline.hpp"
+#include "ring.hpp"
 #include "store.h"
 
 #define STREAM_NAME_SIZE							128
@@ -33,9 +35,29 @@
 
 #define DEFAULT_STREAM_SCALE_FACTOR					6
 #define DEFAULT_STREAM_MOVEMENT_THRESH				800
+#define STREAM_MOVEMENT_THRESHOLD					45		// gray difference for a changed pixel
 #define DEFAULT_STREAM_NO_MOVEMENT_FRAMES      		60
 
+#define STREAM_RECONNECT_SLEEP_STEP					100		// ms
+
+#define DEFAULT_STREAM_FRAMES_POOL_SIZE				16
+
+#define DEFAULT_STREAM_PRE_ROLL_SECONDS				0		// disabled
+#define STREAM_PRE_ROLL_MAX_FRAMES					300
+
+#define STREAM_MAX_CONSUMERS						4
+#define STREAM_CONSUMER_RING_SIZE					64
+#define STREAM_CONSUMER_WAIT_STEP					1		// ms
+
+#define DEFAULT_STREAM_STAGE_THREADS				1
+#define DEFAULT_STREAM_PIPELINE_QUEUE_SIZE			2
+
 struct _Store;
+struct _PixzoFrame;
+struct _PixzoFramesPool;
+struct _ActionsMemory;
+struct _SpillLog;
+struct _Executor;
 
 #define STREAM_TYPE_MAP(XX)				\
 	XX(0,	NONE, 		None)			\
@@ -53,6 +75,49 @@ typedef enum StreamType {
 
 extern const char *stream_type_to_string (StreamType type);
 
+#define STREAM_CONSUMER_TYPE_MAP(XX)		\
+	XX(0,	NONE, 		None)				\
+	XX(1,	MOVEMENT, 	Movement)			\
+	XX(2,	RECORD, 	Record)
+
+typedef enum StreamConsumerType {
+
+	#define XX(num, name, string) STREAM_CONSUMER_TYPE_##name = num,
+	STREAM_CONSUMER_TYPE_MAP (XX)
+	#undef XX
+
+} StreamConsumerType;
+
+extern const char *stream_consumer_type_to_string (
+	StreamConsumerType type
+);
+
+// every consumer gets the same captured frames in its own ring
+// where they wait until there is room for them in its pipeline
+// the stream's capture thread is the only producer
+struct _StreamConsumer {
+
+	StreamConsumerType type;
+	FramesRing *ring;
+
+	struct _Stream *stream;
+
+	// handles the frames in the store's executor
+	// stopped by the stream's thread after its last capture
+	struct _Pipeline *pipeline;
+
+	// only a single executor's task moves the frames
+	// from the ring into the pipeline at the same time
+	bool idle;
+	struct _PixzoFrame *pending;	// taken from the ring, waiting for room
+
+	u64 last_latency_ns;		// from capture until the frame was handled
+	u64 max_latency_ns;
+
+};
+
+typedef struct _StreamConsumer StreamConsumer;
+
 #pragma region main
 
 struct _Stream {
@@ -65,24 +130,52 @@ struct _Stream {
 	StreamType type;
 
 	pthread_t stream_thread_id;
+	bool detached;						// its thread did not exit in time so it is never deleted
+	ThreadAffinity capture_affinity;	// where the capture thread & its frames live
 
 	DoubleList *videos;			// list of videos to use as inputs
 
 	Camera *cam;
+	u64 grabbed_tick;			// the last capture tick where the camera grabbed a frame
+	u64 capture_tick;			// the last capture tick that we retrieved
 	unsigned int width, height;
 
 	unsigned int scale_factor;
 
-	JobQueue *frames_buffer;
+	// owned by the stream's capture thread
+	struct _PixzoFramesPool *frames_pool;
+
+	// the captured frames are shared with all of them
+	StreamConsumer consumers[STREAM_MAX_CONSUMERS];
+	unsigned int n_consumers;
+
+	// live frames & actions memory charged to the store's budget
+	u64 budget_bytes;
+	u64 n_budget_drops;			// frames dropped by the budget's policy (atomic)
+	bool decimate_skip;			// the next frame is dropped when decimating
 
-	pthread_t movement_thread_id;
 	bool movement;
 	unsigned int movement_count;
 	unsigned int no_movement_frames;
 	unsigned int movement_thresh;
 	unsigned int max_no_movement_frames;
 
-	pthread_t record_thread_id;
+	// for each consumer's pipeline
+	unsigned int stage_threads[PIPELINE_STAGE_TYPES];
+
+	// the frames of the last actions
+	struct _ActionsMemory *memory;
+	u32 action_id;				// the current action, 0 if none
+	struct _SpillLog *spill;	// for the frames that don't fit in memory
+
+	// the last frames before an action starts
+	// only used by the movement pipeline's sink
+	unsigned int pre_roll_frames;		// requested frames (takes precedence)
+	unsigned int pre_roll_seconds;		// requested seconds at the camera's fps
+	struct _PixzoFrame **pre_roll;
+	unsigned int pre_roll_size;
+	unsigned int pre_roll_head;			// the oldest frame
+	unsigned int pre_roll_count;
 
 	u64 next_frame_id;
 	u32 raw_frame_saved_count;
@@ -98,11 +191,13 @@ struct _Stream {
 
 	cv::VideoWriter *writer;
 	char video_output[STREAM_VIDEO_OUTPUT_FILENAME_SIZE];
+	u64 writer_start_ns;		// capture time of the video's first frame
+	u64 writer_frames;			// frames written to the current video
 
 	// stats
 	u64 n_frames_read;			// total number of capture.read (input_image) performed
 	u64 n_frames_good;			// good input frames 
-	u64 n_frames_bad;			// bad input frames
+	u64 n_frames_bad;			// bad input frames (atomic)
 
 };
 
@@ -116,6 +211,18 @@ extern int stream_comparator_by_id (
 	const void *a, const void *b
 );
 
+// registers a new consumer that will get every captured frame
+// must be called before the stream's thread has started
+// returns the registered consumer, NULL on error
+extern StreamConsumer *stream_register_consumer (
+	Stream *stream, StreamConsumerType type
+);
+
+// returns a registered consumer, NULL if not found
+extern StreamConsumer *stream_get_consumer (
+	Stream *stream, StreamConsumerType type
+);
+
 // sets the stream's name to be used for output filenames
 extern void stream_set_name (
 	Stream *stream, const char *name
@@ -148,6 +255,45 @@ extern void stream_set_max_no_movement_frames (
 	Stream *stream, unsigned int max_no_movement_frames
 );
 
+// sets how many frames before an action starts are kept
+// to be included in the action's video & memory
+// takes precedence over the pre roll seconds, 0 to use them
+extern void stream_set_pre_roll_frames (
+	Stream *stream, unsigned int pre_roll_frames
+);
+
+// sets how many seconds before an action starts are kept
+// based on the camera's fps, 0 to disable pre roll
+extern void stream_set_pre_roll_seconds (
+	Stream *stream, unsigned int pre_roll_seconds
+);
+
+// pins the stream's capture thread to a cpu list like "0-3,8"
+// returns 0 on success, 1 on error
+extern unsigned int stream_set_capture_cpus (
+	Stream *stream, const char *cpu_list
+);
+
+// sets the scheduling policy & priority (fifo & rr) of the capture thread
+extern void stream_set_capture_sched (
+	Stream *stream, AffinitySched sched, int priority
+);
+
+// the capture thread & its frames are kept in the numa node
+// using the node's cpus if none were set
+extern void stream_set_numa_node (
+	Stream *stream, int numa_node
+);
+
+// sets how many workers can run a stage of the stream's pipeline at the same time
+// the movement & sink stages always use a single thread
+// as they must see the frames in order
+// the capture is always done by the stream's own thread
+// returns 0 on success, 1 if the stage can't be configured
+extern unsigned int stream_set_stage_threads (
+	Stream *stream, PipelineStageType type, unsigned int n_threads
+);
+
 // scale raw frame (into a new one) to this size to be used as pose input
 extern int stream_set_pose_size (
 	Stream *stream, int width, int height
@@ -164,6 +310,14 @@ extern void stream_set_pose_output_offset (
 	Stream *stream, int x_offset, int y_offset
 );
 
+// creates the log where the actions' frames that don't fit
+// in memory are written to, in path
+// returns 0 on success, 1 on error
+extern unsigned int stream_set_spill (
+	Stream *stream, const char *path,
+	size_t segment_size, unsigned int n_segments
+);
+
 // sets the stream's values now that we have all the required info
 // called automatically in store_stream_thread () after the camera has been opened
 extern int stream_populate_values (Stream *stream);
@@ -174,6 +328,15 @@ extern unsigned int stream_set_video_writer (
 	Stream *stream
 );
 
+// writes the frame to the current video based on its capture time
+// frames are repeated (or skipped) to keep the real timing
+// even when the camera is not delivering at its real fps
+// returns 0 on success, 1 on error
+extern unsigned int stream_write_video_frame (
+	Stream *stream,
+	const struct _PixzoFrame *pixzo_frame, const cv::Mat &frame
+);
+
 // ends the current stream's video writer recording
 // returns 0 on success, 1 on error
 extern unsigned int stream_close_video_writer (
@@ -197,6 +360,8 @@ extern void stream_print (const Stream *stream);
 
 // get the original frame by searching it by its id
 // in the stream's actions memories
+// returns a new reference that must be released
+// with pixzo_frame_release (), NULL if not found
 extern struct _PixzoFrame *stream_memory_get_frame (
 	Stream *stream, u32 action_id, u64 frame_id
 );
@@ -209,9 +374,21 @@ extern struct _PixzoFrame *stream_memory_get_frame (
 // returns 0 on success, 1 on error
 extern unsigned int stream_open (Stream *stream);
 
-extern void *stream_movement_thread (void *stream_ptr);
+// registers the stream's consumers with their pipelines to handle
+// the captured frames in the executor's workers
+// must be called before the stream's thread has started
+// returns 0 on success, 1 on error
+extern unsigned int stream_pipeline_start (
+	Stream *stream, struct _Executor *executor
+);
 
-extern void *stream_record_thread (void *stream_ptr);
+// waits up to timeout ms (0 for no limit) for the frames
+// that are in the consumers' rings & pipelines to be handled
+// called by the stream's thread after it has stopped capturing
+// returns 0 on success, 1 if some frames were dropped
+extern unsigned int stream_pipeline_stop (
+	Stream *stream, unsigned int timeout
+);
 
 // dedicated thread for each stream to read from its camera
 extern void *stream_thread (void *stream_ptr);
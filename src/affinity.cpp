@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <sched.h>
+#include <pthread.h>
+
+#include <sys/syscall.h>
+
+#include <linux/mempolicy.h>
+
+#include <client/types/types.h>
+
+#include <client/utils/log.h>
+
+#include "affinity.hpp"
+
+#define AFFINITY_NUMA_NODE_CPULIST		"/sys/devices/system/node/node%d/cpulist"
+
+// node masks are passed to the kernel as a single word
+#define AFFINITY_MAX_NUMA_NODES			(int) (sizeof (unsigned long) * 8)
+
+const char *affinity_sched_to_string (AffinitySched sched) {
+
+	switch (sched) {
+		#define XX(num, name, string) case AFFINITY_SCHED_##name: return #string;
+		AFFINITY_SCHED_MAP(XX)
+		#undef XX
+	}
+
+	return affinity_sched_to_string (AFFINITY_SCHED_NONE);
+
+}
+
+// returns NONE for NULL or unknown values
+AffinitySched affinity_sched_from_string (const char *string) {
+
+	AffinitySched sched = AFFINITY_SCHED_NONE;
+
+	if (string) {
+		#define XX(num, name, str) if (!strcasecmp (#str, string)) sched = AFFINITY_SCHED_##name;
+		AFFINITY_SCHED_MAP(XX)
+		#undef XX
+	}
+
+	return sched;
+
+}
+
+static int affinity_sched_policy (AffinitySched sched) {
+
+	int policy = SCHED_OTHER;
+
+	switch (sched) {
+		case AFFINITY_SCHED_FIFO: policy = SCHED_FIFO; break;
+		case AFFINITY_SCHED_RR: policy = SCHED_RR; break;
+
+		default: break;
+	}
+
+	return policy;
+
+}
+
+static const char *affinity_policy_to_string (int policy) {
+
+	const char *string = "other";
+
+	switch (policy) {
+		case SCHED_FIFO: string = "fifo"; break;
+		case SCHED_RR: string = "rr"; break;
+
+		default: break;
+	}
+
+	return string;
+
+}
+
+// parses a cpu list like "0-3,8" as used by the kernel
+// returns 0 on success, 1 on error
+static unsigned int affinity_parse_cpus (
+	const char *cpu_list, cpu_set_t *cpus
+) {
+
+	unsigned int errors = 0;
+
+	CPU_ZERO (cpus);
+
+	const char *ptr = cpu_list;
+	char *end = NULL;
+	long first = 0;
+	long last = 0;
+	while (*ptr && (*ptr != '\n') && !errors) {
+		first = strtol (ptr, &end, 10);
+		last = first;
+		if (end == ptr) errors = 1;
+
+		else if (*end == '-') {
+			ptr = end + 1;
+			last = strtol (ptr, &end, 10);
+			if (end == ptr) errors = 1;
+		}
+
+		if (!errors) {
+			if ((first < 0) || (last < first) || (last >= CPU_SETSIZE)) {
+				errors = 1;
+			}
+
+			else {
+				for (long cpu = first; cpu <= last; cpu++) {
+					CPU_SET ((int) cpu, cpus);
+				}
+
+				ptr = end;
+				if (*ptr == ',') ptr++;
+				else if (*ptr && (*ptr != '\n')) errors = 1;
+			}
+		}
+	}
+
+	if (!CPU_COUNT (cpus)) errors = 1;
+
+	return errors;
+
+}
+
+// gets the node's cpus from sysfs
+// returns 0 on success, 1 on error
+static unsigned int affinity_numa_node_cpus (
+	int numa_node, cpu_set_t *cpus
+) {
+
+	unsigned int retval = 1;
+
+	char filename[128] = { 0 };
+	(void) snprintf (filename, sizeof (filename), AFFINITY_NUMA_NODE_CPULIST, numa_node);
+
+	FILE *file = fopen (filename, "r");
+	if (file) {
+		char cpu_list[AFFINITY_CPUS_STRING_SIZE] = { 0 };
+		if (fgets (cpu_list, AFFINITY_CPUS_STRING_SIZE, file)) {
+			retval = affinity_parse_cpus (cpu_list, cpus);
+		}
+
+		(void) fclose (file);
+	}
+
+	return retval;
+
+}
+
+// writes the set's cpus as a cpu list like "0-3,8"
+void affinity_cpus_to_string (
+	const cpu_set_t *cpus, char *buffer, size_t size
+) {
+
+	size_t used = 0;
+	buffer[0] = '\0';
+
+	int cpu = 0;
+	int first = 0;
+	while ((cpu < CPU_SETSIZE) && (used < size)) {
+		if (CPU_ISSET (cpu, cpus)) {
+			first = cpu;
+			while (((cpu + 1) < CPU_SETSIZE) && CPU_ISSET (cpu + 1, cpus)) cpu++;
+
+			used += (size_t) snprintf (
+				buffer + used, size - used,
+				(first == cpu) ? "%s%d" : "%s%d-%d",
+				used ? "," : "", first, cpu
+			);
+		}
+
+		cpu++;
+	}
+
+}
+
+void thread_affinity_init (ThreadAffinity *affinity) {
+
+	affinity->has_cpus = false;
+	CPU_ZERO (&affinity->cpus);
+
+	affinity->numa_node = AFFINITY_NUMA_NODE_NONE;
+
+	affinity->sched = AFFINITY_SCHED_NONE;
+	affinity->priority = 0;
+
+}
+
+// parses a cpu list like "0-3,8"
+// returns 0 on success, 1 on error
+unsigned int thread_affinity_set_cpus (
+	ThreadAffinity *affinity, const char *cpu_list
+) {
+
+	unsigned int retval = 1;
+
+	if (affinity && cpu_list) {
+		cpu_set_t cpus;
+		if (!affinity_parse_cpus (cpu_list, &cpus)) {
+			affinity->cpus = cpus;
+			affinity->has_cpus = true;
+			retval = 0;
+		}
+
+		else {
+			client_log_error ("Invalid cpu list %s", cpu_list);
+		}
+	}
+
+	return retval;
+
+}
+
+// the thread's memory is allocated from this node
+// and it runs in the node's cpus if none were set
+void thread_affinity_set_numa_node (
+	ThreadAffinity *affinity, int numa_node
+) {
+
+	if (affinity) {
+		affinity->numa_node = (numa_node < AFFINITY_MAX_NUMA_NODES) ?
+			numa_node : AFFINITY_NUMA_NODE_NONE;
+	}
+
+}
+
+void thread_affinity_set_sched (
+	ThreadAffinity *affinity, AffinitySched sched, int priority
+) {
+
+	if (affinity) {
+		affinity->sched = sched;
+		affinity->priority = priority;
+	}
+
+}
+
+static unsigned int thread_affinity_apply_cpus (
+	const ThreadAffinity *affinity, const char *thread_name
+) {
+
+	unsigned int retval = 0;
+
+	cpu_set_t cpus = affinity->cpus;
+	bool has_cpus = affinity->has_cpus;
+	if (!has_cpus && (affinity->numa_node >= 0)) {
+		has_cpus = !affinity_numa_node_cpus (affinity->numa_node, &cpus);
+	}
+
+	if (has_cpus) {
+		if (pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &cpus)) {
+			client_log_error ("Failed to set %s cpus!", thread_name);
+			retval = 1;
+		}
+	}
+
+	return retval;
+
+}
+
+// new allocations (& first touched pages) come from the node
+static unsigned int thread_affinity_apply_numa_node (
+	const ThreadAffinity *affinity, const char *thread_name
+) {
+
+	unsigned int retval = 0;
+
+	if (affinity->numa_node >= 0) {
+		unsigned long node_mask = 1UL << affinity->numa_node;
+		if (syscall (
+			SYS_set_mempolicy, MPOL_PREFERRED,
+			&node_mask, (unsigned long) AFFINITY_MAX_NUMA_NODES
+		)) {
+			client_log_error (
+				"Failed to set %s numa node %d!", thread_name, affinity->numa_node
+			);
+
+			retval = 1;
+		}
+	}
+
+	return retval;
+
+}
+
+static unsigned int thread_affinity_apply_sched (
+	const ThreadAffinity *affinity, const char *thread_name
+) {
+
+	unsigned int retval = 0;
+
+	if (affinity->sched != AFFINITY_SCHED_NONE) {
+		int policy = affinity_sched_policy (affinity->sched);
+
+		struct sched_param param;
+		(void) memset (&param, 0, sizeof (struct sched_param));
+
+		if (policy != SCHED_OTHER) {
+			param.sched_priority = affinity->priority;
+			if (param.sched_priority < sched_get_priority_min (policy)) {
+				param.sched_priority = sched_get_priority_min (policy);
+			}
+
+			else if (param.sched_priority > sched_get_priority_max (policy)) {
+				param.sched_priority = sched_get_priority_max (policy);
+			}
+		}
+
+		if (pthread_setschedparam (pthread_self (), policy, &param)) {
+			// real time policies require CAP_SYS_NICE
+			client_log_warning (
+				"Failed to set %s %s scheduling!",
+				thread_name, affinity_sched_to_string (affinity->sched)
+			);
+
+			retval = 1;
+		}
+	}
+
+	return retval;
+
+}
+
+// logs where the thread has actually been placed
+static void thread_affinity_report (
+	const ThreadAffinity *affinity, const char *thread_name
+) {
+
+	char cpus_string[AFFINITY_CPUS_STRING_SIZE] = { 0 };
+
+	cpu_set_t cpus;
+	if (!pthread_getaffinity_np (pthread_self (), sizeof (cpu_set_t), &cpus)) {
+		affinity_cpus_to_string (&cpus, cpus_string, AFFINITY_CPUS_STRING_SIZE);
+	}
+
+	int policy = SCHED_OTHER;
+	struct sched_param param;
+	(void) memset (&param, 0, sizeof (struct sched_param));
+	(void) pthread_getschedparam (pthread_self (), &policy, &param);
+
+	client_log_debug (
+		"%s placement - cpus: %s -- sched: %s (%d) -- numa node: %d -- running on cpu: %d",
+		thread_name, cpus_string,
+		affinity_policy_to_string (policy), param.sched_priority,
+		affinity->numa_node, sched_getcpu ()
+	);
+
+}
+
+// applies the affinity to the calling thread
+// and logs where it has actually been placed
+// returns 0 on success, 1 if any value could not be applied
+unsigned int thread_affinity_apply (
+	const ThreadAffinity *affinity, const char *thread_name
+) {
+
+	unsigned int errors = 0;
+
+	if (affinity) {
+		errors |= thread_affinity_apply_cpus (affinity, thread_name);
+		errors |= thread_affinity_apply_numa_node (affinity, thread_name);
+		errors |= thread_affinity_apply_sched (affinity, thread_name);
+
+		thread_affinity_report (affinity, thread_name);
+	}
+
+	return errors;
+
+}
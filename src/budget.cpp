@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <time.h>
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#include <client/utils/log.h>
+
+#include "budget.hpp"
+
+const char *memory_budget_policy_to_string (
+	MemoryBudgetPolicy policy
+) {
+
+	switch (policy) {
+		#define XX(num, name, string) case MEMORY_BUDGET_POLICY_##name: return #string;
+		MEMORY_BUDGET_POLICY_MAP(XX)
+		#undef XX
+	}
+
+	return memory_budget_policy_to_string (MEMORY_BUDGET_POLICY_NONE);
+
+}
+
+// returns NONE for NULL or unknown values
+MemoryBudgetPolicy memory_budget_policy_from_string (
+	const char *string
+) {
+
+	MemoryBudgetPolicy policy = MEMORY_BUDGET_POLICY_NONE;
+
+	if (string) {
+		#define XX(num, name, str) if (!strcasecmp (#str, string)) policy = MEMORY_BUDGET_POLICY_##name;
+		MEMORY_BUDGET_POLICY_MAP(XX)
+		#undef XX
+	}
+
+	return policy;
+
+}
+
+MemoryBudget *memory_budget_create (
+	u64 max_bytes, MemoryBudgetPolicy policy
+) {
+
+	MemoryBudget *budget = (MemoryBudget *) malloc (sizeof (MemoryBudget));
+	if (budget) {
+		budget->max_bytes = max_bytes;
+		budget->policy = policy;
+
+		budget->used_bytes = 0;
+		budget->high_water = 0;
+
+		budget->n_waits = 0;
+
+		budget->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+		(void) pthread_mutex_init (budget->mutex, NULL);
+
+		budget->cond = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+		(void) pthread_cond_init (budget->cond, NULL);
+	}
+
+	return budget;
+
+}
+
+void memory_budget_delete (void *budget_ptr) {
+
+	if (budget_ptr) {
+		MemoryBudget *budget = (MemoryBudget *) budget_ptr;
+
+		if (budget->used_bytes) {
+			client_log_warning (
+				"Memory budget deleted with %lu bytes still in use!",
+				budget->used_bytes
+			);
+		}
+
+		(void) pthread_mutex_destroy (budget->mutex);
+		free (budget->mutex);
+
+		(void) pthread_cond_destroy (budget->cond);
+		free (budget->cond);
+
+		free (budget);
+	}
+
+}
+
+// returns true if the bytes don't fit in the budget
+bool memory_budget_exceeded (
+	const MemoryBudget *budget, u64 bytes
+) {
+
+	return budget->max_bytes
+		&& ((__atomic_load_n (&budget->used_bytes, __ATOMIC_RELAXED) + bytes) > budget->max_bytes);
+
+}
+
+// returns true if the bytes would take the budget
+// over the percent of its max bytes
+bool memory_budget_above (
+	const MemoryBudget *budget, u64 bytes, unsigned int percent
+) {
+
+	return budget->max_bytes
+		&& (((__atomic_load_n (&budget->used_bytes, __ATOMIC_RELAXED) + bytes) * 100)
+			> (budget->max_bytes * percent));
+
+}
+
+// adds the bytes to the budget & to the owner's account
+void memory_budget_charge (
+	MemoryBudget *budget, u64 *account, u64 bytes
+) {
+
+	u64 used = __atomic_add_fetch (&budget->used_bytes, bytes, __ATOMIC_RELAXED);
+	if (account) (void) __atomic_add_fetch (account, bytes, __ATOMIC_RELAXED);
+
+	// only an approximation, it does not need to be exact
+	if (used > budget->high_water) budget->high_water = used;
+
+}
+
+// removes the bytes from the budget & from the owner's account
+void memory_budget_release (
+	MemoryBudget *budget, u64 *account, u64 bytes
+) {
+
+	(void) __atomic_sub_fetch (&budget->used_bytes, bytes, __ATOMIC_RELAXED);
+	if (account) (void) __atomic_sub_fetch (account, bytes, __ATOMIC_RELAXED);
+
+	if (budget->policy == MEMORY_BUDGET_POLICY_BLOCK) {
+		memory_budget_wake (budget);
+	}
+
+}
+
+// waits up to MEMORY_BUDGET_WAIT_TIMEOUT for the bytes to fit
+// returns true if they fit
+bool memory_budget_wait (MemoryBudget *budget, u64 bytes) {
+
+	struct timespec deadline = { 0 };
+	(void) clock_gettime (CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += (long) MEMORY_BUDGET_WAIT_TIMEOUT * 1000000;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000;
+	deadline.tv_nsec %= 1000000000;
+
+	(void) pthread_mutex_lock (budget->mutex);
+
+	budget->n_waits += 1;
+
+	int result = 0;
+	while (memory_budget_exceeded (budget, bytes) && !result) {
+		result = pthread_cond_timedwait (budget->cond, budget->mutex, &deadline);
+	}
+
+	(void) pthread_mutex_unlock (budget->mutex);
+
+	return !memory_budget_exceeded (budget, bytes);
+
+}
+
+// wakes up any thread that is waiting for the budget
+void memory_budget_wake (MemoryBudget *budget) {
+
+	(void) pthread_mutex_lock (budget->mutex);
+	(void) pthread_cond_broadcast (budget->cond);
+	(void) pthread_mutex_unlock (budget->mutex);
+
+}
+
+void memory_budget_print (const MemoryBudget *budget) {
+
+	if (budget) {
+		(void) printf ("Memory budget: \n");
+		(void) printf ("\tMax bytes: %lu\n", budget->max_bytes);
+		(void) printf ("\tPolicy: %s\n", memory_budget_policy_to_string (budget->policy));
+		(void) printf ("\tUsed bytes: %lu\n", __atomic_load_n (&budget->used_bytes, __ATOMIC_RELAXED));
+		(void) printf ("\tHigh water: %lu\n", budget->high_water);
+		(void) printf ("\tWaits: %lu\n", budget->n_waits);
+	}
+
+}
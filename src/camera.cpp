@@ -1,6 +1,18 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/videodev2.h>
+
+#include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
 #include <opencv2/videoio/videoio_c.h>
 
@@ -11,11 +23,14 @@
 #include <client/utils/log.h>
 
 #include "camera.hpp"
+#include "frames.hpp"
 
 static void camera_print_config (
 	const Camera *cam
 );
 
+static void camera_v4l2_close (Camera *cam);
+
 static void camera_print_real_capture_config (
 	cv::VideoCapture *capture
 );
@@ -32,6 +47,44 @@ const char *camera_type_to_string (CameraType type) {
 
 }
 
+const char *camera_backend_to_string (CameraBackend backend) {
+
+	switch (backend) {
+		#define XX(num, name, string) case CAMERA_BACKEND_##name: return #string;
+		CAMERA_BACKEND_MAP(XX)
+		#undef XX
+	}
+
+	return camera_backend_to_string (CAMERA_BACKEND_OPENCV);
+
+}
+
+CameraBackend camera_backend_from_string (const char *backend) {
+
+	CameraBackend retval = CAMERA_BACKEND_OPENCV;
+
+	if (backend) {
+		if (!strcasecmp (backend, "v4l2")) {
+			retval = CAMERA_BACKEND_V4L2;
+		}
+	}
+
+	return retval;
+
+}
+
+const char *camera_state_to_string (CameraState state) {
+
+	switch (state) {
+		#define XX(num, name, string) case CAMERA_STATE_##name: return #string;
+		CAMERA_STATE_MAP(XX)
+		#undef XX
+	}
+
+	return camera_state_to_string (CAMERA_STATE_NONE);
+
+}
+
 #pragma region main
 
 static Camera *camera_new (void) {
@@ -39,6 +92,7 @@ static Camera *camera_new (void) {
 	Camera *cam = (Camera *) malloc (sizeof (Camera));
 	if (cam) {
 		cam->type = CAMERA_TYPE_NONE;
+		cam->backend = CAMERA_BACKEND_OPENCV;
 
 		cam->device_idx = 0;
 		(void) memset (cam->device_name, 0, CAMERA_NAME_SIZE);
@@ -46,11 +100,17 @@ static Camera *camera_new (void) {
 		cam->address = NULL;
 		cam->filename = NULL;
 
+		cam->rotation = CAMERA_ROTATION_NONE;
+
 		cam->preferred_width = CAMERA_DEFAULT_WIDTH;
 		cam->preferred_height = CAMERA_DEFAULT_HEIGHT;
 		cam->preferred_fps = CAMERA_DEFAULT_FPS;
 
 		cam->real_width = cam->real_height = cam->real_fps = 0;
+		cam->capture_width = cam->capture_height = 0;
+
+		(void) memset (&cam->roi, 0, sizeof (CameraRoi));
+		(void) memset (&cam->crop, 0, sizeof (CameraRoi));
 
 		cam->auto_exposure = CAMERA_DEFAULT_AUTO_EXPOSURE;
 		cam->brightness = CAMERA_DEFAULT_BRIGHTNESS;
@@ -62,6 +122,34 @@ static Camera *camera_new (void) {
 
 		cam->total_frames = 0;
 		cam->capture = NULL;
+
+		cam->state = CAMERA_STATE_NONE;
+		cam->n_failures = 0;
+		cam->reconnect_delay = CAMERA_RECONNECT_MIN_DELAY;
+		cam->n_reconnects = 0;
+
+		cam->grab_time = 0;
+		cam->grab_ns = 0;
+		cam->grab_driver_ns = 0;
+		cam->passthrough = false;
+		cam->passthrough_mjpeg = false;
+
+		cam->preferred_pixel_format = 0;
+		(void) memset (&cam->mode, 0, sizeof (CameraMode));
+
+		cam->fd = -1;
+		cam->pixel_format = 0;
+		cam->bytes_per_line = 0;
+		cam->n_buffers = CAMERA_V4L2_DEFAULT_BUFFERS;
+		(void) memset (cam->buffers, 0, sizeof (CameraBuffer) * CAMERA_V4L2_MAX_BUFFERS);
+		cam->n_queued = 0;
+		cam->n_dequeued = 0;
+		cam->streaming = false;
+		cam->generation = 0;
+		cam->grabbed_idx = -1;
+		cam->grabbed_bytes = 0;
+		cam->buffers_mutex = NULL;
+		cam->buffers_cond = NULL;
 	}
 
 	return cam;
@@ -80,6 +168,18 @@ void camera_delete (void *camera_ptr) {
 			delete (cam->capture);
 		}
 
+		camera_v4l2_close (cam);
+
+		if (cam->buffers_mutex) {
+			(void) pthread_mutex_destroy (cam->buffers_mutex);
+			free (cam->buffers_mutex);
+		}
+
+		if (cam->buffers_cond) {
+			(void) pthread_cond_destroy (cam->buffers_cond);
+			free (cam->buffers_cond);
+		}
+
 		free (cam);
 	}
 
@@ -92,6 +192,12 @@ Camera *camera_create (CameraType type) {
 		cam->capture = new cv::VideoCapture ();
 		if (cam->capture) {
 			cam->type = type;
+
+			cam->buffers_mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+			(void) pthread_mutex_init (cam->buffers_mutex, NULL);
+
+			cam->buffers_cond = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+			(void) pthread_cond_init (cam->buffers_cond, NULL);
 		}
 
 		else {
@@ -175,6 +281,54 @@ void camera_set_source (Camera *cam, const char *device_name) {
 
 }
 
+// sets the backend to be used to capture frames
+// CAMERA_BACKEND_V4L2 is only available for CAMERA_TYPE_MEDIA
+void camera_set_backend (
+	Camera *cam, CameraBackend backend
+) {
+
+	if (cam) cam->backend = backend;
+
+}
+
+// sets the preferred V4L2 pixel format using its fourcc string (like "YUYV")
+// if it is not set, the best format for the resolution is negotiated
+void camera_set_pixel_format (
+	Camera *cam, const char *fourcc
+) {
+
+	if (cam && fourcc) {
+		if (strlen (fourcc) == 4) {
+			cam->preferred_pixel_format = v4l2_fourcc (
+				fourcc[0], fourcc[1], fourcc[2], fourcc[3]
+			);
+		}
+	}
+
+}
+
+// keeps the compressed MJPEG bitstream of each frame
+// so it is only decoded when its pixels are requested
+void camera_set_passthrough (
+	Camera *cam, bool passthrough
+) {
+
+	if (cam) cam->passthrough = passthrough;
+
+}
+
+// sets how many driver buffers to request with the V4L2 backend
+void camera_set_n_buffers (
+	Camera *cam, unsigned int n_buffers
+) {
+
+	if (cam && n_buffers) {
+		cam->n_buffers = (n_buffers < CAMERA_V4L2_MAX_BUFFERS) ?
+			n_buffers : CAMERA_V4L2_MAX_BUFFERS;
+	}
+
+}
+
 // set the rotation to be applied to every new frame
 void camera_set_rotation (
 	Camera *cam, CameraRotation rotation
@@ -184,6 +338,41 @@ void camera_set_rotation (
 
 }
 
+// only keeps this region of every captured frame
+// coordinates are relative to the frame before being rotated
+// the cropped size becomes the camera's real size
+void camera_set_roi (
+	Camera *cam,
+	unsigned int x, unsigned int y,
+	unsigned int width, unsigned int height
+) {
+
+	if (cam) {
+		cam->roi.x = x;
+		cam->roi.y = y;
+		cam->roi.width = width;
+		cam->roi.height = height;
+	}
+
+}
+
+// returns true if the camera only keeps a region of its frames
+bool camera_is_cropped (const Camera *cam) {
+
+	return (cam->crop.width != cam->capture_width)
+		|| (cam->crop.height != cam->capture_height);
+
+}
+
+static cv::Rect camera_crop_rect (const Camera *cam) {
+
+	return cv::Rect (
+		(int) cam->crop.x, (int) cam->crop.y,
+		(int) cam->crop.width, (int) cam->crop.height
+	);
+
+}
+
 // sets the preferred resolution
 // returns 0 on success, 1 on error
 unsigned int camera_set_resolution (
@@ -244,223 +433,1556 @@ static void camera_set_capture_value (
 
 }
 
-static bool camera_open_internal (Camera *cam) {
+// clamps the requested roi to the captured size
+// x & width are kept even so YUYV pixel pairs are not split
+// the whole frame is used if the clamped roi is too small
+static void camera_set_crop (Camera *cam) {
+
+	cam->crop.x = 0;
+	cam->crop.y = 0;
+	cam->crop.width = cam->capture_width;
+	cam->crop.height = cam->capture_height;
+
+	if (
+		cam->roi.width && cam->roi.height
+		&& (cam->roi.x < cam->capture_width)
+		&& (cam->roi.y < cam->capture_height)
+	) {
+		cam->crop.x = cam->roi.x & ~1u;
+		cam->crop.y = cam->roi.y;
+
+		cam->crop.width = cam->roi.width;
+		if (cam->crop.x + cam->crop.width > cam->capture_width) {
+			cam->crop.width = cam->capture_width - cam->crop.x;
+		}
 
-	bool retval = false;
+		cam->crop.width &= ~1u;
 
-	switch (cam->type) {
-		case CAMERA_TYPE_MEDIA: {
-			if (cam->device_name) {
-				retval = cam->capture->open (cam->device_name);
-			}
+		cam->crop.height = cam->roi.height;
+		if (cam->crop.y + cam->crop.height > cam->capture_height) {
+			cam->crop.height = cam->capture_height - cam->crop.y;
+		}
 
-			else {
-				retval = cam->capture->open (cam->device_idx);
-			}
-		} break;
+		if (
+			(cam->crop.width < CAMERA_MIN_CROP_SIZE)
+			|| (cam->crop.height < CAMERA_MIN_CROP_SIZE)
+		) {
+			client_log_warning (
+				"Camera roi w: %u x h: %u is smaller than %u pixels - ignoring it",
+				cam->crop.width, cam->crop.height, CAMERA_MIN_CROP_SIZE
+			);
+
+			cam->crop.x = 0;
+			cam->crop.y = 0;
+			cam->crop.width = cam->capture_width;
+			cam->crop.height = cam->capture_height;
+		}
 
-		case CAMERA_TYPE_IP: retval = cam->capture->open (cam->address->str); break;
-		case CAMERA_TYPE_VIDEO: retval = cam->capture->open (cam->filename->str); break;
+		else if (
+			(cam->crop.x != cam->roi.x) || (cam->crop.y != cam->roi.y)
+			|| (cam->crop.width != cam->roi.width) || (cam->crop.height != cam->roi.height)
+		) {
+			client_log_warning (
+				"Camera roi has been adjusted to x: %u y: %u -- w: %u x h: %u",
+				cam->crop.x, cam->crop.y, cam->crop.width, cam->crop.height
+			);
+		}
+	}
 
-		default: break;
+	else if (cam->roi.width || cam->roi.height) {
+		client_log_warning (
+			"Camera roi is outside the w: %u x h: %u captured frame - ignoring it",
+			cam->capture_width, cam->capture_height
+		);
 	}
 
-	if (cam->capture->isOpened ()) {
-		// set preferred options for camera
-		(void) cam->capture->set (CV_CAP_PROP_FOURCC, CV_FOURCC ('M', 'J', 'P', 'G'));
-		(void) cam->capture->set (CV_CAP_PROP_FPS, cam->preferred_fps);
-		(void) cam->capture->set (CV_CAP_PROP_FRAME_WIDTH, cam->preferred_width);
-		(void) cam->capture->set (CV_CAP_PROP_FRAME_HEIGHT, cam->preferred_height);
+}
 
-		switch (cam->rotation) {
-			case CAMERA_ROTATION_90_CLOCKWISE:
-				cam->real_height = cam->capture->get (cv::CAP_PROP_FRAME_WIDTH);
-				cam->real_width = cam->capture->get (cv::CAP_PROP_FRAME_HEIGHT);
-				break;
-			case CAMERA_ROTATION_90_COUNTERCLOCKWISE:
-				cam->real_height = cam->capture->get (cv::CAP_PROP_FRAME_WIDTH);
-				cam->real_width = cam->capture->get (cv::CAP_PROP_FRAME_HEIGHT);
-				break;
-			case CAMERA_ROTATION_180:
-				cam->real_width = cam->capture->get (cv::CAP_PROP_FRAME_WIDTH);
-				cam->real_height = cam->capture->get (cv::CAP_PROP_FRAME_HEIGHT);
-				break;
+// sets the camera's real values based on the captured size
+// the real size is the size of the roi after being rotated
+static void camera_set_real_size (
+	Camera *cam, unsigned int width, unsigned int height
+) {
 
-			default:
-				cam->real_width = cam->capture->get (cv::CAP_PROP_FRAME_WIDTH);
-				cam->real_height = cam->capture->get (cv::CAP_PROP_FRAME_HEIGHT);
-				break;
-		}
+	cam->capture_width = width;
+	cam->capture_height = height;
 
-		cam->real_fps = cam->capture->get (CV_CAP_PROP_FPS);
+	camera_set_crop (cam);
 
-		// #ifdef PIXZO_DEBUG
-		switch (cam->type) {
-			case CAMERA_TYPE_MEDIA: {
-				camera_print_config (cam);
+	switch (cam->rotation) {
+		case CAMERA_ROTATION_90_CLOCKWISE:
+		case CAMERA_ROTATION_90_COUNTERCLOCKWISE:
+			cam->real_width = cam->crop.height;
+			cam->real_height = cam->crop.width;
+			break;
 
-				camera_print_real_capture_config (cam->capture);
+		default:
+			cam->real_width = cam->crop.width;
+			cam->real_height = cam->crop.height;
+			break;
+	}
 
-				camera_set_capture_value (cam->capture, CV_CAP_PROP_AUTO_EXPOSURE, "auto exposure", cam->auto_exposure);
-				camera_set_capture_value (cam->capture, CV_CAP_PROP_BRIGHTNESS, "brightness", cam->brightness);
-				camera_set_capture_value (cam->capture, CV_CAP_PROP_CONTRAST, "contrast", cam->contrast);
-				camera_set_capture_value (cam->capture, CV_CAP_PROP_SATURATION, "saturation", cam->saturation);
-				camera_set_capture_value (cam->capture, CV_CAP_PROP_GAIN, "gain", cam->gain);
-				camera_set_capture_value (cam->capture, CV_CAP_PROP_EXPOSURE, "exposure", cam->exposure);
-				camera_set_capture_value (cam->capture, CV_CAP_PROP_SHARPNESS, "sharpness", cam->sharpness);
+}
 
-				if (cam->device_name) {
-					client_log_debug (
-						"Video capture info for <%s> is: w: %d x h: %d -- fps: %d",
-						cam->device_name,
-						cam->real_width, cam->real_height, cam->real_fps
-					);
-				}
+#pragma region v4l2
 
-				else {
-					client_log_debug (
-						"Video capture info for <%d> is: w: %d x h: %d -- fps: %d",
-						cam->device_idx,
-						cam->real_width, cam->real_height, cam->real_fps
-					);
-				}
+static int camera_v4l2_ioctl (int fd, unsigned long request, void *arg) {
 
-				camera_print_real_capture_config (cam->capture);
-			} break;
-			case CAMERA_TYPE_IP: {
-				client_log_debug (
-					"Video capture info for <%s> is: w: %d x h: %d -- fps: %d",
-					cam->address->str,
-					cam->real_width, cam->real_height, cam->real_fps
-				);
-			} break;
-			case CAMERA_TYPE_VIDEO: {
-				client_log_debug (
-					"Video capture info for <%s> is: w: %d x h: %d -- fps: %d",
-					cam->filename->str,
-					cam->real_width, cam->real_height, cam->real_fps
-				);
-			} break;
+	int retval = -1;
 
-			default: break;
-		}
-		// #endif
-	}
+	do {
+		retval = ioctl (fd, request, arg);
+	} while ((retval == -1) && (errno == EINTR));
 
 	return retval;
 
 }
 
-// opens the camera using the values set on its creation
-// returns true on success, false on error
-bool camera_open (Camera *cam) {
+// the format of the data that we get from the driver
+static PixzoFrameFormat camera_v4l2_frame_format (const Camera *cam) {
+
+	PixzoFrameFormat format = PIXZO_FRAME_FORMAT_NONE;
 
-	return cam ? camera_open_internal (cam) : false;
+	switch (cam->pixel_format) {
+		case V4L2_PIX_FMT_YUYV: format = PIXZO_FRAME_FORMAT_YUYV; break;
+
+		case V4L2_PIX_FMT_MJPEG:
+		case V4L2_PIX_FMT_JPEG:
+			format = PIXZO_FRAME_FORMAT_MJPEG;
+			break;
+
+		default: break;
+	}
+
+	return format;
 
 }
 
-// opens a camera using the video file as the input
-// camera must be of type CAMERA_TYPE_VIDEO
-// returns true on success, false on error
-bool camera_open (Camera *cam, const String *filename) {
+static void camera_v4l2_set_control (
+	Camera *cam, const u32 control_id, const char *name, const int value
+) {
 
-	bool retval = false;
+	struct v4l2_control control = { 0 };
+	control.id = control_id;
+	control.value = value;
 
-	if (cam && filename) {
-		cam->filename = filename;
-		retval = camera_open_internal (cam);
+	if (!camera_v4l2_ioctl (cam->fd, VIDIOC_S_CTRL, &control)) {
+		client_log_debug ("Set %s to %d", name, value);
 	}
 
-	return retval;
+	else {
+		client_log_error (
+			"Failed to set %s to %d: %s",
+			name, value, strerror (errno)
+		);
+	}
 
 }
 
-// gets the next camera frame
-// applies configuration to the new frame
-u8 camera_get (Camera *cam, cv::Mat *frame) {
+static void camera_v4l2_set_controls (Camera *cam) {
 
-	u8 retval = 1;
+	// same values that OpenCV uses for its V4L2 auto exposure mapping
+	camera_v4l2_set_control (
+		cam, V4L2_CID_EXPOSURE_AUTO, "auto exposure",
+		(cam->auto_exposure > 0.5) ? V4L2_EXPOSURE_APERTURE_PRIORITY : V4L2_EXPOSURE_MANUAL
+	);
 
-	*cam->capture >> *frame;
+	camera_v4l2_set_control (cam, V4L2_CID_BRIGHTNESS, "brightness", (int) cam->brightness);
+	camera_v4l2_set_control (cam, V4L2_CID_CONTRAST, "contrast", (int) cam->contrast);
+	camera_v4l2_set_control (cam, V4L2_CID_SATURATION, "saturation", (int) cam->saturation);
+	camera_v4l2_set_control (cam, V4L2_CID_GAIN, "gain", (int) cam->gain);
+	camera_v4l2_set_control (cam, V4L2_CID_EXPOSURE_ABSOLUTE, "exposure", (int) cam->exposure);
+	camera_v4l2_set_control (cam, V4L2_CID_SHARPNESS, "sharpness", (int) cam->sharpness);
 
-	if (!frame->empty ()) {
-		switch (cam->rotation) {
-			case CAMERA_ROTATION_90_CLOCKWISE:
-				cv::rotate (*frame, *frame, cv::ROTATE_90_CLOCKWISE);
-				break;
+}
 
-			case CAMERA_ROTATION_90_COUNTERCLOCKWISE:
-				cv::rotate (*frame, *frame, cv::ROTATE_90_COUNTERCLOCKWISE);
-				break;
+static unsigned int camera_v4l2_check_capabilities (
+	Camera *cam, const char *device
+) {
 
-			case CAMERA_ROTATION_180:
-				cv::rotate (*frame, *frame, cv::ROTATE_180);
-				break;
+	unsigned int retval = 1;
 
-			default: break;
+	struct v4l2_capability capability = { 0 };
+	if (!camera_v4l2_ioctl (cam->fd, VIDIOC_QUERYCAP, &capability)) {
+		if (
+			(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE)
+			&& (capability.capabilities & V4L2_CAP_STREAMING)
+		) {
+			retval = 0;
 		}
 
-		retval = 0;
+		else {
+			client_log_error ("%s does not support streaming capture!", device);
+		}
+	}
+
+	else {
+		client_log_error ("%s is not a V4L2 device!", device);
 	}
 
 	return retval;
 
 }
 
-cv::Mat *camera_get (Camera *cam) {
+static bool camera_v4l2_format_is_compressed (u32 pixel_format) {
 
-	cv::Mat *frame = new cv::Mat ();
-	if (frame) {
-		(void) camera_get (cam, frame);
-	}
+	return (pixel_format == V4L2_PIX_FMT_MJPEG) || (pixel_format == V4L2_PIX_FMT_JPEG);
 
-	return frame;
+}
+
+static void camera_v4l2_mode_print (
+	const char *device, const char *action, const CameraMode *mode
+) {
+
+	client_log_debug (
+		"%s %s mode: %c%c%c%c -- w: %u x h: %u -- fps: %u",
+		device, action,
+		(char) (mode->pixel_format & 0xFF),
+		(char) ((mode->pixel_format >> 8) & 0xFF),
+		(char) ((mode->pixel_format >> 16) & 0xFF),
+		(char) ((mode->pixel_format >> 24) & 0xFF),
+		mode->width, mode->height, mode->fps
+	);
 
 }
 
-// closes the camera's video capture
-void camera_close (Camera *cam) {
+// MJPEG modes are always preferred as they can be passed through
+// & use the least bandwidth, then any other compressed format
+static unsigned int camera_v4l2_mode_format_rank (const CameraMode *mode) {
 
-	if (cam) {
-		if (cam->capture) {
-			cam->capture->release ();
-		}
-	}
+	unsigned int rank = 0;
+
+	if (mode->pixel_format == V4L2_PIX_FMT_MJPEG) rank = 2;
+	else if (camera_v4l2_format_is_compressed (mode->pixel_format)) rank = 1;
+
+	return rank;
 
 }
 
-void camera_print (const Camera *cam) {
+// returns true if mode a is a better match than mode b for the camera's preferences
+static bool camera_v4l2_mode_is_better (
+	const Camera *cam, const CameraMode *a, const CameraMode *b
+) {
 
-	if (cam) {
-		(void) printf ("\t\tCamera type: %s\n", camera_type_to_string (cam->type));
+	bool retval = false;
 
-		switch (cam->type) {
-			case CAMERA_TYPE_NONE: break;
+	bool a_format = (a->pixel_format == cam->preferred_pixel_format);
+	bool b_format = (b->pixel_format == cam->preferred_pixel_format);
 
-			case CAMERA_TYPE_MEDIA: {
-				if (cam->device_name) {
-					(void) printf ("\t\tDevice idx: %d\n", cam->device_idx);
-				}
+	bool a_size = (a->width >= cam->preferred_width) && (a->height >= cam->preferred_height);
+	bool b_size = (b->width >= cam->preferred_width) && (b->height >= cam->preferred_height);
 
-				else {
-					(void) printf ("\t\tDevice name: %s\n", cam->device_name);
-				}
-			} break;
+	bool a_fps = (a->fps >= cam->preferred_fps);
+	bool b_fps = (b->fps >= cam->preferred_fps);
 
-			case CAMERA_TYPE_IP:
-				(void) printf ("\t\tAddress: %s\n", cam->address->str);
-				break;
+	u64 a_area = (u64) a->width * a->height;
+	u64 b_area = (u64) b->width * b->height;
 
-			default: break;
-		}
+	unsigned int a_rank = camera_v4l2_mode_format_rank (a);
+	unsigned int b_rank = camera_v4l2_mode_format_rank (b);
 
-		(void) printf ("\t\tPreferred width: %u\n", cam->preferred_width);
-		(void) printf ("\t\tPreferred height: %u\n", cam->preferred_height);
-		(void) printf ("\t\tPreferred fps: %u\n", cam->preferred_fps);
+	// a requested format always wins
+	if (a_format != b_format) retval = a_format;
 
-		(void) printf ("\t\tReal width: %u\n", cam->real_width);
-		(void) printf ("\t\tReal height: %u\n", cam->real_height);
-		(void) printf ("\t\tReal fps: %u\n", cam->real_fps);
+	else if (a_size != b_size) retval = a_size;
+
+	else if (a_fps != b_fps) retval = a_fps;
+
+	// a MJPEG mode wins over a closer size in another format
+	else if (a_rank != b_rank) retval = (a_rank > b_rank);
+
+	// the smallest size that is big enough or the biggest one we have
+	else if (a_area != b_area) retval = a_size ? (a_area < b_area) : (a_area > b_area);
+
+	else if (a->fps != b->fps) retval = a_fps ? (a->fps < b->fps) : (a->fps > b->fps);
+
+	return retval;
+
+}
+
+static void camera_v4l2_mode_select (
+	const Camera *cam, const CameraMode *mode,
+	CameraMode *best, bool *found
+) {
+
+	if (!*found || camera_v4l2_mode_is_better (cam, mode, best)) {
+		(void) memcpy (best, mode, sizeof (CameraMode));
+		*found = true;
+	}
+
+}
+
+static void camera_v4l2_enum_intervals (
+	const Camera *cam, int fd, CameraMode *mode,
+	CameraMode *best, bool *found
+) {
+
+	struct v4l2_frmivalenum interval = { 0 };
+	interval.pixel_format = mode->pixel_format;
+	interval.width = mode->width;
+	interval.height = mode->height;
+
+	unsigned int n_intervals = 0;
+	while (!camera_v4l2_ioctl (fd, VIDIOC_ENUM_FRAMEINTERVALS, &interval)) {
+		if (interval.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+			if (interval.discrete.numerator) {
+				mode->fps = (interval.discrete.denominator + (interval.discrete.numerator / 2))
+					/ interval.discrete.numerator;
+
+				camera_v4l2_mode_select (cam, mode, best, found);
+			}
+		}
+
+		// the fastest interval in the range
+		else if (interval.stepwise.min.numerator) {
+			mode->fps = interval.stepwise.min.denominator / interval.stepwise.min.numerator;
+			if (mode->fps > cam->preferred_fps) mode->fps = cam->preferred_fps;
+
+			camera_v4l2_mode_select (cam, mode, best, found);
+
+			break;
+		}
+
+		n_intervals += 1;
+		interval.index += 1;
+	}
+
+	// some drivers do not report their intervals
+	// so the size is still a candidate at the camera's fps
+	if (!n_intervals) {
+		mode->fps = cam->preferred_fps;
+		camera_v4l2_mode_select (cam, mode, best, found);
+	}
+
+}
+
+static void camera_v4l2_enum_sizes (
+	const Camera *cam, int fd, u32 pixel_format,
+	CameraMode *best, bool *found
+) {
+
+	CameraMode mode = { 0 };
+	mode.pixel_format = pixel_format;
+
+	struct v4l2_frmsizeenum size = { 0 };
+	size.pixel_format = pixel_format;
+
+	while (!camera_v4l2_ioctl (fd, VIDIOC_ENUM_FRAMESIZES, &size)) {
+		if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+			mode.width = size.discrete.width;
+			mode.height = size.discrete.height;
+
+			camera_v4l2_enum_intervals (cam, fd, &mode, best, found);
+		}
+
+		// the preferred size clamped & aligned to the supported range
+		else {
+			mode.width = cam->preferred_width;
+			if (mode.width < size.stepwise.min_width) mode.width = size.stepwise.min_width;
+			if (mode.width > size.stepwise.max_width) mode.width = size.stepwise.max_width;
+			if (size.stepwise.step_width > 1) {
+				mode.width -= (mode.width - size.stepwise.min_width) % size.stepwise.step_width;
+			}
+
+			mode.height = cam->preferred_height;
+			if (mode.height < size.stepwise.min_height) mode.height = size.stepwise.min_height;
+			if (mode.height > size.stepwise.max_height) mode.height = size.stepwise.max_height;
+			if (size.stepwise.step_height > 1) {
+				mode.height -= (mode.height - size.stepwise.min_height) % size.stepwise.step_height;
+			}
+
+			camera_v4l2_enum_intervals (cam, fd, &mode, best, found);
+
+			break;
+		}
+
+		size.index += 1;
+	}
+
+}
+
+// probes every format, size & interval supported by the device
+// and selects the best mode for the camera's preferences
+// returns 0 on success, 1 on error
+static unsigned int camera_v4l2_enum_modes (
+	const Camera *cam, int fd, bool compressed_only, CameraMode *best
+) {
+
+	bool found = false;
+
+	struct v4l2_fmtdesc format = { 0 };
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	while (!camera_v4l2_ioctl (fd, VIDIOC_ENUM_FMT, &format)) {
+		// we are only able to decode these ones
+		if (
+			(format.pixelformat == V4L2_PIX_FMT_YUYV)
+			|| camera_v4l2_format_is_compressed (format.pixelformat)
+		) {
+			if (!compressed_only || camera_v4l2_format_is_compressed (format.pixelformat)) {
+				camera_v4l2_enum_sizes (cam, fd, format.pixelformat, best, &found);
+			}
+		}
+
+		format.index += 1;
+	}
+
+	return found ? 0 : 1;
+
+}
+
+// the probed modes are kept so reopening a device is fast
+struct _CameraModeCache {
+
+	char device[CAMERA_NAME_SIZE];
+
+	u32 preferred_pixel_format;
+	unsigned int preferred_width, preferred_height;
+	unsigned int preferred_fps;
+	bool compressed_only;
+
+	CameraMode mode;
+
+};
+
+typedef struct _CameraModeCache CameraModeCache;
+
+static CameraModeCache camera_modes_cache[CAMERA_MODES_CACHE_SIZE];
+static unsigned int camera_modes_cache_count = 0;
+static unsigned int camera_modes_cache_next = 0;		// the oldest entry when full
+static pthread_mutex_t camera_modes_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool camera_modes_cache_match (
+	const CameraModeCache *entry, const Camera *cam,
+	const char *device, bool compressed_only
+) {
+
+	return !strcmp (entry->device, device)
+		&& (entry->preferred_pixel_format == cam->preferred_pixel_format)
+		&& (entry->preferred_width == cam->preferred_width)
+		&& (entry->preferred_height == cam->preferred_height)
+		&& (entry->preferred_fps == cam->preferred_fps)
+		&& (entry->compressed_only == compressed_only);
+
+}
+
+static bool camera_modes_cache_get (
+	const Camera *cam, const char *device, bool compressed_only, CameraMode *mode
+) {
+
+	bool retval = false;
+
+	(void) pthread_mutex_lock (&camera_modes_cache_mutex);
+
+	for (unsigned int i = 0; i < camera_modes_cache_count; i++) {
+		if (camera_modes_cache_match (&camera_modes_cache[i], cam, device, compressed_only)) {
+			(void) memcpy (mode, &camera_modes_cache[i].mode, sizeof (CameraMode));
+			retval = true;
+			break;
+		}
+	}
+
+	(void) pthread_mutex_unlock (&camera_modes_cache_mutex);
+
+	return retval;
+
+}
+
+static void camera_modes_cache_put (
+	const Camera *cam, const char *device, bool compressed_only, const CameraMode *mode
+) {
+
+	(void) pthread_mutex_lock (&camera_modes_cache_mutex);
+
+	// the oldest entry is replaced when the cache is full
+	CameraModeCache *entry = &camera_modes_cache[camera_modes_cache_next];
+	camera_modes_cache_next = (camera_modes_cache_next + 1) % CAMERA_MODES_CACHE_SIZE;
+
+	(void) strncpy (entry->device, device, CAMERA_NAME_SIZE - 1);
+	entry->device[CAMERA_NAME_SIZE - 1] = '\0';
+	entry->preferred_pixel_format = cam->preferred_pixel_format;
+	entry->preferred_width = cam->preferred_width;
+	entry->preferred_height = cam->preferred_height;
+	entry->preferred_fps = cam->preferred_fps;
+	entry->compressed_only = compressed_only;
+	(void) memcpy (&entry->mode, mode, sizeof (CameraMode));
+
+	if (camera_modes_cache_count < CAMERA_MODES_CACHE_SIZE) camera_modes_cache_count += 1;
+
+	(void) pthread_mutex_unlock (&camera_modes_cache_mutex);
+
+}
+
+// gets the best mode for the device from the cache or by probing it
+// returns 0 on success, 1 on error
+static unsigned int camera_v4l2_negotiate_mode (
+	Camera *cam, int fd, const char *device, bool compressed_only
+) {
+
+	unsigned int retval = 1;
+
+	(void) memset (&cam->mode, 0, sizeof (CameraMode));
+
+	CameraMode mode = { 0 };
+	if (camera_modes_cache_get (cam, device, compressed_only, &mode)) {
+		retval = 0;
+	}
+
+	else if (!camera_v4l2_enum_modes (cam, fd, compressed_only, &mode)) {
+		camera_modes_cache_put (cam, device, compressed_only, &mode);
+		retval = 0;
+	}
+
+	if (!retval) {
+		(void) memcpy (&cam->mode, &mode, sizeof (CameraMode));
+		camera_v4l2_mode_print (device, "selected", &cam->mode);
+
+		if (
+			(mode.width != cam->preferred_width)
+			|| (mode.height != cam->preferred_height)
+			|| (mode.fps < cam->preferred_fps)
+		) {
+			client_log_warning (
+				"%s does not support w: %u x h: %u -- fps: %u - using w: %u x h: %u -- fps: %u",
+				device,
+				cam->preferred_width, cam->preferred_height, cam->preferred_fps,
+				mode.width, mode.height, mode.fps
+			);
+		}
+	}
+
+	else {
+		client_log_warning ("Failed to enumerate %s modes!", device);
+	}
+
+	return retval;
+
+}
+
+// probes a device for its best mode without keeping it open
+// returns 0 on success, 1 on error
+static unsigned int camera_v4l2_probe_mode (
+	Camera *cam, const char *device, bool compressed_only
+) {
+
+	unsigned int retval = 1;
+
+	CameraMode mode = { 0 };
+	if (camera_modes_cache_get (cam, device, compressed_only, &mode)) {
+		retval = camera_v4l2_negotiate_mode (cam, -1, device, compressed_only);
+	}
+
+	else {
+		int fd = open (device, O_RDWR | O_NONBLOCK);
+		if (fd >= 0) {
+			retval = camera_v4l2_negotiate_mode (cam, fd, device, compressed_only);
+			(void) close (fd);
+		}
+	}
+
+	return retval;
+
+}
+
+static unsigned int camera_v4l2_set_format (Camera *cam, const char *device) {
+
+	unsigned int retval = 1;
+
+	(void) camera_v4l2_negotiate_mode (cam, cam->fd, device, false);
+
+	// fallback to our preferences if the device could not be probed
+	CameraMode mode = { 0 };
+	if (cam->mode.width) {
+		(void) memcpy (&mode, &cam->mode, sizeof (CameraMode));
+	}
+
+	else {
+		mode.pixel_format = cam->preferred_pixel_format ?
+			cam->preferred_pixel_format : V4L2_PIX_FMT_YUYV;
+		mode.width = cam->preferred_width;
+		mode.height = cam->preferred_height;
+		mode.fps = cam->preferred_fps;
+	}
+
+	struct v4l2_format format = { 0 };
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	format.fmt.pix.width = mode.width;
+	format.fmt.pix.height = mode.height;
+	format.fmt.pix.pixelformat = mode.pixel_format;
+	format.fmt.pix.field = V4L2_FIELD_NONE;
+
+	if (!camera_v4l2_ioctl (cam->fd, VIDIOC_S_FMT, &format)) {
+		// the driver may have changed any of our values
+		cam->pixel_format = format.fmt.pix.pixelformat;
+		cam->bytes_per_line = format.fmt.pix.bytesperline;
+
+		camera_set_real_size (cam, format.fmt.pix.width, format.fmt.pix.height);
+
+		struct v4l2_streamparm params = { 0 };
+		params.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		params.parm.capture.timeperframe.numerator = 1;
+		params.parm.capture.timeperframe.denominator = mode.fps;
+
+		if (!camera_v4l2_ioctl (cam->fd, VIDIOC_S_PARM, &params)) {
+			if (params.parm.capture.timeperframe.numerator) {
+				cam->real_fps = params.parm.capture.timeperframe.denominator
+					/ params.parm.capture.timeperframe.numerator;
+			}
+		}
+
+		else {
+			cam->real_fps = mode.fps;
+		}
+
+		if (
+			(cam->pixel_format != mode.pixel_format)
+			|| (format.fmt.pix.width != mode.width)
+			|| (format.fmt.pix.height != mode.height)
+			|| (cam->real_fps != mode.fps)
+		) {
+			client_log_warning (
+				"Driver changed the requested mode to w: %u x h: %u -- fps: %u",
+				format.fmt.pix.width, format.fmt.pix.height, cam->real_fps
+			);
+		}
+
+		// we would not be able to wrap any of the frames
+		if (camera_v4l2_frame_format (cam) != PIXZO_FRAME_FORMAT_NONE) {
+			retval = 0;
+		}
+
+		else {
+			client_log_error (
+				"%s pixel format %c%c%c%c is not supported - only YUYV, MJPG & JPEG are!",
+				device,
+				(char) (cam->pixel_format & 0xFF),
+				(char) ((cam->pixel_format >> 8) & 0xFF),
+				(char) ((cam->pixel_format >> 16) & 0xFF),
+				(char) ((cam->pixel_format >> 24) & 0xFF)
+			);
+		}
+	}
+
+	else {
+		client_log_error ("VIDIOC_S_FMT failed: %s", strerror (errno));
+	}
+
+	return retval;
+
+}
+
+static void camera_v4l2_unmap_buffers (Camera *cam) {
+
+	for (unsigned int i = 0; i < CAMERA_V4L2_MAX_BUFFERS; i++) {
+		if (cam->buffers[i].start) {
+			(void) munmap (cam->buffers[i].start, cam->buffers[i].length);
+
+			cam->buffers[i].start = NULL;
+			cam->buffers[i].length = 0;
+		}
+	}
+
+}
+
+static unsigned int camera_v4l2_init_buffers (Camera *cam) {
+
+	unsigned int retval = 1;
+
+	struct v4l2_requestbuffers request = { 0 };
+	request.count = cam->n_buffers;
+	request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	request.memory = V4L2_MEMORY_MMAP;
+
+	if (!camera_v4l2_ioctl (cam->fd, VIDIOC_REQBUFS, &request) && request.count) {
+		cam->n_buffers = (request.count < CAMERA_V4L2_MAX_BUFFERS) ?
+			request.count : CAMERA_V4L2_MAX_BUFFERS;
+
+		unsigned int errors = 0;
+		for (unsigned int i = 0; i < cam->n_buffers; i++) {
+			struct v4l2_buffer buffer = { 0 };
+			buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buffer.memory = V4L2_MEMORY_MMAP;
+			buffer.index = i;
+
+			if (!camera_v4l2_ioctl (cam->fd, VIDIOC_QUERYBUF, &buffer)) {
+				void *start = mmap (
+					NULL, buffer.length,
+					PROT_READ | PROT_WRITE, MAP_SHARED,
+					cam->fd, buffer.m.offset
+				);
+
+				if (start != MAP_FAILED) {
+					cam->buffers[i].start = start;
+					cam->buffers[i].length = buffer.length;
+
+					errors |= (unsigned int) camera_v4l2_ioctl (cam->fd, VIDIOC_QBUF, &buffer) ? 1 : 0;
+				}
+
+				else {
+					errors |= 1;
+				}
+			}
+
+			else {
+				errors |= 1;
+			}
+		}
+
+		if (!errors) {
+			(void) pthread_mutex_lock (cam->buffers_mutex);
+			cam->n_queued = cam->n_buffers;
+			(void) pthread_mutex_unlock (cam->buffers_mutex);
+
+			retval = 0;
+		}
+
+		else {
+			client_log_error ("Failed to map V4L2 buffers: %s", strerror (errno));
+			camera_v4l2_unmap_buffers (cam);
+		}
+	}
+
+	else {
+		client_log_error ("VIDIOC_REQBUFS failed: %s", strerror (errno));
+	}
+
+	return retval;
+
+}
+
+static unsigned int camera_v4l2_stream_on (Camera *cam) {
+
+	unsigned int retval = 1;
+
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (!camera_v4l2_ioctl (cam->fd, VIDIOC_STREAMON, &type)) {
+		(void) pthread_mutex_lock (cam->buffers_mutex);
+		cam->streaming = true;
+		(void) pthread_mutex_unlock (cam->buffers_mutex);
+
+		retval = 0;
+	}
+
+	return retval;
+
+}
+
+static void camera_v4l2_close (Camera *cam) {
+
+	if (cam->fd >= 0) {
+		(void) pthread_mutex_lock (cam->buffers_mutex);
+
+		enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		(void) camera_v4l2_ioctl (cam->fd, VIDIOC_STREAMOFF, &type);
+		cam->streaming = false;
+
+		if (cam->grabbed_idx >= 0) {
+			cam->n_dequeued -= 1;
+			cam->grabbed_idx = -1;
+			cam->grabbed_bytes = 0;
+		}
+
+		// frames might still be wrapping our buffers
+		struct timespec deadline = { 0, 0 };
+		(void) clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += CAMERA_V4L2_CLOSE_TIMEOUT;
+
+		int wait = 0;
+		while (cam->n_dequeued && (wait != ETIMEDOUT)) {
+			wait = pthread_cond_timedwait (cam->buffers_cond, cam->buffers_mutex, &deadline);
+		}
+
+		if (!cam->n_dequeued) {
+			camera_v4l2_unmap_buffers (cam);
+		}
+
+		else {
+			// it is safer to leak the mappings than to unmap them under a consumer
+			client_log_warning (
+				"%u V4L2 buffers are still in use - leaving them mapped",
+				cam->n_dequeued
+			);
+
+			(void) memset (cam->buffers, 0, sizeof (CameraBuffer) * CAMERA_V4L2_MAX_BUFFERS);
+		}
+
+		(void) close (cam->fd);
+		cam->fd = -1;
+
+		cam->n_queued = 0;
+		cam->n_dequeued = 0;
+
+		// late releases from this session must not reach the next one
+		cam->generation += 1;
+
+		(void) pthread_cond_broadcast (cam->buffers_cond);
+		(void) pthread_mutex_unlock (cam->buffers_mutex);
+	}
+
+}
+
+static void camera_v4l2_device (const Camera *cam, char *device) {
+
+	if (strlen (cam->device_name)) {
+		(void) strncpy (device, cam->device_name, CAMERA_NAME_SIZE - 1);
+	}
+
+	else {
+		(void) snprintf (device, CAMERA_NAME_SIZE, "/dev/video%u", cam->device_idx);
+	}
+
+}
+
+static bool camera_v4l2_open (Camera *cam) {
+
+	bool retval = false;
+
+	char device[CAMERA_NAME_SIZE] = { 0 };
+	camera_v4l2_device (cam, device);
+
+	cam->fd = open (device, O_RDWR | O_NONBLOCK);
+	if (cam->fd >= 0) {
+		if (
+			!camera_v4l2_check_capabilities (cam, device)
+			&& !camera_v4l2_set_format (cam, device)
+			&& !camera_v4l2_init_buffers (cam)
+			&& !camera_v4l2_stream_on (cam)
+		) {
+			camera_print_config (cam);
+			camera_v4l2_set_controls (cam);
+
+			client_log_debug (
+				"V4L2 capture info for <%s> is: w: %d x h: %d -- fps: %d -- %c%c%c%c -- %u buffers",
+				device,
+				cam->real_width, cam->real_height, cam->real_fps,
+				(char) (cam->pixel_format & 0xFF),
+				(char) ((cam->pixel_format >> 8) & 0xFF),
+				(char) ((cam->pixel_format >> 16) & 0xFF),
+				(char) ((cam->pixel_format >> 24) & 0xFF),
+				cam->n_buffers
+			);
+
+			retval = true;
+		}
+
+		else {
+			camera_v4l2_close (cam);
+		}
+	}
+
+	else {
+		client_log_error ("Failed to open %s: %s", device, strerror (errno));
+	}
+
+	return retval;
+
+}
+
+// waits until we have at least one buffer owned by the driver
+// every buffer might be held by frames that are still in use
+static bool camera_v4l2_wait_queued (Camera *cam) {
+
+	bool retval = false;
+
+	(void) pthread_mutex_lock (cam->buffers_mutex);
+
+	while (!cam->n_queued && cam->streaming) {
+		(void) pthread_cond_wait (cam->buffers_cond, cam->buffers_mutex);
+	}
+
+	retval = cam->streaming;
+
+	(void) pthread_mutex_unlock (cam->buffers_mutex);
+
+	return retval;
+
+}
+
+// dequeues the next filled buffer without touching its data
+// returns 0 on success, 1 on error
+static u8 camera_v4l2_grab (Camera *cam) {
+
+	u8 retval = 1;
+
+	if (camera_v4l2_wait_queued (cam)) {
+		struct pollfd fds = { 0 };
+		fds.fd = cam->fd;
+		fds.events = POLLIN;
+
+		if (poll (&fds, 1, CAMERA_V4L2_POLL_TIMEOUT) > 0) {
+			struct v4l2_buffer buffer = { 0 };
+			buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buffer.memory = V4L2_MEMORY_MMAP;
+
+			if (!camera_v4l2_ioctl (cam->fd, VIDIOC_DQBUF, &buffer)) {
+				(void) pthread_mutex_lock (cam->buffers_mutex);
+				cam->n_queued -= 1;
+				cam->n_dequeued += 1;
+				(void) pthread_mutex_unlock (cam->buffers_mutex);
+
+				if (!(buffer.flags & V4L2_BUF_FLAG_ERROR) && buffer.bytesused) {
+					cam->grabbed_idx = (int) buffer.index;
+					cam->grabbed_bytes = buffer.bytesused;
+
+					// the time the driver got the first byte of the frame
+					cam->grab_driver_ns = ((u64) buffer.timestamp.tv_sec * 1000000000)
+						+ ((u64) buffer.timestamp.tv_usec * 1000);
+
+					retval = 0;
+				}
+
+				else {
+					camera_buffer_release (cam, (int) buffer.index, cam->generation);
+				}
+			}
+		}
+	}
+
+	return retval;
+
+}
+
+// wraps the last grabbed buffer without copying
+// returns 0 on success, 1 on error
+static u8 camera_v4l2_retrieve (
+	Camera *cam, cv::Mat *raw, int *buffer_idx
+) {
+
+	u8 retval = 1;
+
+	if (cam->grabbed_idx >= 0) {
+		switch (camera_v4l2_frame_format (cam)) {
+			case PIXZO_FRAME_FORMAT_YUYV: {
+				*raw = cv::Mat (
+					cam->capture_height, cam->capture_width, CV_8UC2,
+					cam->buffers[cam->grabbed_idx].start, cam->bytes_per_line
+				);
+
+				// still wraps the same driver buffer
+				if (camera_is_cropped (cam)) {
+					*raw = (*raw) (camera_crop_rect (cam));
+				}
+
+				retval = 0;
+			} break;
+
+			// only the used bytes have the compressed bitstream
+			case PIXZO_FRAME_FORMAT_MJPEG: {
+				*raw = cv::Mat (
+					1, (int) cam->grabbed_bytes, CV_8UC1,
+					cam->buffers[cam->grabbed_idx].start
+				);
+
+				retval = 0;
+			} break;
+
+			default: break;
+		}
+
+		if (!retval) {
+			*buffer_idx = cam->grabbed_idx;
+		}
+
+		else {
+			camera_buffer_release (cam, cam->grabbed_idx, cam->generation);
+		}
+
+		cam->grabbed_idx = -1;
+		cam->grabbed_bytes = 0;
+	}
+
+	return retval;
+
+}
+
+// dequeues the next filled buffer and wraps it without copying
+static u8 camera_v4l2_get (
+	Camera *cam, cv::Mat *raw, int *buffer_idx
+) {
+
+	u8 retval = 1;
+
+	if (!camera_v4l2_grab (cam)) {
+		retval = camera_v4l2_retrieve (cam, raw, buffer_idx);
+	}
+
+	return retval;
+
+}
+
+// returns a dequeued V4L2 buffer back to the driver
+// buffers from a previous session (before a reconnect) are ignored
+void camera_buffer_release (Camera *cam, int buffer_idx, u32 generation) {
+
+	if (cam && (buffer_idx >= 0)) {
+		(void) pthread_mutex_lock (cam->buffers_mutex);
+
+		if (generation == cam->generation) {
+			if (cam->n_dequeued) cam->n_dequeued -= 1;
+
+			if (cam->streaming) {
+				struct v4l2_buffer buffer = { 0 };
+				buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				buffer.memory = V4L2_MEMORY_MMAP;
+				buffer.index = (u32) buffer_idx;
+
+				if (!camera_v4l2_ioctl (cam->fd, VIDIOC_QBUF, &buffer)) {
+					cam->n_queued += 1;
+				}
+			}
+
+			// wakes both the capture & a pending close
+			(void) pthread_cond_broadcast (cam->buffers_cond);
+		}
+
+		(void) pthread_mutex_unlock (cam->buffers_mutex);
+	}
+
+}
+
+#pragma endregion
+
+// uses our preferences as they are
+static void camera_opencv_preferred_mode (Camera *cam) {
+
+	cam->mode.pixel_format = V4L2_PIX_FMT_MJPEG;
+	cam->mode.width = cam->preferred_width;
+	cam->mode.height = cam->preferred_height;
+	cam->mode.fps = cam->preferred_fps;
+
+}
+
+static bool camera_opencv_open (Camera *cam) {
+
+	bool retval = false;
+
+	camera_opencv_preferred_mode (cam);
+
+	cam->passthrough_mjpeg = false;
+
+	switch (cam->type) {
+		case CAMERA_TYPE_MEDIA: {
+			// select a mode that the device actually supports
+			// passthrough requires the device to send MJPEG frames
+			char device[CAMERA_NAME_SIZE] = { 0 };
+			camera_v4l2_device (cam, device);
+			if (camera_v4l2_probe_mode (cam, device, cam->passthrough)) {
+				camera_opencv_preferred_mode (cam);
+			}
+
+			if (cam->device_name) {
+				retval = cam->capture->open (cam->device_name);
+			}
+
+			else {
+				retval = cam->capture->open (cam->device_idx);
+			}
+		} break;
+
+		case CAMERA_TYPE_IP: retval = cam->capture->open (cam->address->str); break;
+		case CAMERA_TYPE_VIDEO: retval = cam->capture->open (cam->filename->str); break;
+
+		default: break;
+	}
+
+	if (cam->capture->isOpened ()) {
+		// set the selected mode for camera
+		// OpenCV & V4L2 fourcc codes share the same layout
+		(void) cam->capture->set (CV_CAP_PROP_FOURCC, (double) cam->mode.pixel_format);
+		(void) cam->capture->set (CV_CAP_PROP_FPS, cam->mode.fps);
+		(void) cam->capture->set (CV_CAP_PROP_FRAME_WIDTH, cam->mode.width);
+		(void) cam->capture->set (CV_CAP_PROP_FRAME_HEIGHT, cam->mode.height);
+
+		// only devices that really send MJPEG can skip the conversion
+		// streams & videos are always converted into BGR frames
+		if (cam->passthrough && (cam->type == CAMERA_TYPE_MEDIA)) {
+			if (
+				(u32) cam->capture->get (CV_CAP_PROP_FOURCC) == V4L2_PIX_FMT_MJPEG
+			) {
+				// get the MJPEG bitstream without decoding it
+				(void) cam->capture->set (CV_CAP_PROP_CONVERT_RGB, 0);
+				cam->passthrough_mjpeg = true;
+			}
+
+			else {
+				client_log_warning (
+					"Camera does not send MJPEG frames, passthrough is disabled!"
+				);
+			}
+		}
+
+		camera_set_real_size (
+			cam,
+			(unsigned int) cam->capture->get (cv::CAP_PROP_FRAME_WIDTH),
+			(unsigned int) cam->capture->get (cv::CAP_PROP_FRAME_HEIGHT)
+		);
+
+		cam->real_fps = cam->capture->get (CV_CAP_PROP_FPS);
+
+		if (
+			(cam->type == CAMERA_TYPE_MEDIA)
+			&& (
+				(cam->capture_width != cam->mode.width)
+				|| (cam->capture_height != cam->mode.height)
+				|| (cam->real_fps != cam->mode.fps)
+			)
+		) {
+			client_log_warning (
+				"Capture changed the requested mode w: %u x h: %u -- fps: %u to w: %u x h: %u -- fps: %u",
+				cam->mode.width, cam->mode.height, cam->mode.fps,
+				cam->capture_width, cam->capture_height, cam->real_fps
+			);
+		}
+
+		// #ifdef PIXZO_DEBUG
+		switch (cam->type) {
+			case CAMERA_TYPE_MEDIA: {
+				camera_print_config (cam);
+
+				camera_print_real_capture_config (cam->capture);
+
+				camera_set_capture_value (cam->capture, CV_CAP_PROP_AUTO_EXPOSURE, "auto exposure", cam->auto_exposure);
+				camera_set_capture_value (cam->capture, CV_CAP_PROP_BRIGHTNESS, "brightness", cam->brightness);
+				camera_set_capture_value (cam->capture, CV_CAP_PROP_CONTRAST, "contrast", cam->contrast);
+				camera_set_capture_value (cam->capture, CV_CAP_PROP_SATURATION, "saturation", cam->saturation);
+				camera_set_capture_value (cam->capture, CV_CAP_PROP_GAIN, "gain", cam->gain);
+				camera_set_capture_value (cam->capture, CV_CAP_PROP_EXPOSURE, "exposure", cam->exposure);
+				camera_set_capture_value (cam->capture, CV_CAP_PROP_SHARPNESS, "sharpness", cam->sharpness);
+
+				if (cam->device_name) {
+					client_log_debug (
+						"Video capture info for <%s> is: w: %d x h: %d -- fps: %d",
+						cam->device_name,
+						cam->real_width, cam->real_height, cam->real_fps
+					);
+				}
+
+				else {
+					client_log_debug (
+						"Video capture info for <%d> is: w: %d x h: %d -- fps: %d",
+						cam->device_idx,
+						cam->real_width, cam->real_height, cam->real_fps
+					);
+				}
+
+				camera_print_real_capture_config (cam->capture);
+			} break;
+			case CAMERA_TYPE_IP: {
+				client_log_debug (
+					"Video capture info for <%s> is: w: %d x h: %d -- fps: %d",
+					cam->address->str,
+					cam->real_width, cam->real_height, cam->real_fps
+				);
+			} break;
+			case CAMERA_TYPE_VIDEO: {
+				client_log_debug (
+					"Video capture info for <%s> is: w: %d x h: %d -- fps: %d",
+					cam->filename->str,
+					cam->real_width, cam->real_height, cam->real_fps
+				);
+			} break;
+
+			default: break;
+		}
+		// #endif
+	}
+
+	return retval;
+
+}
+
+static bool camera_open_internal (Camera *cam) {
+
+	bool retval = false;
+
+	if ((cam->type == CAMERA_TYPE_MEDIA) && (cam->backend == CAMERA_BACKEND_V4L2)) {
+		retval = camera_v4l2_open (cam);
+	}
+
+	else {
+		retval = camera_opencv_open (cam);
+	}
+
+	return retval;
+
+}
+
+static void camera_set_state (Camera *cam, CameraState state) {
+
+	__atomic_store_n (&cam->state, state, __ATOMIC_RELEASE);
+
+}
+
+static bool camera_open_state (Camera *cam) {
+
+	bool retval = camera_open_internal (cam);
+
+	cam->n_failures = 0;
+	camera_set_state (
+		cam, retval ? CAMERA_STATE_CONNECTED : CAMERA_STATE_DISCONNECTED
+	);
+
+	return retval;
+
+}
+
+// opens the camera using the values set on its creation
+// returns true on success, false on error
+bool camera_open (Camera *cam) {
+
+	return cam ? camera_open_state (cam) : false;
+
+}
+
+// opens a camera using the video file as the input
+// camera must be of type CAMERA_TYPE_VIDEO
+// returns true on success, false on error
+bool camera_open (Camera *cam, const String *filename) {
+
+	bool retval = false;
+
+	if (cam && filename) {
+		cam->filename = filename;
+		retval = camera_open_state (cam);
+	}
+
+	return retval;
+
+}
+
+// gets the next camera frame
+// applies configuration to the new frame
+u8 camera_get (Camera *cam, cv::Mat *frame) {
+
+	u8 retval = 1;
+
+	if (cam->backend == CAMERA_BACKEND_V4L2) {
+		// the frame needs to own its pixels
+		cv::Mat raw;
+		int buffer_idx = -1;
+		if (!camera_v4l2_get (cam, &raw, &buffer_idx)) {
+			pixzo_frame_decode_data (camera_v4l2_frame_format (cam), raw, *frame);
+			raw.release ();
+
+			camera_buffer_release (cam, buffer_idx, cam->generation);
+
+			// YUYV data was already cropped when it was retrieved
+			if (
+				camera_is_cropped (cam)
+				&& (camera_v4l2_frame_format (cam) == PIXZO_FRAME_FORMAT_MJPEG)
+				&& !frame->empty ()
+			) {
+				*frame = (*frame) (camera_crop_rect (cam));
+			}
+		}
+	}
+
+	else {
+		if (cam->passthrough_mjpeg) {
+			cv::Mat raw;
+			*cam->capture >> raw;
+			if (!raw.empty ()) {
+				pixzo_frame_decode_data (PIXZO_FRAME_FORMAT_MJPEG, raw, *frame);
+			}
+		}
+
+		else {
+			*cam->capture >> *frame;
+		}
+
+		if (camera_is_cropped (cam) && !frame->empty ()) {
+			*frame = (*frame) (camera_crop_rect (cam));
+		}
+	}
+
+	if (!frame->empty ()) {
+		switch (cam->rotation) {
+			case CAMERA_ROTATION_90_CLOCKWISE:
+				cv::rotate (*frame, *frame, cv::ROTATE_90_CLOCKWISE);
+				break;
+
+			case CAMERA_ROTATION_90_COUNTERCLOCKWISE:
+				cv::rotate (*frame, *frame, cv::ROTATE_90_COUNTERCLOCKWISE);
+				break;
+
+			case CAMERA_ROTATION_180:
+				cv::rotate (*frame, *frame, cv::ROTATE_180);
+				break;
+
+			default: break;
+		}
+
+		retval = 0;
+	}
+
+	return retval;
+
+}
+
+cv::Mat *camera_get (Camera *cam) {
+
+	cv::Mat *frame = new cv::Mat ();
+	if (frame) {
+		(void) camera_get (cam, frame);
+	}
+
+	return frame;
+
+}
+
+// grabs the next frame from the device without decoding it
+// so that many cameras can be grabbed back to back
+// returns 0 on success, 1 on error
+u8 camera_grab (Camera *cam) {
+
+	u8 retval = 1;
+
+	if (cam->backend == CAMERA_BACKEND_V4L2) {
+		retval = camera_v4l2_grab (cam);
+	}
+
+	else {
+		retval = cam->capture->grab () ? 0 : 1;
+
+		// the backend's timestamp of the grabbed frame
+		double pos_msec = cam->capture->get (cv::CAP_PROP_POS_MSEC);
+		cam->grab_driver_ns = (pos_msec > 0) ? (u64) (pos_msec * 1000000) : 0;
+	}
+
+	// taken only once for each frame
+	cam->grab_ns = pixzo_frame_time_ns ();
+	(void) time (&cam->grab_time);
+
+	if (!retval) {
+		cam->n_failures = 0;
+	}
+
+	// a video file that has ended is not reconnected
+	else if (cam->type != CAMERA_TYPE_VIDEO) {
+		cam->n_failures += 1;
+		if (
+			(cam->n_failures >= CAMERA_MAX_FAILURES)
+			&& (camera_get_state (cam) == CAMERA_STATE_CONNECTED)
+		) {
+			client_log_warning (
+				"Camera has failed %u consecutive grabs - it is now disconnected",
+				cam->n_failures
+			);
+
+			cam->reconnect_delay = CAMERA_RECONNECT_MIN_DELAY;
+			camera_set_state (cam, CAMERA_STATE_DISCONNECTED);
+		}
+	}
+
+	return retval;
+
+}
+
+static void camera_retrieve_timestamps (
+	const Camera *cam, PixzoFrame *pixzo_frame
+) {
+
+	pixzo_frame->info.timestamp = cam->grab_time;
+	pixzo_frame->info.capture_ns = cam->grab_ns;
+	pixzo_frame->info.driver_ns = cam->grab_driver_ns;
+
+}
+
+// gets the last grabbed frame into a pixzo frame
+// with the V4L2 backend, the frame wraps the driver buffer
+// until it is returned with camera_buffer_release ()
+// returns 0 on success, 1 on error
+u8 camera_retrieve (Camera *cam, PixzoFrame *pixzo_frame) {
+
+	u8 retval = 1;
+
+	camera_retrieve_timestamps (cam, pixzo_frame);
+
+	if (cam->backend == CAMERA_BACKEND_V4L2) {
+		if (!camera_v4l2_retrieve (cam, pixzo_frame->raw, &pixzo_frame->buffer_idx)) {
+			pixzo_frame->buffer_generation = cam->generation;
+			pixzo_frame->format = camera_v4l2_frame_format (cam);
+			pixzo_frame->info.rotation = cam->rotation;
+			pixzo_frame->decoded = false;
+			pixzo_frame->cam = cam;
+
+			// compressed data can only be cropped after being decoded
+			if (
+				camera_is_cropped (cam)
+				&& (pixzo_frame->format == PIXZO_FRAME_FORMAT_MJPEG)
+			) {
+				(void) memcpy (&pixzo_frame->crop, &cam->crop, sizeof (CameraRoi));
+			}
+
+			retval = 0;
+		}
+	}
+
+	else if (cam->passthrough_mjpeg) {
+		(void) cam->capture->retrieve (*pixzo_frame->raw);
+		if (!pixzo_frame->raw->empty ()) {
+			pixzo_frame->format = PIXZO_FRAME_FORMAT_MJPEG;
+			pixzo_frame->info.rotation = cam->rotation;
+			pixzo_frame->decoded = false;
+
+			if (camera_is_cropped (cam)) {
+				(void) memcpy (&pixzo_frame->crop, &cam->crop, sizeof (CameraRoi));
+			}
+
+			retval = 0;
+		}
+	}
+
+	// the rotation is carried with the frame and only applied
+	// by the consumers to their (smaller) resized frames
+	// the capture writes into the frame's existing buffer
+	else {
+		(void) cam->capture->retrieve (*pixzo_frame->pixels);
+		if (!pixzo_frame->pixels->empty ()) {
+			// the frame only references the roi of the full captured frame
+			if (camera_is_cropped (cam)) {
+				*pixzo_frame->frame = (*pixzo_frame->pixels) (camera_crop_rect (cam));
+			}
+
+			else {
+				*pixzo_frame->frame = *pixzo_frame->pixels;
+			}
+
+			pixzo_frame->format = PIXZO_FRAME_FORMAT_BGR;
+			pixzo_frame->info.rotation = cam->rotation;
+			pixzo_frame->decoded = true;
+
+			retval = 0;
+		}
+	}
+
+	return retval;
+
+}
+
+// gets the next camera frame into a pixzo frame
+// with the V4L2 backend, the frame wraps the driver buffer
+// until it is returned with camera_buffer_release ()
+// returns 0 on success, 1 on error
+u8 camera_get (Camera *cam, PixzoFrame *pixzo_frame) {
+
+	u8 retval = 1;
+
+	if (!camera_grab (cam)) {
+		retval = camera_retrieve (cam, pixzo_frame);
+	}
+
+	return retval;
+
+}
+
+// returns the camera's current connection state
+CameraState camera_get_state (const Camera *cam) {
+
+	return __atomic_load_n (&cam->state, __ATOMIC_ACQUIRE);
+
+}
+
+// returns how many ms to wait before trying to reconnect
+// doubles after every failed attempt up to CAMERA_RECONNECT_MAX_DELAY
+unsigned int camera_get_reconnect_delay (const Camera *cam) {
+
+	return cam->reconnect_delay;
+
+}
+
+static void camera_close_internal (Camera *cam) {
+
+	if (cam->capture) {
+		cam->capture->release ();
+	}
+
+	camera_v4l2_close (cam);
+
+}
+
+// closes & opens again a disconnected camera
+// returns true on success, false on error
+bool camera_reconnect (Camera *cam) {
+
+	bool retval = false;
+
+	if (cam) {
+		camera_set_state (cam, CAMERA_STATE_RECONNECTING);
+		cam->n_reconnects += 1;
+
+		camera_close_internal (cam);
+
+		if (camera_open_state (cam)) {
+			cam->reconnect_delay = CAMERA_RECONNECT_MIN_DELAY;
+			retval = true;
+		}
+
+		else {
+			cam->reconnect_delay *= 2;
+			if (cam->reconnect_delay > CAMERA_RECONNECT_MAX_DELAY) {
+				cam->reconnect_delay = CAMERA_RECONNECT_MAX_DELAY;
+			}
+		}
+	}
+
+	return retval;
+
+}
+
+// closes the camera's video capture
+void camera_close (Camera *cam) {
+
+	if (cam) {
+		camera_close_internal (cam);
+
+		camera_set_state (cam, CAMERA_STATE_NONE);
+	}
+
+}
+
+void camera_print (const Camera *cam) {
+
+	if (cam) {
+		(void) printf ("\t\tCamera type: %s\n", camera_type_to_string (cam->type));
+		(void) printf ("\t\tBackend: %s\n", camera_backend_to_string (cam->backend));
+		(void) printf ("\t\tState: %s\n", camera_state_to_string (camera_get_state (cam)));
+		(void) printf ("\t\tReconnects: %lu\n", cam->n_reconnects);
+
+		switch (cam->type) {
+			case CAMERA_TYPE_NONE: break;
+
+			case CAMERA_TYPE_MEDIA: {
+				if (cam->device_name) {
+					(void) printf ("\t\tDevice idx: %d\n", cam->device_idx);
+				}
+
+				else {
+					(void) printf ("\t\tDevice name: %s\n", cam->device_name);
+				}
+			} break;
+
+			case CAMERA_TYPE_IP:
+				(void) printf ("\t\tAddress: %s\n", cam->address->str);
+				break;
+
+			default: break;
+		}
+
+		(void) printf ("\t\tPreferred width: %u\n", cam->preferred_width);
+		(void) printf ("\t\tPreferred height: %u\n", cam->preferred_height);
+		(void) printf ("\t\tPreferred fps: %u\n", cam->preferred_fps);
+
+		(void) printf ("\t\tReal width: %u\n", cam->real_width);
+		(void) printf ("\t\tReal height: %u\n", cam->real_height);
+		(void) printf ("\t\tReal fps: %u\n", cam->real_fps);
+
+		if (cam->roi.width && cam->roi.height) {
+			(void) printf (
+				"\t\tRoi: x: %u y: %u -- w: %u x h: %u\n",
+				cam->crop.x, cam->crop.y, cam->crop.width, cam->crop.height
+			);
+		}
 
 		(void) printf ("\t\tAuto exposure: %.2f\n", cam->auto_exposure);
 		(void) printf ("\t\tBrightness: %.2f\n", cam->brightness);
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include <client/utils/log.h>
 
@@ -29,6 +30,8 @@ void config_init (Config *config) {
 	config->max_no_movement_frames = CONFIG_DEFAULT_NO_MOVEMENT_FRAMES;
 
 	config->max_actions_memory_size = CONFIG_DEFAULT_MAX_ACTIONS_MEM_SIZE;
+	config->max_action_frames = CONFIG_DEFAULT_MAX_ACTION_FRAMES;
+	config->memory_compression = CONFIG_DEFAULT_MEMORY_COMPRESSION;
 
 	config->videos_n_loops = CONFIG_DEFAULT_VIDEOS_N_LOOPS;
 
@@ -38,6 +41,25 @@ void config_init (Config *config) {
 	config->record = CONFIG_DEFAULT_RECORD;
 	config->output_path = NULL;
 
+	config->sync_capture = CONFIG_DEFAULT_SYNC_CAPTURE;
+
+	config->huge_pages = CONFIG_DEFAULT_HUGE_PAGES;
+
+	config->memory_budget = CONFIG_DEFAULT_MEMORY_BUDGET;
+	config->memory_policy = CONFIG_DEFAULT_MEMORY_POLICY;
+
+	config->spill_path = NULL;
+	config->spill_segment_size = CONFIG_DEFAULT_SPILL_SEGMENT_SIZE;
+	config->spill_segments = CONFIG_DEFAULT_SPILL_SEGMENTS;
+
+	config->workers = CONFIG_DEFAULT_WORKERS;
+	config->workers_cpus = NULL;
+
+	config->shutdown_timeout = CONFIG_DEFAULT_SHUTDOWN_TIMEOUT;
+
+	config->capture_sched = CONFIG_DEFAULT_CAPTURE_SCHED;
+	config->capture_priority = CONFIG_DEFAULT_CAPTURE_PRIORITY;
+
 	config->cams_settings_filename = CONFIG_DEFAULT_CAMS_SETTINGS;
 
 	config->connect = CONFIG_DEFAULT_CONNECT;
@@ -104,6 +126,81 @@ static unsigned int config_validate_videos_path (
 	
 }
 
+// must match the memory's compression values
+static unsigned int config_validate_memory_compression (
+	const char *memory_compression
+) {
+
+	unsigned int errors = 0;
+
+	if (
+		strcasecmp (memory_compression, "none")
+		&& strcasecmp (memory_compression, "png")
+		&& strcasecmp (memory_compression, "jpeg")
+	) {
+		client_log_error (
+			"Unknown memory compression %s - only none, png & jpeg are supported!",
+			memory_compression
+		);
+
+		errors = 1;
+	}
+
+	return errors;
+
+}
+
+// must match the memory budget's policy values
+static unsigned int config_validate_memory_policy (
+	const char *memory_policy
+) {
+
+	unsigned int errors = 0;
+
+	if (
+		strcasecmp (memory_policy, "none")
+		&& strcasecmp (memory_policy, "drop_oldest")
+		&& strcasecmp (memory_policy, "drop_newest")
+		&& strcasecmp (memory_policy, "decimate")
+		&& strcasecmp (memory_policy, "block")
+	) {
+		client_log_error (
+			"Unknown memory policy %s - only none, drop_oldest, drop_newest, decimate & block are supported!",
+			memory_policy
+		);
+
+		errors = 1;
+	}
+
+	return errors;
+
+}
+
+// must match the affinity's sched values
+static unsigned int config_validate_capture_sched (
+	const char *capture_sched
+) {
+
+	unsigned int errors = 0;
+
+	if (
+		strcasecmp (capture_sched, "none")
+		&& strcasecmp (capture_sched, "other")
+		&& strcasecmp (capture_sched, "fifo")
+		&& strcasecmp (capture_sched, "rr")
+	) {
+		client_log_error (
+			"Unknown capture sched %s - only none, other, fifo & rr are supported!",
+			capture_sched
+		);
+
+		errors = 1;
+	}
+
+	return errors;
+
+}
+
 unsigned int config_validate_single (
 	const Config *config
 ) {
@@ -116,6 +213,12 @@ unsigned int config_validate_single (
 
 	errors |= config_validate_camera_name (config->camera_name);
 
+	errors |= config_validate_memory_compression (config->memory_compression);
+
+	errors |= config_validate_memory_policy (config->memory_policy);
+
+	errors |= config_validate_capture_sched (config->capture_sched);
+
 	return errors;
 
 }
@@ -132,6 +235,12 @@ unsigned int config_validate_videos (
 
 	errors |= config_validate_videos_path (config->videos_path);
 
+	errors |= config_validate_memory_compression (config->memory_compression);
+
+	errors |= config_validate_memory_policy (config->memory_policy);
+
+	errors |= config_validate_capture_sched (config->capture_sched);
+
 	return errors;
 
 }
@@ -183,11 +292,30 @@ void config_log (const Config *config) {
 	client_log_debug ("Max no mov frames: %u", config->max_no_movement_frames);
 
 	client_log_debug ("Max actions mem size: %u", config->max_actions_memory_size);
+	client_log_debug ("Max action frames: %u", config->max_action_frames);
+	client_log_debug ("Memory compression: %s", config->memory_compression);
 	client_log_debug ("Wait key delay: %u", config->wait_key_delay);
 
 	client_log_debug ("Record: %s", config->record ? true_str : false_str);
 	client_log_debug ("Output path: %s", config->output_path ? config->output_path : null);
 
+	client_log_debug ("Sync capture: %s", config->sync_capture ? true_str : false_str);
+
+	client_log_debug ("Huge pages: %s", config->huge_pages ? true_str : false_str);
+
+	client_log_debug ("Memory budget: %u MB", config->memory_budget);
+	client_log_debug ("Memory policy: %s", config->memory_policy);
+
+	client_log_debug ("Spill path: %s", config->spill_path ? config->spill_path : null);
+	client_log_debug ("Spill segments: %u x %u MB", config->spill_segments, config->spill_segment_size);
+
+	client_log_debug ("Workers: %u", config->workers);
+	client_log_debug ("Workers cpus: %s", config->workers_cpus ? config->workers_cpus : null);
+
+	client_log_debug ("Shutdown timeout: %u ms", config->shutdown_timeout);
+
+	client_log_debug ("Capture sched: %s (%u)", config->capture_sched, config->capture_priority);
+
 	client_log_debug ("Cameras config file: %s", config->cams_settings_filename);
 
 	client_log_debug ("Connect: %s", config->connect ? true_str : false_str);
@@ -220,6 +348,8 @@ void config_help (void) {
 	(void) printf ("--max_no_mov [n frames]  The max number of frames to allow without movement\n");
 
 	(void) printf ("--actions_mem_size [n]   How many actions to keep in memory\n");
+	(void) printf ("--max_action_frames [n]  How many frames of each action to keep in memory\n");
+	(void) printf ("--memory_compression [c] How to hold the actions' frames (none, png, jpeg)\n");
 
 	(void) printf ("--videos_n_loops [n]     How many times to repeat the videos\n");
 
@@ -229,6 +359,29 @@ void config_help (void) {
 	(void) printf ("--record                 Option to record videos from streams\n");
 	(void) printf ("-o [output]              Specifies the output path for videos & images\n");
 
+	(void) printf ("--sync_capture           Grabs all the store's cameras at the same time\n");
+
+	(void) printf ("--huge_pages             Allocates the frames' pixels from 2 MB huge pages\n");
+
+	(void) printf ("--memory_budget [MB]     Max memory for all the live frames (0 for no limit)\n");
+	(void) printf ("--memory_policy [policy] What to do when over budget\n");
+	(void) printf ("   drop_oldest           Drop the oldest queued frames (default)\n");
+	(void) printf ("   drop_newest           Drop the new frames\n");
+	(void) printf ("   decimate              Only keep every other new frame when close to the budget\n");
+	(void) printf ("   block                 Wait until there is room (drops the frame after a second)\n");
+
+	(void) printf ("--spill_path [path]      Writes the actions' frames that don't fit in memory to disk\n");
+	(void) printf ("--spill_segment_size [MB] The size of each spill log segment\n");
+	(void) printf ("--spill_segments [n]     How many spill log segments to reuse\n");
+
+	(void) printf ("--workers [n]            Threads that handle every stream's frames (defaults to one per cpu)\n");
+	(void) printf ("--workers_cpus [list]    Pins the workers to a cpu list like 0-3,8\n");
+
+	(void) printf ("--shutdown_timeout [ms]  Max time to handle the pending frames when closing (0 to wait for all)\n");
+
+	(void) printf ("--capture_sched [value]  Capture threads scheduling: none, other, fifo or rr\n");
+	(void) printf ("--capture_priority [n]   Capture threads priority for fifo & rr\n");
+
 	(void) printf ("--cams [filename]        Specifies a custom cameras settings filename\n");
 
 	(void) printf ("--connect [value]        Enables connection to the main cerver (defaults to TRUE)\n");
@@ -355,6 +508,24 @@ void config_get_values (
 			}
 		}
 
+		// max_action_frames
+		else if (!strcmp (curr_arg, "--max_action_frames")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->max_action_frames = (unsigned int) atoi (argv[j]);
+				i++;
+			}
+		}
+
+		// memory_compression
+		else if (!strcmp (curr_arg, "--memory_compression")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->memory_compression = argv[j];
+				i++;
+			}
+		}
+
 		// videos_n_loops
 		else if (!strcmp (curr_arg, "--videos_n_loops")) {
 			j = i + 1;
@@ -392,6 +563,106 @@ void config_get_values (
 			}
 		}
 
+		// sync_capture
+		else if (!strcmp (curr_arg, "--sync_capture")) {
+			config->sync_capture = true;
+		}
+
+		// huge_pages
+		else if (!strcmp (curr_arg, "--huge_pages")) {
+			config->huge_pages = true;
+		}
+
+		// memory_budget
+		else if (!strcmp (curr_arg, "--memory_budget")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->memory_budget = (unsigned int) atoi (argv[j]);
+				i++;
+			}
+		}
+
+		// memory_policy
+		else if (!strcmp (curr_arg, "--memory_policy")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->memory_policy = argv[j];
+				i++;
+			}
+		}
+
+		// spill_path
+		else if (!strcmp (curr_arg, "--spill_path")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->spill_path = argv[j];
+				i++;
+			}
+		}
+
+		// spill_segment_size
+		else if (!strcmp (curr_arg, "--spill_segment_size")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->spill_segment_size = (unsigned int) atoi (argv[j]);
+				i++;
+			}
+		}
+
+		// spill_segments
+		else if (!strcmp (curr_arg, "--spill_segments")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->spill_segments = (unsigned int) atoi (argv[j]);
+				i++;
+			}
+		}
+
+		// workers
+		else if (!strcmp (curr_arg, "--workers")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->workers = (unsigned int) atoi (argv[j]);
+				i++;
+			}
+		}
+
+		// workers_cpus
+		else if (!strcmp (curr_arg, "--workers_cpus")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->workers_cpus = argv[j];
+				i++;
+			}
+		}
+
+		// shutdown_timeout
+		else if (!strcmp (curr_arg, "--shutdown_timeout")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->shutdown_timeout = (unsigned int) atoi (argv[j]);
+				i++;
+			}
+		}
+
+		// capture_sched
+		else if (!strcmp (curr_arg, "--capture_sched")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->capture_sched = argv[j];
+				i++;
+			}
+		}
+
+		// capture_priority
+		else if (!strcmp (curr_arg, "--capture_priority")) {
+			j = i + 1;
+			if (j <= argc) {
+				config->capture_priority = (unsigned int) atoi (argv[j]);
+				i++;
+			}
+		}
+
 		// get the cameras settings filename
 		else if (!strcmp (curr_arg, "--cams")) {
 			j = i + 1;
@@ -0,0 +1,425 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <time.h>
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#include <client/threads/thread.h>
+
+#include <client/utils/log.h>
+
+#include "affinity.hpp"
+#include "executor.hpp"
+
+// the worker that is running in the current thread, if any
+static __thread ExecutorWorker *executor_current_worker = NULL;
+
+static unsigned int executor_worker_init (
+	Executor *executor, ExecutorWorker *worker, unsigned int idx
+) {
+
+	worker->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+	(void) pthread_mutex_init (worker->mutex, NULL);
+
+	worker->head = 0;
+	worker->tail = 0;
+	worker->tasks = (ExecutorTask *) calloc (
+		EXECUTOR_WORKER_QUEUE_SIZE, sizeof (ExecutorTask)
+	);
+
+	worker->executor = executor;
+	worker->idx = idx;
+	worker->thread_id = 0;
+
+	worker->n_tasks = 0;
+	worker->n_stolen = 0;
+	worker->n_sleeps = 0;
+
+	return worker->tasks ? 0 : 1;
+
+}
+
+static void executor_worker_end (ExecutorWorker *worker) {
+
+	if (worker->mutex) {
+		(void) pthread_mutex_destroy (worker->mutex);
+		free (worker->mutex);
+		worker->mutex = NULL;
+	}
+
+	free (worker->tasks);
+	worker->tasks = NULL;
+
+}
+
+// creates a new executor with n_workers threads
+// 0 to use one worker for each online cpu
+Executor *executor_create (unsigned int n_workers) {
+
+	Executor *executor = NULL;
+
+	if (!n_workers) {
+		long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+		n_workers = (n_cpus > 0) ? (unsigned int) n_cpus : 1;
+	}
+
+	if (n_workers > EXECUTOR_MAX_WORKERS) n_workers = EXECUTOR_MAX_WORKERS;
+
+	void *workers_ptr = NULL;
+	if (!posix_memalign (
+		&workers_ptr, EXECUTOR_CACHE_LINE, n_workers * sizeof (ExecutorWorker)
+	)) {
+		executor = (Executor *) malloc (sizeof (Executor));
+		if (executor) {
+			executor->workers = (ExecutorWorker *) workers_ptr;
+			executor->n_workers = n_workers;
+
+			executor->running = false;
+			executor->next_worker = 0;
+
+			executor->pending = 0;
+			executor->n_idle = 0;
+
+			executor->idle_mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+			(void) pthread_mutex_init (executor->idle_mutex, NULL);
+
+			executor->idle_cond = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+			(void) pthread_cond_init (executor->idle_cond, NULL);
+
+			thread_affinity_init (&executor->affinity);
+
+			executor->n_inline = 0;
+
+			unsigned int errors = 0;
+			for (unsigned int i = 0; i < n_workers; i++) {
+				errors |= executor_worker_init (executor, &executor->workers[i], i);
+			}
+
+			if (errors) {
+				executor_delete (executor);
+				executor = NULL;
+			}
+		}
+
+		else {
+			free (workers_ptr);
+		}
+	}
+
+	return executor;
+
+}
+
+// stops the executor if it was still running
+void executor_delete (void *executor_ptr) {
+
+	if (executor_ptr) {
+		Executor *executor = (Executor *) executor_ptr;
+
+		executor_stop (executor);
+
+		for (unsigned int i = 0; i < executor->n_workers; i++) {
+			executor_worker_end (&executor->workers[i]);
+		}
+
+		free (executor->workers);
+
+		(void) pthread_mutex_destroy (executor->idle_mutex);
+		free (executor->idle_mutex);
+
+		(void) pthread_cond_destroy (executor->idle_cond);
+		free (executor->idle_cond);
+
+		free (executor);
+	}
+
+}
+
+// the owner takes its newest task as its data is still in its cache
+static bool executor_worker_pop (
+	ExecutorWorker *worker, ExecutorTask *task
+) {
+
+	bool popped = false;
+
+	(void) pthread_mutex_lock (worker->mutex);
+
+	if (worker->tail != worker->head) {
+		worker->tail -= 1;
+		*task = worker->tasks[worker->tail & (EXECUTOR_WORKER_QUEUE_SIZE - 1)];
+		popped = true;
+	}
+
+	(void) pthread_mutex_unlock (worker->mutex);
+
+	return popped;
+
+}
+
+// thieves take the oldest task
+static bool executor_worker_steal (
+	ExecutorWorker *worker, ExecutorTask *task
+) {
+
+	bool stolen = false;
+
+	(void) pthread_mutex_lock (worker->mutex);
+
+	if (worker->tail != worker->head) {
+		*task = worker->tasks[worker->head & (EXECUTOR_WORKER_QUEUE_SIZE - 1)];
+		worker->head += 1;
+		stolen = true;
+	}
+
+	(void) pthread_mutex_unlock (worker->mutex);
+
+	return stolen;
+
+}
+
+// returns false if the worker's queue is full
+static bool executor_worker_push (
+	ExecutorWorker *worker, ExecutorWork work, void *args
+) {
+
+	bool pushed = false;
+
+	(void) pthread_mutex_lock (worker->mutex);
+
+	if ((worker->tail - worker->head) < EXECUTOR_WORKER_QUEUE_SIZE) {
+		ExecutorTask *task = &worker->tasks[worker->tail & (EXECUTOR_WORKER_QUEUE_SIZE - 1)];
+		task->work = work;
+		task->args = args;
+
+		worker->tail += 1;
+		pushed = true;
+	}
+
+	(void) pthread_mutex_unlock (worker->mutex);
+
+	return pushed;
+
+}
+
+static bool executor_worker_take (
+	ExecutorWorker *worker, ExecutorTask *task
+) {
+
+	Executor *executor = worker->executor;
+
+	bool taken = executor_worker_pop (worker, task);
+	for (unsigned int i = 1; !taken && (i < executor->n_workers); i++) {
+		taken = executor_worker_steal (
+			&executor->workers[(worker->idx + i) % executor->n_workers], task
+		);
+
+		if (taken) worker->n_stolen += 1;
+	}
+
+	if (taken) {
+		(void) __atomic_sub_fetch (&executor->pending, 1, __ATOMIC_SEQ_CST);
+	}
+
+	return taken;
+
+}
+
+// sleeps until a new task is submitted
+// pairs with executor_submit () checking for idle workers
+static void executor_worker_sleep (ExecutorWorker *worker) {
+
+	Executor *executor = worker->executor;
+
+	(void) pthread_mutex_lock (executor->idle_mutex);
+
+	(void) __atomic_add_fetch (&executor->n_idle, 1, __ATOMIC_SEQ_CST);
+
+	if (executor->running && !__atomic_load_n (&executor->pending, __ATOMIC_SEQ_CST)) {
+		struct timespec timeout = { 0 };
+		(void) clock_gettime (CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += EXECUTOR_IDLE_TIMEOUT * 1000000;
+		timeout.tv_sec += timeout.tv_nsec / 1000000000;
+		timeout.tv_nsec %= 1000000000;
+
+		(void) pthread_cond_timedwait (
+			executor->idle_cond, executor->idle_mutex, &timeout
+		);
+
+		worker->n_sleeps += 1;
+	}
+
+	(void) __atomic_sub_fetch (&executor->n_idle, 1, __ATOMIC_SEQ_CST);
+
+	(void) pthread_mutex_unlock (executor->idle_mutex);
+
+}
+
+static void *executor_worker_thread (void *worker_ptr) {
+
+	ExecutorWorker *worker = (ExecutorWorker *) worker_ptr;
+	Executor *executor = worker->executor;
+
+	char thread_name[THREAD_NAME_BUFFER_SIZE] = { 0 };
+	(void) snprintf (
+		thread_name, THREAD_NAME_BUFFER_SIZE,
+		"worker-%u", worker->idx
+	);
+
+	(void) thread_set_name (thread_name);
+	(void) thread_affinity_apply (&executor->affinity, thread_name);
+
+	executor_current_worker = worker;
+
+	// the queued tasks are finished before exiting
+	ExecutorTask task = { 0 };
+	while (
+		executor->running
+		|| __atomic_load_n (&executor->pending, __ATOMIC_SEQ_CST)
+	) {
+		if (executor_worker_take (worker, &task)) {
+			task.work (task.args);
+			worker->n_tasks += 1;
+		}
+
+		else {
+			executor_worker_sleep (worker);
+		}
+	}
+
+	executor_current_worker = NULL;
+
+	return NULL;
+
+}
+
+// sets where the workers run
+// must be called before the executor is started
+void executor_set_affinity (
+	Executor *executor, const ThreadAffinity *affinity
+) {
+
+	if (executor && affinity && !executor->running) {
+		executor->affinity = *affinity;
+	}
+
+}
+
+// creates the workers' threads
+// returns 0 on success, 1 on error
+unsigned int executor_start (Executor *executor) {
+
+	unsigned int retval = 1;
+
+	if (executor && !executor->running) {
+		executor->running = true;
+
+		unsigned int errors = 0;
+		for (unsigned int i = 0; i < executor->n_workers; i++) {
+			if (pthread_create (
+				&executor->workers[i].thread_id, NULL,
+				executor_worker_thread, &executor->workers[i]
+			)) {
+				client_log_error ("Failed to create executor's worker %u thread!", i);
+				executor->workers[i].thread_id = 0;
+				errors |= 1;
+			}
+		}
+
+		client_log_success (
+			"Executor has started with %u workers!", executor->n_workers
+		);
+
+		retval = errors;
+	}
+
+	return retval;
+
+}
+
+// queues a new task to be run by any worker
+// tasks submitted by a worker are added to its own queue
+void executor_submit (
+	Executor *executor, ExecutorWork work, void *args
+) {
+
+	unsigned int first = 0;
+	if (executor_current_worker && (executor_current_worker->executor == executor)) {
+		first = executor_current_worker->idx;
+	}
+
+	else {
+		first = __atomic_fetch_add (&executor->next_worker, 1, __ATOMIC_RELAXED)
+			% executor->n_workers;
+	}
+
+	// counted before it can be taken
+	(void) __atomic_add_fetch (&executor->pending, 1, __ATOMIC_SEQ_CST);
+
+	bool queued = false;
+	for (unsigned int i = 0; !queued && (i < executor->n_workers); i++) {
+		queued = executor_worker_push (
+			&executor->workers[(first + i) % executor->n_workers], work, args
+		);
+	}
+
+	if (queued) {
+		if (__atomic_load_n (&executor->n_idle, __ATOMIC_SEQ_CST)) {
+			(void) pthread_mutex_lock (executor->idle_mutex);
+			(void) pthread_cond_signal (executor->idle_cond);
+			(void) pthread_mutex_unlock (executor->idle_mutex);
+		}
+	}
+
+	else {
+		(void) __atomic_sub_fetch (&executor->pending, 1, __ATOMIC_SEQ_CST);
+
+		// every queue is full so the submitter does the work
+		(void) __atomic_add_fetch (&executor->n_inline, 1, __ATOMIC_RELAXED);
+		work (args);
+	}
+
+}
+
+// waits for the workers to finish their queued tasks
+// and then stops them
+void executor_stop (Executor *executor) {
+
+	if (executor && executor->running) {
+		(void) pthread_mutex_lock (executor->idle_mutex);
+		executor->running = false;
+		(void) pthread_cond_broadcast (executor->idle_cond);
+		(void) pthread_mutex_unlock (executor->idle_mutex);
+
+		for (unsigned int i = 0; i < executor->n_workers; i++) {
+			if (executor->workers[i].thread_id) {
+				(void) pthread_join (executor->workers[i].thread_id, NULL);
+				executor->workers[i].thread_id = 0;
+			}
+		}
+	}
+
+}
+
+void executor_print (const Executor *executor) {
+
+	if (executor) {
+		(void) printf ("Executor: \n");
+		(void) printf ("\tWorkers: %u\n", executor->n_workers);
+		(void) printf ("\tPending: %lu\n", executor->pending);
+		(void) printf ("\tInline: %lu\n", executor->n_inline);
+
+		const ExecutorWorker *worker = NULL;
+		for (unsigned int i = 0; i < executor->n_workers; i++) {
+			worker = &executor->workers[i];
+			(void) printf (
+				"\t\tWorker %u - tasks: %lu -- stolen: %lu -- sleeps: %lu\n",
+				worker->idx, worker->n_tasks, worker->n_stolen, worker->n_sleeps
+			);
+		}
+	}
+
+}
@@ -1,9 +1,20 @@
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <pthread.h>
+
+#include <sys/mman.h>
 
 #include <vector>
 
+#include <jpeglib.h>
+
 #include <opencv2/core/mat.hpp>
 #include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include <client/types/types.h>
 
@@ -11,6 +22,8 @@
 
 #include <client/utils/log.h>
 
+#include "budget.hpp"
+#include "camera.hpp"
 #include "frames.hpp"
 
 static Pool *frames_pool = NULL;
@@ -19,6 +32,291 @@ void pixzo_frame_delete_internal (void *pixzo_frame_ptr);
 
 void *pixzo_frame_create (void);
 
+#pragma region arena
+
+// a freed block that can be handed out again
+struct _PixzoFramesArenaBlock {
+
+	void *start;
+	size_t length;
+	int kind;
+
+};
+
+typedef struct _PixzoFramesArenaBlock PixzoFramesArenaBlock;
+
+static PixzoFramesArenaBlock arena_cache[FRAMES_ARENA_CACHE_SIZE];
+static unsigned int arena_cache_count = 0;
+
+static PixzoFramesArenaStats arena_stats = { 0 };
+static pthread_mutex_t arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t pixzo_frames_arena_length (size_t size) {
+
+	return (size + FRAMES_HUGE_PAGE_SIZE - 1) & ~((size_t) FRAMES_HUGE_PAGE_SIZE - 1);
+
+}
+
+// maps a huge page aligned block that the kernel can back with
+// transparent huge pages when there are no reserved huge pages
+static void *pixzo_frames_arena_map_thp (size_t length) {
+
+	void *retval = NULL;
+
+	void *mapped = mmap (
+		NULL, length + FRAMES_HUGE_PAGE_SIZE,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+	);
+
+	if (mapped != MAP_FAILED) {
+		uintptr_t start = (uintptr_t) mapped;
+		uintptr_t aligned = (start + FRAMES_HUGE_PAGE_SIZE - 1)
+			& ~((uintptr_t) FRAMES_HUGE_PAGE_SIZE - 1);
+
+		size_t head = aligned - start;
+		size_t tail = FRAMES_HUGE_PAGE_SIZE - head;
+
+		if (head) (void) munmap (mapped, head);
+		if (tail) (void) munmap ((void *) (aligned + length), tail);
+
+		(void) madvise ((void *) aligned, length, MADV_HUGEPAGE);
+
+		retval = (void *) aligned;
+	}
+
+	return retval;
+
+}
+
+static void *pixzo_frames_arena_alloc (size_t size, int *kind) {
+
+	void *retval = NULL;
+
+	size_t length = pixzo_frames_arena_length (size);
+
+	(void) pthread_mutex_lock (&arena_mutex);
+
+	for (unsigned int i = 0; i < arena_cache_count; i++) {
+		if (arena_cache[i].length == length) {
+			retval = arena_cache[i].start;
+			*kind = arena_cache[i].kind;
+
+			arena_cache_count -= 1;
+			arena_cache[i] = arena_cache[arena_cache_count];
+
+			arena_stats.n_reused += 1;
+			break;
+		}
+	}
+
+	(void) pthread_mutex_unlock (&arena_mutex);
+
+	if (!retval) {
+		retval = mmap (
+			NULL, length,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0
+		);
+
+		if (retval != MAP_FAILED) {
+			*kind = FRAMES_ARENA_BLOCK_HUGETLB;
+		}
+
+		else {
+			retval = pixzo_frames_arena_map_thp (length);
+			*kind = FRAMES_ARENA_BLOCK_THP;
+		}
+
+		if (retval) {
+			(void) pthread_mutex_lock (&arena_mutex);
+
+			if (*kind == FRAMES_ARENA_BLOCK_HUGETLB) arena_stats.hugetlb_bytes += length;
+			else arena_stats.thp_bytes += length;
+
+			arena_stats.n_blocks += 1;
+
+			(void) pthread_mutex_unlock (&arena_mutex);
+		}
+	}
+
+	return retval;
+
+}
+
+static void pixzo_frames_arena_free (void *start, size_t size, int kind) {
+
+	size_t length = pixzo_frames_arena_length (size);
+
+	bool cached = false;
+
+	(void) pthread_mutex_lock (&arena_mutex);
+
+	if (arena_cache_count < FRAMES_ARENA_CACHE_SIZE) {
+		arena_cache[arena_cache_count].start = start;
+		arena_cache[arena_cache_count].length = length;
+		arena_cache[arena_cache_count].kind = kind;
+		arena_cache_count += 1;
+
+		cached = true;
+	}
+
+	else {
+		if (kind == FRAMES_ARENA_BLOCK_HUGETLB) arena_stats.hugetlb_bytes -= length;
+		else arena_stats.thp_bytes -= length;
+
+		arena_stats.n_blocks -= 1;
+	}
+
+	(void) pthread_mutex_unlock (&arena_mutex);
+
+	if (!cached) (void) munmap (start, length);
+
+}
+
+static void pixzo_frames_arena_release (void) {
+
+	(void) pthread_mutex_lock (&arena_mutex);
+
+	for (unsigned int i = 0; i < arena_cache_count; i++) {
+		(void) munmap (arena_cache[i].start, arena_cache[i].length);
+
+		if (arena_cache[i].kind == FRAMES_ARENA_BLOCK_HUGETLB) {
+			arena_stats.hugetlb_bytes -= arena_cache[i].length;
+		}
+
+		else {
+			arena_stats.thp_bytes -= arena_cache[i].length;
+		}
+
+		arena_stats.n_blocks -= 1;
+	}
+
+	arena_cache_count = 0;
+
+	(void) pthread_mutex_unlock (&arena_mutex);
+
+}
+
+#if CV_VERSION_MAJOR >= 4
+typedef cv::AccessFlag PixzoAccessFlag;
+#else
+typedef int PixzoAccessFlag;
+#endif
+
+// hands out the pixels of big frames from the arena
+// smaller allocations are left to OpenCV's default allocator
+class PixzoFramesAllocator : public cv::MatAllocator {
+
+	public:
+		cv::UMatData *allocate (
+			int dims, const int *sizes, int type,
+			void *data, size_t *step,
+			PixzoAccessFlag flags, cv::UMatUsageFlags usage_flags
+		) const {
+
+			size_t total = CV_ELEM_SIZE (type);
+			for (int i = dims - 1; i >= 0; i--) {
+				if (step) {
+					if (data && (step[i] != CV_AUTOSTEP)) total = step[i];
+					else step[i] = total;
+				}
+
+				total *= (size_t) sizes[i];
+			}
+
+			cv::UMatData *u = NULL;
+			int kind = 0;
+			uchar *start = NULL;
+
+			if (!data && (total >= FRAMES_HUGE_PAGE_SIZE)) {
+				start = (uchar *) pixzo_frames_arena_alloc (total, &kind);
+			}
+
+			if (start) {
+				u = new cv::UMatData (this);
+				u->data = u->origdata = start;
+				u->size = total;
+				u->allocatorFlags_ = kind;
+			}
+
+			else {
+				if (!data) {
+					(void) pthread_mutex_lock (&arena_mutex);
+					arena_stats.n_small += 1;
+					(void) pthread_mutex_unlock (&arena_mutex);
+				}
+
+				u = cv::Mat::getStdAllocator ()->allocate (
+					dims, sizes, type, data, step, flags, usage_flags
+				);
+			}
+
+			return u;
+
+		}
+
+		bool allocate (
+			cv::UMatData *u, PixzoAccessFlag access_flags, cv::UMatUsageFlags usage_flags
+		) const {
+
+			(void) u;
+			(void) access_flags;
+			(void) usage_flags;
+
+			return false;
+
+		}
+
+		void deallocate (cv::UMatData *u) const {
+
+			if (u) {
+				if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+					pixzo_frames_arena_free (u->origdata, u->size, u->allocatorFlags_);
+				}
+
+				delete u;
+			}
+
+		}
+
+};
+
+static PixzoFramesAllocator *frames_allocator = NULL;
+
+// returns the allocator to be used for the frames' pixels
+// or NULL to use OpenCV's default one
+cv::MatAllocator *pixzo_frames_allocator (void) {
+
+	return frames_allocator;
+
+}
+
+// gets the current arena values
+void pixzo_frames_arena_get_stats (PixzoFramesArenaStats *stats) {
+
+	(void) pthread_mutex_lock (&arena_mutex);
+	(void) memcpy (stats, &arena_stats, sizeof (PixzoFramesArenaStats));
+	(void) pthread_mutex_unlock (&arena_mutex);
+
+}
+
+void pixzo_frames_arena_print (void) {
+
+	if (frames_allocator) {
+		PixzoFramesArenaStats stats = { 0 };
+		pixzo_frames_arena_get_stats (&stats);
+
+		client_log_debug (
+			"Frames arena - huge pages: %lu MB -- transparent huge pages: %lu MB -- "
+			"blocks: %lu -- reused: %lu -- small: %lu",
+			stats.hugetlb_bytes >> 20, stats.thp_bytes >> 20,
+			stats.n_blocks, stats.n_reused, stats.n_small
+		);
+	}
+
+}
+
+#pragma endregion
+
 static unsigned int pixzo_frames_init_pool (void) {
 
 	unsigned int retval = 1;
@@ -44,10 +342,15 @@ static unsigned int pixzo_frames_init_pool (void) {
 
 }
 
-unsigned int pixzo_frames_init (void) {
+// the frames' pixels are allocated from huge pages when enabled
+unsigned int pixzo_frames_init (bool huge_pages) {
 
 	unsigned int errors = 0;
 
+	if (huge_pages) {
+		frames_allocator = new PixzoFramesAllocator ();
+	}
+
 	errors |= pixzo_frames_init_pool ();
 
 	return errors;
@@ -59,6 +362,25 @@ void pixzo_frames_end (void) {
 	pool_delete (frames_pool);
 	frames_pool = NULL;
 
+	// the allocator is never deleted as there
+	// might still be matrices that reference it
+	if (frames_allocator) {
+		pixzo_frames_arena_print ();
+		pixzo_frames_arena_release ();
+	}
+
+}
+
+const char *pixzo_frame_format_to_string (PixzoFrameFormat format) {
+
+	switch (format) {
+		#define XX(num, name, string) case PIXZO_FRAME_FORMAT_##name: return #string;
+		PIXZO_FRAME_FORMAT_MAP(XX)
+		#undef XX
+	}
+
+	return pixzo_frame_format_to_string (PIXZO_FRAME_FORMAT_NONE);
+
 }
 
 PixzoFrame *pixzo_frame_new (void) {
@@ -67,7 +389,27 @@ PixzoFrame *pixzo_frame_new (void) {
 	if (pixzo_frame) {
 		(void) memset (&pixzo_frame->info, 0, sizeof (PixzoFrameInfo));
 
+		pixzo_frame->format = PIXZO_FRAME_FORMAT_NONE;
+		pixzo_frame->raw = NULL;
+		(void) memset (&pixzo_frame->crop, 0, sizeof (CameraRoi));
+
+		pixzo_frame->decoded = false;
 		pixzo_frame->frame = NULL;
+		pixzo_frame->pixels = NULL;
+
+		pixzo_frame->cam = NULL;
+		pixzo_frame->buffer_idx = -1;
+		pixzo_frame->buffer_generation = 0;
+
+		pixzo_frame->pool = NULL;
+		pixzo_frame->next = NULL;
+
+		pixzo_frame->ref_count = 0;
+		pixzo_frame->decode_mutex = NULL;
+
+		pixzo_frame->budget = NULL;
+		pixzo_frame->budget_account = NULL;
+		pixzo_frame->budget_bytes = 0;
 	}
 
 	return pixzo_frame;
@@ -79,11 +421,33 @@ void pixzo_frame_delete_internal (void *pixzo_frame_ptr) {
 	if (pixzo_frame_ptr) {
 		PixzoFrame *pixzo_frame = (PixzoFrame *) pixzo_frame_ptr;
 
+		if (pixzo_frame->raw) {
+			pixzo_frame->raw->release ();
+			delete (pixzo_frame->raw);
+		}
+
+		if (pixzo_frame->cam) {
+			camera_buffer_release (
+				pixzo_frame->cam,
+				pixzo_frame->buffer_idx, pixzo_frame->buffer_generation
+			);
+		}
+
 		if (pixzo_frame->frame) {
 			pixzo_frame->frame->release ();
 			delete (pixzo_frame->frame);
 		}
 
+		if (pixzo_frame->pixels) {
+			pixzo_frame->pixels->release ();
+			delete (pixzo_frame->pixels);
+		}
+
+		if (pixzo_frame->decode_mutex) {
+			(void) pthread_mutex_destroy (pixzo_frame->decode_mutex);
+			free (pixzo_frame->decode_mutex);
+		}
+
 		free (pixzo_frame);
 	}
 
@@ -96,9 +460,47 @@ void pixzo_frame_delete (void *pixzo_frame_ptr) {
 
 		(void) memset (&pixzo_frame->info, 0, sizeof (PixzoFrameInfo));
 
+		if (pixzo_frame->budget) {
+			memory_budget_release (
+				pixzo_frame->budget,
+				pixzo_frame->budget_account, pixzo_frame->budget_bytes
+			);
+
+			pixzo_frame->budget = NULL;
+			pixzo_frame->budget_account = NULL;
+			pixzo_frame->budget_bytes = 0;
+		}
+
+		// the raw data header must be dropped before
+		// the driver is able to write to the buffer again
+		if (pixzo_frame->raw) pixzo_frame->raw->release ();
+
+		if (pixzo_frame->cam) {
+			camera_buffer_release (
+				pixzo_frame->cam,
+				pixzo_frame->buffer_idx, pixzo_frame->buffer_generation
+			);
+
+			pixzo_frame->cam = NULL;
+			pixzo_frame->buffer_idx = -1;
+		}
+
+		pixzo_frame->format = PIXZO_FRAME_FORMAT_NONE;
+		(void) memset (&pixzo_frame->crop, 0, sizeof (CameraRoi));
+		pixzo_frame->decoded = false;
+		pixzo_frame->ref_count = 0;
+
+		// only the header is dropped, the pixels buffer is kept
+		// so the next capture writes into the same memory
 		if (pixzo_frame->frame) pixzo_frame->frame->release ();
 
-		(void) pool_push (frames_pool, pixzo_frame_ptr);
+		if (pixzo_frame->pool) {
+			pixzo_frames_pool_return (pixzo_frame->pool, pixzo_frame);
+		}
+
+		else {
+			(void) pool_push (frames_pool, pixzo_frame_ptr);
+		}
 	}
 
 }
@@ -125,7 +527,12 @@ void *pixzo_frame_create (void) {
 
 	PixzoFrame *pixzo_frame = pixzo_frame_new ();
 	if (pixzo_frame) {
+		pixzo_frame->raw = new cv::Mat ();
 		pixzo_frame->frame = new cv::Mat ();
+		pixzo_frame->pixels = new cv::Mat ();
+
+		pixzo_frame->decode_mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+		(void) pthread_mutex_init (pixzo_frame->decode_mutex, NULL);
 	}
 
 	return pixzo_frame;
@@ -138,6 +545,830 @@ PixzoFrame *pixzo_frame_get (void) {
 
 }
 
+// sets how many consumers are going to release the frame
+// must be called before the frame is shared
+void pixzo_frame_set_refs (
+	PixzoFrame *pixzo_frame, unsigned int ref_count
+) {
+
+	__atomic_store_n (&pixzo_frame->ref_count, ref_count, __ATOMIC_RELAXED);
+
+}
+
+// adds a reference for a new consumer of an already shared frame
+void pixzo_frame_ref (PixzoFrame *pixzo_frame) {
+
+	(void) __atomic_add_fetch (&pixzo_frame->ref_count, 1, __ATOMIC_RELAXED);
+
+}
+
+// releases a consumer's reference
+// the frame is deleted when it was the last one
+void pixzo_frame_release (PixzoFrame *pixzo_frame) {
+
+	if (pixzo_frame) {
+		// the last consumer must see every other consumer's writes
+		if (!__atomic_sub_fetch (&pixzo_frame->ref_count, 1, __ATOMIC_ACQ_REL)) {
+			pixzo_frame_delete (pixzo_frame);
+		}
+	}
+
+}
+
+#pragma region pool
+
+static PixzoFrame *pixzo_frames_pool_create_frame (PixzoFramesPool *pool) {
+
+	PixzoFrame *pixzo_frame = (PixzoFrame *) pixzo_frame_create ();
+	if (pixzo_frame) {
+		pixzo_frame->pool = pool;
+
+		if (frames_allocator) {
+			pixzo_frame->pixels->allocator = frames_allocator;
+		}
+
+		if (pool->width && pool->height) {
+			pixzo_frame->pixels->create ((int) pool->height, (int) pool->width, CV_8UC3);
+
+			// fault the pages now instead of on the first capture
+			pixzo_frame->pixels->setTo (cv::Scalar::all (0));
+		}
+
+		(void) __atomic_add_fetch (&pool->size, 1, __ATOMIC_RELAXED);
+	}
+
+	return pixzo_frame;
+
+}
+
+// creates a new pool with n frames that already have
+// (touched) pixel buffers of the captured size
+// so that capturing does not need to allocate them
+PixzoFramesPool *pixzo_frames_pool_create (
+	unsigned int width, unsigned int height, unsigned int n_frames
+) {
+
+	PixzoFramesPool *pool = (PixzoFramesPool *) malloc (sizeof (PixzoFramesPool));
+	if (pool) {
+		pool->width = width;
+		pool->height = height;
+
+		pool->available = NULL;
+		pool->returned = NULL;
+
+		pool->size = 0;
+		pool->in_use = 0;
+		pool->high_water = 0;
+		pool->misses = 0;
+
+		PixzoFrame *pixzo_frame = NULL;
+		for (unsigned int i = 0; i < n_frames; i++) {
+			pixzo_frame = pixzo_frames_pool_create_frame (pool);
+			if (pixzo_frame) {
+				pixzo_frame->next = pool->available;
+				pool->available = pixzo_frame;
+			}
+		}
+	}
+
+	return pool;
+
+}
+
+static void pixzo_frames_pool_delete_list (PixzoFrame *pixzo_frame) {
+
+	PixzoFrame *next = NULL;
+	while (pixzo_frame) {
+		next = pixzo_frame->next;
+		pixzo_frame_delete_internal (pixzo_frame);
+		pixzo_frame = next;
+	}
+
+}
+
+// all the frames must have been returned before
+void pixzo_frames_pool_delete (void *pool_ptr) {
+
+	if (pool_ptr) {
+		PixzoFramesPool *pool = (PixzoFramesPool *) pool_ptr;
+
+		pixzo_frames_pool_delete_list (pool->available);
+		pixzo_frames_pool_delete_list (
+			__atomic_exchange_n (&pool->returned, (PixzoFrame *) NULL, __ATOMIC_ACQUIRE)
+		);
+
+		if (__atomic_load_n (&pool->in_use, __ATOMIC_RELAXED)) {
+			client_log_warning (
+				"Frames pool deleted with %u frames still in use!",
+				pool->in_use
+			);
+		}
+
+		free (pool);
+	}
+
+}
+
+static void pixzo_frames_pool_update_in_use (PixzoFramesPool *pool) {
+
+	unsigned int in_use = __atomic_add_fetch (&pool->in_use, 1, __ATOMIC_RELAXED);
+
+	unsigned int high_water = __atomic_load_n (&pool->high_water, __ATOMIC_RELAXED);
+	while (
+		(in_use > high_water)
+		&& !__atomic_compare_exchange_n (
+			&pool->high_water, &high_water, in_use,
+			true, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+		)
+	);
+
+}
+
+// gets an available frame, or creates a new one
+// must only be called by the pool's owner
+PixzoFrame *pixzo_frames_pool_get (PixzoFramesPool *pool) {
+
+	// takes every returned frame at once
+	// so there is no ABA problem with the returned stack
+	if (!pool->available) {
+		pool->available = __atomic_exchange_n (
+			&pool->returned, (PixzoFrame *) NULL, __ATOMIC_ACQUIRE
+		);
+	}
+
+	PixzoFrame *pixzo_frame = pool->available;
+	if (pixzo_frame) {
+		pool->available = pixzo_frame->next;
+		pixzo_frame->next = NULL;
+	}
+
+	else {
+		(void) __atomic_add_fetch (&pool->misses, 1, __ATOMIC_RELAXED);
+		pixzo_frame = pixzo_frames_pool_create_frame (pool);
+	}
+
+	if (pixzo_frame) pixzo_frames_pool_update_in_use (pool);
+
+	return pixzo_frame;
+
+}
+
+// gets a frame from the returned ones, or creates a new one
+// can be called from any thread, unlike pixzo_frames_pool_get ()
+PixzoFrame *pixzo_frames_pool_get_shared (PixzoFramesPool *pool) {
+
+	// the whole stack is taken so no other thread can pop
+	// from it at the same time, the rest is pushed back
+	PixzoFrame *pixzo_frame = __atomic_exchange_n (
+		&pool->returned, (PixzoFrame *) NULL, __ATOMIC_ACQUIRE
+	);
+
+	if (pixzo_frame) {
+		PixzoFrame *rest = pixzo_frame->next;
+		pixzo_frame->next = NULL;
+
+		if (rest) {
+			PixzoFrame *tail = rest;
+			while (tail->next) tail = tail->next;
+
+			PixzoFrame *head = __atomic_load_n (&pool->returned, __ATOMIC_RELAXED);
+			do {
+				tail->next = head;
+			} while (!__atomic_compare_exchange_n (
+				&pool->returned, &head, rest,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED
+			));
+		}
+	}
+
+	else {
+		(void) __atomic_add_fetch (&pool->misses, 1, __ATOMIC_RELAXED);
+		pixzo_frame = pixzo_frames_pool_create_frame (pool);
+	}
+
+	if (pixzo_frame) pixzo_frames_pool_update_in_use (pool);
+
+	return pixzo_frame;
+
+}
+
+// returns a frame to its pool
+// can be called from any thread
+void pixzo_frames_pool_return (
+	PixzoFramesPool *pool, PixzoFrame *pixzo_frame
+) {
+
+	PixzoFrame *head = __atomic_load_n (&pool->returned, __ATOMIC_RELAXED);
+	do {
+		pixzo_frame->next = head;
+	} while (!__atomic_compare_exchange_n (
+		&pool->returned, &head, pixzo_frame,
+		true, __ATOMIC_RELEASE, __ATOMIC_RELAXED
+	));
+
+	(void) __atomic_sub_fetch (&pool->in_use, 1, __ATOMIC_RELAXED);
+
+}
+
+void pixzo_frames_pool_print (const PixzoFramesPool *pool) {
+
+	if (pool) {
+		(void) printf ("\tFrames pool: \n");
+		(void) printf ("\t\tFrames size: %u x %u\n", pool->width, pool->height);
+		(void) printf ("\t\tSize: %u\n", __atomic_load_n (&pool->size, __ATOMIC_RELAXED));
+		(void) printf ("\t\tIn use: %u\n", __atomic_load_n (&pool->in_use, __ATOMIC_RELAXED));
+		(void) printf ("\t\tHigh water: %u\n", __atomic_load_n (&pool->high_water, __ATOMIC_RELAXED));
+		(void) printf ("\t\tMisses: %lu\n", __atomic_load_n (&pool->misses, __ATOMIC_RELAXED));
+	}
+
+}
+
+#pragma endregion
+
+// charges the memory that the frame has grown since its first charge
+// like the pixels allocated when it was decoded or its captured data
+// once it has been detached from the driver buffer
+// must be called with the frame's decode mutex held
+static void pixzo_frame_recharge (PixzoFrame *pixzo_frame) {
+
+	if (pixzo_frame->budget) {
+		u64 bytes = pixzo_frame_memory_size (pixzo_frame);
+		if (bytes > pixzo_frame->budget_bytes) {
+			memory_budget_charge (
+				pixzo_frame->budget, pixzo_frame->budget_account,
+				bytes - pixzo_frame->budget_bytes
+			);
+
+			pixzo_frame->budget_bytes = bytes;
+		}
+	}
+
+}
+
+// the frame's data is copied into a new frame from the same pool
+// the captured data is kept as it is (not decoded) unless it already was
+// the copy is charged to the same budget & account as the frame
+// must be called with the frame's decode mutex held
+static PixzoFrame *pixzo_frame_copy (PixzoFrame *pixzo_frame) {
+
+	PixzoFrame *copy = pixzo_frame->pool ?
+		pixzo_frames_pool_get_shared (pixzo_frame->pool) : pixzo_frame_get ();
+	if (copy) {
+		(void) memcpy (&copy->info, &pixzo_frame->info, sizeof (PixzoFrameInfo));
+
+		if (__atomic_load_n (&pixzo_frame->decoded, __ATOMIC_ACQUIRE)) {
+			pixzo_frame->frame->copyTo (*copy->pixels);
+			*copy->frame = *copy->pixels;
+
+			copy->format = PIXZO_FRAME_FORMAT_BGR;
+			copy->decoded = true;
+		}
+
+		else {
+			pixzo_frame->raw->copyTo (*copy->raw);
+			copy->format = pixzo_frame->format;
+			copy->crop = pixzo_frame->crop;
+		}
+
+		pixzo_frame_charge (copy, pixzo_frame->budget, pixzo_frame->budget_account);
+
+		pixzo_frame_set_refs (copy, 1);
+	}
+
+	return copy;
+
+}
+
+// gets a new reference to a frame that can be held for a long time
+// frames that wrap a driver buffer are detached from it
+// by copying their captured data (compressed data stays compressed)
+// or copied if other consumers are still using the buffer
+// must be released with pixzo_frame_release ()
+PixzoFrame *pixzo_frame_keep (PixzoFrame *pixzo_frame) {
+
+	PixzoFrame *kept = pixzo_frame;
+
+	// the check & the detach are done with the decode mutex held
+	// so no other consumer can be decoding or keeping the frame meanwhile
+	(void) pthread_mutex_lock (pixzo_frame->decode_mutex);
+
+	if (pixzo_frame->cam) {
+		// nobody else can be reading the raw data
+		if (__atomic_load_n (&pixzo_frame->ref_count, __ATOMIC_ACQUIRE) <= 1) {
+			if (pixzo_frame->decoded) pixzo_frame->raw->release ();
+			else *pixzo_frame->raw = pixzo_frame->raw->clone ();
+
+			camera_buffer_release (
+				pixzo_frame->cam,
+				pixzo_frame->buffer_idx, pixzo_frame->buffer_generation
+			);
+
+			pixzo_frame->cam = NULL;
+			pixzo_frame->buffer_idx = -1;
+
+			// its captured data is no longer in the driver's buffer
+			pixzo_frame_recharge (pixzo_frame);
+
+			pixzo_frame_ref (pixzo_frame);
+		}
+
+		else {
+			kept = pixzo_frame_copy (pixzo_frame);
+		}
+	}
+
+	else {
+		pixzo_frame_ref (pixzo_frame);
+	}
+
+	(void) pthread_mutex_unlock (pixzo_frame->decode_mutex);
+
+	return kept;
+
+}
+
+// creates a new frame with the compressed version of the frame's data
+// already compressed frames (MJPEG or PNG) keep their original data
+// any other one is encoded into format (PNG or MJPEG)
+// must be released with pixzo_frame_release ()
+PixzoFrame *pixzo_frame_compress (
+	PixzoFrame *pixzo_frame, PixzoFrameFormat format
+) {
+
+	PixzoFrame *compressed = pixzo_frame_get ();
+	if (compressed) {
+		(void) memcpy (&compressed->info, &pixzo_frame->info, sizeof (PixzoFrameInfo));
+
+		if (
+			((pixzo_frame->format == PIXZO_FRAME_FORMAT_MJPEG)
+			|| (pixzo_frame->format == PIXZO_FRAME_FORMAT_PNG))
+			&& !pixzo_frame->raw->empty ()
+		) {
+			// the driver buffer can't be referenced after it is returned
+			if (pixzo_frame->cam) pixzo_frame->raw->copyTo (*compressed->raw);
+			else *compressed->raw = *pixzo_frame->raw;
+
+			compressed->format = pixzo_frame->format;
+			compressed->crop = pixzo_frame->crop;
+		}
+
+		else {
+			std::vector <int> params;
+			std::vector <uchar> buffer;
+			if (format == PIXZO_FRAME_FORMAT_PNG) {
+				params.push_back (cv::IMWRITE_PNG_COMPRESSION);
+				params.push_back (FRAMES_COMPRESS_PNG_LEVEL);
+				(void) cv::imencode (".png", *pixzo_frame_decode (pixzo_frame), buffer, params);
+			}
+
+			else {
+				params.push_back (cv::IMWRITE_JPEG_QUALITY);
+				params.push_back (FRAMES_COMPRESS_JPEG_QUALITY);
+				(void) cv::imencode (".jpg", *pixzo_frame_decode (pixzo_frame), buffer, params);
+			}
+
+			// the decoded frame is already cropped
+			cv::Mat (buffer, true).copyTo (*compressed->raw);
+			compressed->format = (format == PIXZO_FRAME_FORMAT_PNG) ?
+				PIXZO_FRAME_FORMAT_PNG : PIXZO_FRAME_FORMAT_MJPEG;
+		}
+
+		pixzo_frame_set_refs (compressed, 1);
+	}
+
+	return compressed;
+
+}
+
+// creates a new frame that references the same captured data
+// to be decoded on its own (the original one stays compressed)
+// must be released with pixzo_frame_release ()
+PixzoFrame *pixzo_frame_share (const PixzoFrame *pixzo_frame) {
+
+	PixzoFrame *shared = pixzo_frame_get ();
+	if (shared) {
+		(void) memcpy (&shared->info, &pixzo_frame->info, sizeof (PixzoFrameInfo));
+
+		*shared->raw = *pixzo_frame->raw;
+		shared->format = pixzo_frame->format;
+		shared->crop = pixzo_frame->crop;
+
+		pixzo_frame_set_refs (shared, 1);
+	}
+
+	return shared;
+
+}
+
+// returns the size in bytes of the frame's captured data
+size_t pixzo_frame_data_size (const PixzoFrame *pixzo_frame) {
+
+	return pixzo_frame->raw->total () * pixzo_frame->raw->elemSize ();
+
+}
+
+// returns the bytes of memory that the frame is using
+// driver buffers are not counted as they are always mapped
+u64 pixzo_frame_memory_size (const PixzoFrame *pixzo_frame) {
+
+	u64 bytes = pixzo_frame->pixels->total () * pixzo_frame->pixels->elemSize ();
+	if (!pixzo_frame->cam) bytes += pixzo_frame_data_size (pixzo_frame);
+
+	return bytes;
+
+}
+
+// charges the frame's memory to the budget & the owner's account
+// until it is deleted, only the first charge is counted
+void pixzo_frame_charge (
+	PixzoFrame *pixzo_frame, MemoryBudget *budget, u64 *account
+) {
+
+	if (budget && !pixzo_frame->budget) {
+		pixzo_frame->budget = budget;
+		pixzo_frame->budget_account = account;
+		pixzo_frame->budget_bytes = pixzo_frame_memory_size (pixzo_frame);
+
+		memory_budget_charge (budget, account, pixzo_frame->budget_bytes);
+	}
+
+}
+
+// returns the current CLOCK_MONOTONIC time in nanoseconds
+u64 pixzo_frame_time_ns (void) {
+
+	struct timespec now = { 0, 0 };
+	(void) clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return ((u64) now.tv_sec * 1000000000) + (u64) now.tv_nsec;
+
+}
+
+// returns the nanoseconds that have passed since the frame was captured
+u64 pixzo_frame_latency_ns (const PixzoFrame *pixzo_frame) {
+
+	u64 now = pixzo_frame_time_ns ();
+
+	return (now > pixzo_frame->info.capture_ns) ?
+		now - pixzo_frame->info.capture_ns : 0;
+
+}
+
+static bool pixzo_frame_is_decoded (const PixzoFrame *pixzo_frame) {
+
+	return __atomic_load_n (&pixzo_frame->decoded, __ATOMIC_ACQUIRE);
+
+}
+
+// returns true if the frame has no captured data
+bool pixzo_frame_empty (const PixzoFrame *pixzo_frame) {
+
+	return pixzo_frame_is_decoded (pixzo_frame) ?
+		pixzo_frame->frame->empty () : pixzo_frame->raw->empty ();
+
+}
+
+static void pixzo_frame_rotate (
+	const cv::Mat &src, cv::Mat &dst, CameraRotation rotation
+) {
+
+	switch (rotation) {
+		case CAMERA_ROTATION_90_CLOCKWISE:
+			cv::rotate (src, dst, cv::ROTATE_90_CLOCKWISE);
+			break;
+
+		case CAMERA_ROTATION_90_COUNTERCLOCKWISE:
+			cv::rotate (src, dst, cv::ROTATE_90_COUNTERCLOCKWISE);
+			break;
+
+		case CAMERA_ROTATION_180:
+			cv::rotate (src, dst, cv::ROTATE_180);
+			break;
+
+		default:
+			if (&src != &dst) src.copyTo (dst);
+			break;
+	}
+
+}
+
+// the size of the frame before being rotated
+static cv::Size pixzo_frame_capture_size (
+	const cv::Size &size, CameraRotation rotation
+) {
+
+	cv::Size capture_size = size;
+
+	switch (rotation) {
+		case CAMERA_ROTATION_90_CLOCKWISE:
+		case CAMERA_ROTATION_90_COUNTERCLOCKWISE:
+			capture_size = cv::Size (size.height, size.width);
+			break;
+
+		default: break;
+	}
+
+	return capture_size;
+
+}
+
+// converts captured data in the given format into BGR pixels
+void pixzo_frame_decode_data (
+	PixzoFrameFormat format, const cv::Mat &raw, cv::Mat &frame
+) {
+
+	switch (format) {
+		case PIXZO_FRAME_FORMAT_BGR:
+			raw.copyTo (frame);
+			break;
+
+		case PIXZO_FRAME_FORMAT_YUYV:
+			cv::cvtColor (raw, frame, cv::COLOR_YUV2BGR_YUYV);
+			break;
+
+		// decodes into frame's existing buffer if it has the correct size
+		case PIXZO_FRAME_FORMAT_MJPEG:
+		case PIXZO_FRAME_FORMAT_PNG:
+			(void) cv::imdecode (raw, cv::IMREAD_COLOR, &frame);
+			break;
+
+		default: break;
+	}
+
+}
+
+// decodes into the frame's existing buffer
+static void pixzo_frame_decode_internal (PixzoFrame *pixzo_frame) {
+
+	pixzo_frame_decode_data (
+		pixzo_frame->format, *pixzo_frame->raw, *pixzo_frame->pixels
+	);
+
+	// only keeps a reference to the region of the decoded pixels
+	if (pixzo_frame->crop.width && !pixzo_frame->pixels->empty ()) {
+		*pixzo_frame->frame = (*pixzo_frame->pixels) (
+			cv::Rect (
+				(int) pixzo_frame->crop.x, (int) pixzo_frame->crop.y,
+				(int) pixzo_frame->crop.width, (int) pixzo_frame->crop.height
+			)
+		);
+	}
+
+	else {
+		*pixzo_frame->frame = *pixzo_frame->pixels;
+	}
+
+}
+
+// gets the frame's BGR pixels
+// converting (or decoding) the captured data
+// only the first time it is requested
+// the pixels are NOT rotated, info.rotation still needs to be applied
+cv::Mat *pixzo_frame_decode (PixzoFrame *pixzo_frame) {
+
+	if (!pixzo_frame_is_decoded (pixzo_frame)) {
+		(void) pthread_mutex_lock (pixzo_frame->decode_mutex);
+
+		// another consumer might have decoded it while we waited
+		if (!pixzo_frame->decoded) {
+			pixzo_frame_decode_internal (pixzo_frame);
+			pixzo_frame_recharge (pixzo_frame);
+			__atomic_store_n (&pixzo_frame->decoded, true, __ATOMIC_RELEASE);
+		}
+
+		(void) pthread_mutex_unlock (pixzo_frame->decode_mutex);
+	}
+
+	return pixzo_frame->frame;
+
+}
+
+// gets the frame's full resolution BGR pixels with its rotation applied
+// only use when the rotated full resolution pixels are really needed
+// and the frame has not been shared with other consumers
+cv::Mat *pixzo_frame_decode_rotated (PixzoFrame *pixzo_frame) {
+
+	cv::Mat *frame = pixzo_frame_decode (pixzo_frame);
+
+	if (pixzo_frame->info.rotation != CAMERA_ROTATION_NONE) {
+		pixzo_frame_rotate (*frame, *frame, pixzo_frame->info.rotation);
+		pixzo_frame->info.rotation = CAMERA_ROTATION_NONE;
+	}
+
+	return frame;
+
+}
+
+// resizes the frame's pixels to size, which is already rotated
+// the rotation is applied to the resized frame instead of the full one
+// scaled is used as a working buffer and can be reused between calls
+void pixzo_frame_resize (
+	PixzoFrame *pixzo_frame, const cv::Size &size,
+	cv::Mat &scaled, cv::Mat &dst
+) {
+
+	const cv::Mat *frame = pixzo_frame_decode (pixzo_frame);
+
+	// the captured data could not be decoded
+	if (frame->empty ()) {
+		dst.release ();
+	}
+
+	else if (pixzo_frame->info.rotation == CAMERA_ROTATION_NONE) {
+		cv::resize (*frame, dst, size);
+	}
+
+	else {
+		cv::resize (
+			*frame, scaled,
+			pixzo_frame_capture_size (size, pixzo_frame->info.rotation)
+		);
+
+		pixzo_frame_rotate (scaled, dst, pixzo_frame->info.rotation);
+	}
+
+}
+
+struct _PixzoJpegError {
+
+	struct jpeg_error_mgr manager;
+	jmp_buf jump;
+
+};
+
+typedef struct _PixzoJpegError PixzoJpegError;
+
+static void pixzo_frame_jpeg_error_exit (j_common_ptr cinfo) {
+
+	longjmp (((PixzoJpegError *) cinfo->err)->jump, 1);
+
+}
+
+// decodes the jpeg bitstream as gray scale using libjpeg DCT scaling
+// picks the smallest scale (up to 1/8) where the crop is still bigger than size
+// gray only references the scaled crop of the decoded image
+// returns 0 on success, 1 on error
+static u8 pixzo_frame_decode_jpeg_gray (
+	const cv::Mat &raw, const CameraRoi *crop,
+	const cv::Size &size, cv::Mat &gray
+) {
+
+	// modified between setjmp () & a possible longjmp ()
+	volatile u8 retval = 1;
+
+	struct jpeg_decompress_struct cinfo;
+	PixzoJpegError error;
+
+	cinfo.err = jpeg_std_error (&error.manager);
+	error.manager.error_exit = pixzo_frame_jpeg_error_exit;
+
+	if (!setjmp (error.jump)) {
+		jpeg_create_decompress (&cinfo);
+		jpeg_mem_src (&cinfo, raw.data, (unsigned long) raw.total ());
+
+		if (jpeg_read_header (&cinfo, TRUE) == JPEG_HEADER_OK) {
+			unsigned int width = crop->width ? crop->width : cinfo.image_width;
+			unsigned int height = crop->width ? crop->height : cinfo.image_height;
+
+			unsigned int scale_denom = 8;
+			while (
+				(scale_denom > 1)
+				&& (
+					(width / scale_denom < (unsigned int) size.width)
+					|| (height / scale_denom < (unsigned int) size.height)
+				)
+			) {
+				scale_denom >>= 1;
+			}
+
+			cinfo.scale_num = 1;
+			cinfo.scale_denom = scale_denom;
+			cinfo.out_color_space = JCS_GRAYSCALE;
+			cinfo.dct_method = JDCT_IFAST;
+			cinfo.do_fancy_upsampling = FALSE;
+
+			(void) jpeg_start_decompress (&cinfo);
+
+			gray.create ((int) cinfo.output_height, (int) cinfo.output_width, CV_8UC1);
+
+			JSAMPROW row = NULL;
+			while (cinfo.output_scanline < cinfo.output_height) {
+				row = gray.ptr ((int) cinfo.output_scanline);
+				(void) jpeg_read_scanlines (&cinfo, &row, 1);
+			}
+
+			(void) jpeg_finish_decompress (&cinfo);
+
+			if (crop->width) {
+				gray = gray (
+					cv::Rect (
+						(int) ((crop->x * cinfo.output_width) / cinfo.image_width),
+						(int) ((crop->y * cinfo.output_height) / cinfo.image_height),
+						(int) ((crop->width * cinfo.output_width) / cinfo.image_width),
+						(int) ((crop->height * cinfo.output_height) / cinfo.image_height)
+					) & cv::Rect (0, 0, gray.cols, gray.rows)
+				);
+			}
+
+			retval = 0;
+		}
+	}
+
+	else {
+		client_log_error ("Failed to decode jpeg frame!");
+	}
+
+	jpeg_destroy_decompress (&cinfo);
+
+	// so nobody compares against a previous frame's pixels
+	if (retval) gray.release ();
+
+	return retval;
+
+}
+
+// BGR pixels are reduced before they are converted
+// so only the reduced image is converted into gray
+static void pixzo_frame_gray_scaled_bgr (
+	const cv::Mat &frame, const cv::Size &size,
+	cv::Mat &scaled, cv::Mat &gray
+) {
+
+	cv::resize (frame, scaled, size, 0, 0, cv::INTER_AREA);
+	cv::cvtColor (scaled, gray, cv::COLOR_BGR2GRAY);
+
+}
+
+// creates a reduced gray scale version of the frame with the requested size
+// MJPEG frames are decoded straight at 1/2, 1/4 or 1/8 scale with DCT scaling
+// so the full resolution frame is never decoded for this
+// BGR & YUYV frames are reduced with opencv's area interpolation
+// scaled & reduced are used as working buffers and can be reused between calls
+// returns 0 on success, 1 on error (gray is left empty)
+u8 pixzo_frame_gray_scaled (
+	PixzoFrame *pixzo_frame, const cv::Size &size,
+	cv::Mat &scaled, cv::Mat &reduced, cv::Mat &gray
+) {
+
+	u8 retval = 0;
+
+	// the captured data has not been rotated yet
+	// so we rotate the reduced gray image instead
+	const CameraRotation rotation = pixzo_frame->info.rotation;
+	const cv::Size capture_size = pixzo_frame_capture_size (size, rotation);
+
+	// reduced into its own buffer when it still has to be rotated
+	// so that the rotation never allocates a new image
+	cv::Mat &unrotated = (rotation == CAMERA_ROTATION_NONE) ? gray : reduced;
+
+	if (pixzo_frame_is_decoded (pixzo_frame)) {
+		pixzo_frame_gray_scaled_bgr (*pixzo_frame->frame, capture_size, scaled, unrotated);
+	}
+
+	else {
+		switch (pixzo_frame->format) {
+			case PIXZO_FRAME_FORMAT_MJPEG: {
+				retval = pixzo_frame_decode_jpeg_gray (
+					*pixzo_frame->raw, &pixzo_frame->crop, capture_size, scaled
+				);
+
+				if (!retval) {
+					if (scaled.size () != capture_size) {
+						cv::resize (scaled, unrotated, capture_size, 0, 0, cv::INTER_AREA);
+					}
+
+					// both buffers keep the same size between calls
+					else {
+						cv::swap (scaled, unrotated);
+					}
+				}
+			} break;
+
+			// the luminance is already in the captured data
+			case PIXZO_FRAME_FORMAT_YUYV: {
+				cv::cvtColor (*pixzo_frame->raw, scaled, cv::COLOR_YUV2GRAY_YUYV);
+				cv::resize (scaled, unrotated, capture_size, 0, 0, cv::INTER_AREA);
+			} break;
+
+			default: {
+				pixzo_frame_gray_scaled_bgr (
+					*pixzo_frame_decode (pixzo_frame), capture_size, scaled, unrotated
+				);
+			} break;
+		}
+	}
+
+	// so nobody compares against a previous frame's pixels
+	if (retval) gray.release ();
+
+	else if (rotation != CAMERA_ROTATION_NONE) {
+		pixzo_frame_rotate (unrotated, gray, rotation);
+	}
+
+	return retval;
+
+}
+
 // encodes a cv::Mat input image into a jpeg image that we can send to the pose cerver
 std::vector <uchar> *pixzo_frame_encode_input (cv::Mat &input_image) {
 
@@ -0,0 +1,649 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <time.h>
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#include <client/utils/log.h>
+
+#include "budget.hpp"
+#include "frames.hpp"
+#include "memory.hpp"
+#include "spill.hpp"
+
+const char *memory_compression_to_string (
+	MemoryCompression compression
+) {
+
+	switch (compression) {
+		#define XX(num, name, string) case MEMORY_COMPRESSION_##name: return #string;
+		MEMORY_COMPRESSION_MAP(XX)
+		#undef XX
+	}
+
+	return memory_compression_to_string (MEMORY_COMPRESSION_NONE);
+
+}
+
+// returns NONE for NULL or unknown values
+MemoryCompression memory_compression_from_string (
+	const char *string
+) {
+
+	MemoryCompression compression = MEMORY_COMPRESSION_NONE;
+
+	if (string) {
+		#define XX(num, name, str) if (!strcasecmp (#str, string)) compression = MEMORY_COMPRESSION_##name;
+		MEMORY_COMPRESSION_MAP(XX)
+		#undef XX
+	}
+
+	return compression;
+
+}
+
+static void memory_action_init (MemoryAction *action) {
+
+	action->action_id = 0;
+	action->active = false;
+
+	action->start = 0;
+	action->end = 0;
+
+	action->first_frame_id = 0;
+	action->frames = NULL;
+	action->n_slots = 0;
+	action->capacity = 0;
+
+	action->n_frames = 0;
+	action->n_spilled = 0;
+	action->n_dropped = 0;
+	action->n_bytes = 0;
+
+}
+
+// releases the action's frames but keeps its slots
+static void memory_action_clear (MemoryAction *action) {
+
+	for (unsigned int i = 0; i < action->n_slots; i++) {
+		pixzo_frame_release (action->frames[i].frame);
+		(void) memset (&action->frames[i], 0, sizeof (MemoryFrame));
+	}
+
+	action->action_id = 0;
+	action->active = false;
+
+	action->start = 0;
+	action->end = 0;
+
+	action->first_frame_id = 0;
+	action->n_slots = 0;
+
+	action->n_frames = 0;
+	action->n_spilled = 0;
+	action->n_dropped = 0;
+	action->n_bytes = 0;
+
+}
+
+// makes room for the frame's slot
+// starting with a batch & doubling the slots up to max_slots
+// so that long actions are not copied again every few frames
+// returns 0 on success, 1 on error
+static unsigned int memory_action_reserve (
+	MemoryAction *action, unsigned int n_slots,
+	unsigned int batch_size, unsigned int max_slots
+) {
+
+	unsigned int retval = 1;
+
+	if (n_slots <= action->capacity) {
+		retval = 0;
+	}
+
+	else {
+		unsigned int capacity = action->capacity ? action->capacity : batch_size;
+		while (capacity < n_slots) capacity *= 2;
+		if (capacity > max_slots) capacity = max_slots;
+
+		MemoryFrame *frames = (MemoryFrame *) realloc (
+			action->frames, capacity * sizeof (MemoryFrame)
+		);
+
+		if (frames) {
+			(void) memset (
+				frames + action->capacity, 0,
+				(capacity - action->capacity) * sizeof (MemoryFrame)
+			);
+
+			action->frames = frames;
+			action->capacity = capacity;
+
+			retval = 0;
+		}
+	}
+
+	return retval;
+
+}
+
+ActionsMemory *actions_memory_create (
+	unsigned int max_actions,
+	unsigned int max_action_frames, unsigned int batch_size,
+	MemoryCompression compression
+) {
+
+	ActionsMemory *memory = NULL;
+
+	if (max_actions && max_action_frames && batch_size) {
+		memory = (ActionsMemory *) malloc (sizeof (ActionsMemory));
+		if (memory) {
+			memory->next_action_id = 1;
+
+			memory->max_actions = max_actions;
+			memory->actions = (MemoryAction *) calloc (max_actions, sizeof (MemoryAction));
+
+			memory->max_action_frames = max_action_frames;
+			memory->batch_size = batch_size;
+
+			memory->compression = compression;
+
+			memory->budget = NULL;
+			memory->budget_account = NULL;
+
+			memory->spill = NULL;
+
+			memory->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+
+			if (memory->actions && memory->mutex) {
+				for (unsigned int i = 0; i < max_actions; i++) {
+					memory_action_init (&memory->actions[i]);
+				}
+
+				(void) pthread_mutex_init (memory->mutex, NULL);
+			}
+
+			else {
+				client_log_error ("Failed to allocate actions memory!");
+
+				free (memory->actions);
+				free (memory->mutex);
+				free (memory);
+				memory = NULL;
+			}
+		}
+	}
+
+	return memory;
+
+}
+
+void actions_memory_delete (void *memory_ptr) {
+
+	if (memory_ptr) {
+		ActionsMemory *memory = (ActionsMemory *) memory_ptr;
+
+		for (unsigned int i = 0; i < memory->max_actions; i++) {
+			memory_action_clear (&memory->actions[i]);
+			free (memory->actions[i].frames);
+		}
+
+		free (memory->actions);
+
+		(void) pthread_mutex_destroy (memory->mutex);
+		free (memory->mutex);
+
+		free (memory);
+	}
+
+}
+
+// the held frames are charged to the budget & the owner's account
+// older ended actions are evicted first for the frames that don't fit
+// and the ones that still don't fit are not kept
+void actions_memory_set_budget (
+	ActionsMemory *memory,
+	MemoryBudget *budget, u64 *budget_account
+) {
+
+	if (memory) {
+		memory->budget = budget;
+		memory->budget_account = budget_account;
+	}
+
+}
+
+// frames that don't fit in memory (too many for an action or over budget)
+// are written to the log instead of being dropped
+// the log is owned by the caller & must outlive the memory's use
+void actions_memory_set_spill (
+	ActionsMemory *memory, SpillLog *spill
+) {
+
+	if (memory) memory->spill = spill;
+
+}
+
+// releases the oldest ended action to make room in the budget
+// returns 0 on success, 1 if there was none
+static unsigned int actions_memory_evict_oldest (ActionsMemory *memory) {
+
+	unsigned int retval = 1;
+
+	MemoryAction *oldest = NULL;
+	MemoryAction *action = NULL;
+	for (unsigned int i = 0; i < memory->max_actions; i++) {
+		action = &memory->actions[i];
+		if (action->action_id && !action->active && action->n_frames) {
+			if (!oldest || (action->action_id < oldest->action_id)) oldest = action;
+		}
+	}
+
+	if (oldest) {
+		memory_action_clear (oldest);
+		retval = 0;
+	}
+
+	return retval;
+
+}
+
+// evicts the oldest ended actions until the bytes fit in the budget
+// must be called with the memory's mutex held
+// returns true if they fit
+static bool actions_memory_evict_internal (
+	ActionsMemory *memory, u64 bytes
+) {
+
+	bool fits = !memory_budget_exceeded (memory->budget, bytes);
+	while (!fits && !actions_memory_evict_oldest (memory)) {
+		fits = !memory_budget_exceeded (memory->budget, bytes);
+	}
+
+	return fits;
+
+}
+
+// evicts the oldest ended actions until the bytes fit in the budget
+// returns 0 on success, 1 if they still don't fit
+unsigned int actions_memory_evict (
+	ActionsMemory *memory, u64 bytes
+) {
+
+	unsigned int retval = 0;
+
+	if (memory && memory->budget) {
+		(void) pthread_mutex_lock (memory->mutex);
+
+		retval = actions_memory_evict_internal (memory, bytes) ? 0 : 1;
+
+		(void) pthread_mutex_unlock (memory->mutex);
+	}
+
+	return retval;
+
+}
+
+// checks if the frame fits in the memory's budget
+// the ended actions are evicted first under every policy
+static bool actions_memory_fits (
+	ActionsMemory *memory, const PixzoFrame *pixzo_frame
+) {
+
+	bool fits = true;
+
+	// frames that are already charged don't use more memory
+	if (memory->budget && !pixzo_frame->budget) {
+		fits = actions_memory_evict_internal (
+			memory, pixzo_frame_memory_size (pixzo_frame)
+		);
+	}
+
+	return fits;
+
+}
+
+// starts a new action, replacing the oldest one in the ring
+// returns the new action's id
+u32 actions_memory_action_start (ActionsMemory *memory) {
+
+	(void) pthread_mutex_lock (memory->mutex);
+
+	u32 action_id = memory->next_action_id;
+	memory->next_action_id += 1;
+	if (!memory->next_action_id) memory->next_action_id = 1;
+
+	MemoryAction *action = &memory->actions[action_id % memory->max_actions];
+	memory_action_clear (action);
+
+	action->action_id = action_id;
+	action->active = true;
+	action->start = time (NULL);
+
+	(void) pthread_mutex_unlock (memory->mutex);
+
+	return action_id;
+
+}
+
+// marks the action as ended, its frames are kept
+void actions_memory_action_end (
+	ActionsMemory *memory, u32 action_id
+) {
+
+	(void) pthread_mutex_lock (memory->mutex);
+
+	MemoryAction *action = &memory->actions[action_id % memory->max_actions];
+	if (action->action_id == action_id) {
+		action->active = false;
+		action->end = time (NULL);
+	}
+
+	(void) pthread_mutex_unlock (memory->mutex);
+
+}
+
+// gets the frame that is going to be held
+// done outside the lock as it might need to decode the frame
+static PixzoFrame *actions_memory_push_frame (
+	ActionsMemory *memory, PixzoFrame *pixzo_frame
+) {
+
+	PixzoFrame *kept = NULL;
+
+	switch (memory->compression) {
+		case MEMORY_COMPRESSION_PNG:
+			kept = pixzo_frame_compress (pixzo_frame, PIXZO_FRAME_FORMAT_PNG);
+			break;
+
+		case MEMORY_COMPRESSION_JPEG:
+			kept = pixzo_frame_compress (pixzo_frame, PIXZO_FRAME_FORMAT_MJPEG);
+			break;
+
+		default:
+			kept = pixzo_frame_keep (pixzo_frame);
+			break;
+	}
+
+	return kept;
+
+}
+
+// writes the frame to the spill log & saves its location
+// already compressed data is written straight from the frame
+// returns 0 on success, 1 on error
+static unsigned int actions_memory_spill (
+	ActionsMemory *memory, PixzoFrame *pixzo_frame, u32 action_id
+) {
+
+	unsigned int retval = 1;
+
+	u64 frame_id = pixzo_frame->info.frame_id;
+
+	// the log only holds compressed data
+	PixzoFrame *compressed = NULL;
+	if (
+		((pixzo_frame->format != PIXZO_FRAME_FORMAT_MJPEG)
+		&& (pixzo_frame->format != PIXZO_FRAME_FORMAT_PNG))
+		|| pixzo_frame->raw->empty ()
+	) {
+		compressed = pixzo_frame_compress (
+			pixzo_frame,
+			(memory->compression == MEMORY_COMPRESSION_PNG) ?
+				PIXZO_FRAME_FORMAT_PNG : PIXZO_FRAME_FORMAT_MJPEG
+		);
+	}
+
+	const PixzoFrame *spilled = compressed ? compressed : pixzo_frame;
+
+	SpillLocation location = { 0 };
+	if (
+		(spilled->format != PIXZO_FRAME_FORMAT_NONE)
+		&& !spill_log_append (memory->spill, spilled, action_id, &location)
+	) {
+		(void) pthread_mutex_lock (memory->mutex);
+
+		// the action might have been replaced while we were writing
+		MemoryAction *action = &memory->actions[action_id % memory->max_actions];
+		if (
+			(action->action_id == action_id)
+			&& (frame_id >= action->first_frame_id)
+			&& ((frame_id - action->first_frame_id) < action->n_slots)
+		) {
+			MemoryFrame *entry = &action->frames[frame_id - action->first_frame_id];
+			if (!entry->frame && !entry->spilled.generation) {
+				entry->spilled = location;
+				action->n_spilled += 1;
+
+				retval = 0;
+			}
+		}
+
+		(void) pthread_mutex_unlock (memory->mutex);
+	}
+
+	pixzo_frame_release (compressed);
+
+	return retval;
+
+}
+
+// holds the kept frame in its reserved slot if it fits in the budget
+// returns 0 on success, 1 if it has to be spilled or dropped
+static unsigned int actions_memory_hold (
+	ActionsMemory *memory, PixzoFrame *kept, u32 action_id, bool *spill
+) {
+
+	unsigned int retval = 1;
+
+	u64 frame_id = kept->info.frame_id;
+
+	(void) pthread_mutex_lock (memory->mutex);
+
+	// the action might have been replaced while the frame was kept
+	MemoryAction *action = &memory->actions[action_id % memory->max_actions];
+	if (
+		(action->action_id == action_id) && action->active
+		&& (frame_id >= action->first_frame_id)
+		&& ((frame_id - action->first_frame_id) < action->n_slots)
+	) {
+		MemoryFrame *entry = &action->frames[frame_id - action->first_frame_id];
+		if (!entry->frame && !entry->spilled.generation) {
+			if (actions_memory_fits (memory, kept)) {
+				pixzo_frame_charge (kept, memory->budget, memory->budget_account);
+
+				entry->frame = kept;
+
+				action->n_frames += 1;
+				action->n_bytes += pixzo_frame_data_size (kept);
+
+				retval = 0;
+			}
+
+			else if (memory->spill) {
+				*spill = true;
+			}
+
+			else {
+				action->n_dropped += 1;
+			}
+		}
+	}
+
+	(void) pthread_mutex_unlock (memory->mutex);
+
+	return retval;
+
+}
+
+// keeps a reference to the frame in the action
+// the frame is shared so it is never changed
+// frames that don't fit in memory are spilled to the log
+// returns 0 on success, 1 if the frame was not kept
+unsigned int actions_memory_push (
+	ActionsMemory *memory, PixzoFrame *pixzo_frame, u32 action_id
+) {
+
+	unsigned int retval = 1;
+
+	u64 frame_id = pixzo_frame->info.frame_id;
+
+	if (action_id) {
+		bool hold = false;
+		bool spill = false;
+
+		(void) pthread_mutex_lock (memory->mutex);
+
+		unsigned int max_index = memory->spill ?
+			MEMORY_ACTION_MAX_INDEX : memory->max_action_frames;
+
+		MemoryAction *action = &memory->actions[action_id % memory->max_actions];
+		if ((action->action_id == action_id) && action->active) {
+			if (!action->n_slots) action->first_frame_id = frame_id;
+
+			if (frame_id >= action->first_frame_id) {
+				u64 idx = frame_id - action->first_frame_id;
+				if (
+					(idx < max_index)
+					&& !memory_action_reserve (
+						action, (unsigned int) idx + 1, memory->batch_size, max_index
+					)
+				) {
+					if (idx >= action->n_slots) action->n_slots = (unsigned int) idx + 1;
+
+					MemoryFrame *entry = &action->frames[idx];
+					if (!entry->frame && !entry->spilled.generation) {
+						// the frame is only kept if it can be held
+						if (action->n_frames < memory->max_action_frames) {
+							hold = true;
+						}
+
+						else if (memory->spill) {
+							spill = true;
+						}
+
+						else {
+							action->n_dropped += 1;
+						}
+					}
+				}
+
+				else {
+					action->n_dropped += 1;
+				}
+			}
+		}
+
+		(void) pthread_mutex_unlock (memory->mutex);
+
+		if (hold) {
+			PixzoFrame *kept = actions_memory_push_frame (memory, pixzo_frame);
+			if (kept) {
+				retval = actions_memory_hold (memory, kept, action_id, &spill);
+				if (retval) {
+					// the kept frame is already compressed unless
+					// the memory holds the frames as they were captured
+					if (spill) {
+						retval = actions_memory_spill (memory, kept, action_id);
+						spill = false;
+					}
+
+					// the frame did not make it into the memory
+					pixzo_frame_release (kept);
+				}
+			}
+		}
+
+		// written outside the memory's lock
+		if (spill) {
+			retval = actions_memory_spill (memory, pixzo_frame, action_id);
+		}
+	}
+
+	return retval;
+
+}
+
+// gets a frame from its action in O(1)
+// compressed & spilled frames are returned as a new frame that decodes on demand
+// returns a new reference that must be released
+// with pixzo_frame_release (), NULL if not found
+PixzoFrame *actions_memory_get_frame (
+	ActionsMemory *memory, u32 action_id, u64 frame_id
+) {
+
+	PixzoFrame *pixzo_frame = NULL;
+
+	if (memory && action_id) {
+		SpillLocation location = { 0 };
+
+		(void) pthread_mutex_lock (memory->mutex);
+
+		MemoryAction *action = &memory->actions[action_id % memory->max_actions];
+		if (
+			(action->action_id == action_id)
+			&& (frame_id >= action->first_frame_id)
+			&& ((frame_id - action->first_frame_id) < action->n_slots)
+		) {
+			const MemoryFrame *entry = &action->frames[frame_id - action->first_frame_id];
+			if (entry->frame) {
+				// the held frame is never decoded
+				if (memory->compression != MEMORY_COMPRESSION_NONE) {
+					pixzo_frame = pixzo_frame_share (entry->frame);
+				}
+
+				else {
+					pixzo_frame = entry->frame;
+					pixzo_frame_ref (pixzo_frame);
+				}
+			}
+
+			else {
+				location = entry->spilled;
+			}
+		}
+
+		(void) pthread_mutex_unlock (memory->mutex);
+
+		// read outside the memory's lock
+		if (location.generation) {
+			pixzo_frame = spill_log_read (memory->spill, &location, action_id, frame_id);
+		}
+	}
+
+	return pixzo_frame;
+
+}
+
+void actions_memory_print (const ActionsMemory *memory) {
+
+	if (memory) {
+		(void) printf ("\tActions memory: \n");
+		(void) printf ("\t\tMax actions: %u\n", memory->max_actions);
+		(void) printf ("\t\tMax action frames: %u\n", memory->max_action_frames);
+		(void) printf ("\t\tCompression: %s\n", memory_compression_to_string (memory->compression));
+
+		(void) pthread_mutex_lock (memory->mutex);
+
+		const MemoryAction *action = NULL;
+		for (unsigned int i = 0; i < memory->max_actions; i++) {
+			action = &memory->actions[i];
+			if (action->action_id) {
+				(void) printf (
+					"\t\tAction %u - %s -- frames: %u -- spilled: %u -- dropped: %u -- bytes: %zu\n",
+					action->action_id, action->active ? "active" : "ended",
+					action->n_frames, action->n_spilled, action->n_dropped, action->n_bytes
+				);
+			}
+		}
+
+		(void) pthread_mutex_unlock (memory->mutex);
+
+		spill_log_print (memory->spill);
+	}
+
+}
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#include <immintrin.h>
+#define MOVEMENT_X86
+#endif
+
+#include <opencv2/core/mat.hpp>
+
+#include <client/types/types.h>
+
+#include <client/utils/log.h>
+
+#include "movement.hpp"
+
+// counts the bytes that differ more than threshold in a row
+typedef unsigned int (*MovementCountRow) (
+	const u8 *gray, const u8 *previous, size_t n, u8 threshold
+);
+
+static MovementKernel movement_kernel = MOVEMENT_KERNEL_SCALAR;
+
+static unsigned int movement_count_row_scalar (
+	const u8 *gray, const u8 *previous, size_t n, u8 threshold
+);
+
+static MovementCountRow movement_count_row = movement_count_row_scalar;
+
+const char *movement_kernel_to_string (MovementKernel kernel) {
+
+	switch (kernel) {
+		#define XX(num, name, string) case MOVEMENT_KERNEL_##name: return #string;
+		MOVEMENT_KERNEL_MAP(XX)
+		#undef XX
+	}
+
+	return movement_kernel_to_string (MOVEMENT_KERNEL_SCALAR);
+
+}
+
+#pragma region count
+
+static unsigned int movement_count_row_scalar (
+	const u8 *gray, const u8 *previous, size_t n, u8 threshold
+) {
+
+	unsigned int count = 0;
+
+	u8 difference = 0;
+	for (size_t i = 0; i < n; i++) {
+		difference = (gray[i] > previous[i]) ?
+			gray[i] - previous[i] : previous[i] - gray[i];
+
+		count += (difference > threshold);
+	}
+
+	return count;
+
+}
+
+#ifdef MOVEMENT_X86
+
+// | a - b | is the saturated difference in both directions
+// and x > threshold is the same as max (x, threshold + 1) == x
+__attribute__ ((target ("sse2")))
+static unsigned int movement_count_row_sse2 (
+	const u8 *gray, const u8 *previous, size_t n, u8 threshold
+) {
+
+	unsigned int count = 0;
+
+	const __m128i min = _mm_set1_epi8 ((char) (threshold + 1));
+
+	size_t i = 0;
+	__m128i a, b, difference, changed;
+	for (; (i + 16) <= n; i += 16) {
+		a = _mm_loadu_si128 ((const __m128i *) (gray + i));
+		b = _mm_loadu_si128 ((const __m128i *) (previous + i));
+
+		difference = _mm_or_si128 (_mm_subs_epu8 (a, b), _mm_subs_epu8 (b, a));
+		changed = _mm_cmpeq_epi8 (_mm_max_epu8 (difference, min), difference);
+
+		count += (unsigned int) __builtin_popcount (
+			(unsigned int) _mm_movemask_epi8 (changed)
+		);
+	}
+
+	return count + movement_count_row_scalar (
+		gray + i, previous + i, n - i, threshold
+	);
+
+}
+
+__attribute__ ((target ("avx2")))
+static unsigned int movement_count_row_avx2 (
+	const u8 *gray, const u8 *previous, size_t n, u8 threshold
+) {
+
+	unsigned int count = 0;
+
+	const __m256i min = _mm256_set1_epi8 ((char) (threshold + 1));
+
+	size_t i = 0;
+	__m256i a, b, difference, changed;
+	for (; (i + 32) <= n; i += 32) {
+		a = _mm256_loadu_si256 ((const __m256i *) (gray + i));
+		b = _mm256_loadu_si256 ((const __m256i *) (previous + i));
+
+		difference = _mm256_or_si256 (
+			_mm256_subs_epu8 (a, b), _mm256_subs_epu8 (b, a)
+		);
+
+		changed = _mm256_cmpeq_epi8 (
+			_mm256_max_epu8 (difference, min), difference
+		);
+
+		count += (unsigned int) __builtin_popcount (
+			(unsigned int) _mm256_movemask_epi8 (changed)
+		);
+	}
+
+	return count + movement_count_row_sse2 (
+		gray + i, previous + i, n - i, threshold
+	);
+
+}
+
+#endif
+
+// counts the pixels that differ more than threshold from the previous frame
+// the absolute difference, the threshold & the count are done in a single sweep
+// returns 0 if the images' sizes do not match
+unsigned int movement_count (
+	const cv::Mat &gray, const cv::Mat &previous, u8 threshold
+) {
+
+	unsigned int count = 0;
+
+	if (
+		(gray.size () == previous.size ())
+		&& (gray.type () == CV_8UC1) && (previous.type () == CV_8UC1)
+		// nothing can be above the max value
+		&& (threshold < 255)
+	) {
+		if (gray.isContinuous () && previous.isContinuous ()) {
+			count = movement_count_row (
+				gray.ptr (), previous.ptr (), gray.total (), threshold
+			);
+		}
+
+		else {
+			for (int y = 0; y < gray.rows; y++) {
+				count += movement_count_row (
+					gray.ptr (y), previous.ptr (y), (size_t) gray.cols, threshold
+				);
+			}
+		}
+	}
+
+	return count;
+
+}
+
+#pragma endregion
+
+#pragma region main
+
+// selects the best kernel that the running cpu supports
+// must be called once before any frame is compared
+void movement_init (void) {
+
+	movement_kernel = MOVEMENT_KERNEL_SCALAR;
+	movement_count_row = movement_count_row_scalar;
+
+	#ifdef MOVEMENT_X86
+	__builtin_cpu_init ();
+
+	if (__builtin_cpu_supports ("avx2")) {
+		movement_kernel = MOVEMENT_KERNEL_AVX2;
+		movement_count_row = movement_count_row_avx2;
+	}
+
+	else if (__builtin_cpu_supports ("sse2")) {
+		movement_kernel = MOVEMENT_KERNEL_SSE2;
+		movement_count_row = movement_count_row_sse2;
+	}
+	#endif
+
+	client_log_debug (
+		"Using %s movement kernel",
+		movement_kernel_to_string (movement_kernel)
+	);
+
+}
+
+MovementKernel movement_get_kernel (void) {
+
+	return movement_kernel;
+
+}
+
+#pragma endregion
@@ -0,0 +1,701 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include <time.h>
+#include <pthread.h>
+
+#include <client/types/types.h>
+
+#include <client/threads/thread.h>
+
+#include <client/utils/log.h>
+
+#include "executor.hpp"
+#include "pipeline.hpp"
+
+const char *pipeline_stage_type_to_string (
+	PipelineStageType type
+) {
+
+	switch (type) {
+		#define XX(num, name, string) case PIPELINE_STAGE_TYPE_##name: return #string;
+		PIPELINE_STAGE_TYPE_MAP(XX)
+		#undef XX
+	}
+
+	return pipeline_stage_type_to_string (PIPELINE_STAGE_TYPE_NONE);
+
+}
+
+// returns NONE for NULL or unknown values
+PipelineStageType pipeline_stage_type_from_string (
+	const char *string
+) {
+
+	PipelineStageType type = PIPELINE_STAGE_TYPE_NONE;
+
+	if (string) {
+		#define XX(num, name, str) if (!strcasecmp (#str, string)) type = PIPELINE_STAGE_TYPE_##name;
+		PIPELINE_STAGE_TYPE_MAP(XX)
+		#undef XX
+	}
+
+	return type;
+
+}
+
+static u64 pipeline_time_ns (void) {
+
+	struct timespec now = { 0 };
+	(void) clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return ((u64) now.tv_sec * 1000000000) + (u64) now.tv_nsec;
+
+}
+
+#pragma region queue
+
+static PipelineQueue *pipeline_queue_create (unsigned int capacity) {
+
+	PipelineQueue *queue = (PipelineQueue *) malloc (sizeof (PipelineQueue));
+	if (queue) {
+		queue->items = (void **) calloc (capacity, sizeof (void *));
+		queue->used = (bool *) calloc (capacity, sizeof (bool));
+		queue->capacity = capacity;
+
+		queue->next = 0;
+		queue->closed = false;
+
+		queue->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+		(void) pthread_mutex_init (queue->mutex, NULL);
+
+		queue->has_items = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+		(void) pthread_cond_init (queue->has_items, NULL);
+
+		queue->has_room = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+		(void) pthread_cond_init (queue->has_room, NULL);
+
+		queue->n_active = 0;
+		queue->max_active = 0;
+
+		queue->max_size = 0;
+	}
+
+	return queue;
+
+}
+
+// the queue must be empty
+// returns 0 on success, 1 on error
+static unsigned int pipeline_queue_resize (
+	PipelineQueue *queue, unsigned int capacity
+) {
+
+	unsigned int retval = 1;
+
+	void **items = (void **) calloc (capacity, sizeof (void *));
+	bool *used = (bool *) calloc (capacity, sizeof (bool));
+	if (items && used) {
+		free (queue->items);
+		free (queue->used);
+
+		queue->items = items;
+		queue->used = used;
+		queue->capacity = capacity;
+
+		retval = 0;
+	}
+
+	else {
+		free (items);
+		free (used);
+	}
+
+	return retval;
+
+}
+
+static void pipeline_queue_delete (PipelineQueue *queue) {
+
+	if (queue) {
+		free (queue->items);
+		free (queue->used);
+
+		(void) pthread_mutex_destroy (queue->mutex);
+		free (queue->mutex);
+
+		(void) pthread_cond_destroy (queue->has_items);
+		free (queue->has_items);
+
+		(void) pthread_cond_destroy (queue->has_room);
+		free (queue->has_room);
+
+		free (queue);
+	}
+
+}
+
+// waits until there is room for the item's sequence
+// returns true if a new executor's task has to take the items
+static bool pipeline_queue_push (
+	PipelineQueue *queue, u64 seq, void *item
+) {
+
+	bool activate = false;
+
+	(void) pthread_mutex_lock (queue->mutex);
+
+	while (seq >= (queue->next + queue->capacity)) {
+		(void) pthread_cond_wait (queue->has_room, queue->mutex);
+	}
+
+	queue->items[seq % queue->capacity] = item;
+	queue->used[seq % queue->capacity] = true;
+
+	unsigned int size = (unsigned int) (seq - queue->next) + 1;
+	if (size > queue->max_size) queue->max_size = size;
+
+	if (queue->n_active < queue->max_active) {
+		queue->n_active += 1;
+		activate = true;
+	}
+
+	(void) pthread_cond_broadcast (queue->has_items);
+	(void) pthread_mutex_unlock (queue->mutex);
+
+	return activate;
+
+}
+
+// waits for the next item in sequence
+// returns 0 on success, 1 if the queue was closed & is empty
+static unsigned int pipeline_queue_pop (
+	PipelineQueue *queue, u64 *seq, void **item
+) {
+
+	unsigned int retval = 1;
+
+	(void) pthread_mutex_lock (queue->mutex);
+
+	unsigned int idx = (unsigned int) (queue->next % queue->capacity);
+	while (!queue->used[idx] && !queue->closed) {
+		(void) pthread_cond_wait (queue->has_items, queue->mutex);
+		idx = (unsigned int) (queue->next % queue->capacity);
+	}
+
+	if (queue->used[idx]) {
+		*seq = queue->next;
+		*item = queue->items[idx];
+
+		queue->items[idx] = NULL;
+		queue->used[idx] = false;
+		queue->next += 1;
+
+		(void) pthread_cond_broadcast (queue->has_room);
+
+		retval = 0;
+	}
+
+	(void) pthread_mutex_unlock (queue->mutex);
+
+	return retval;
+
+}
+
+// takes the next item in sequence without waiting
+// if there is none, the caller stops being an active task
+// returns 0 on success, 1 if the next item is not there yet
+static unsigned int pipeline_queue_take (
+	PipelineQueue *queue, u64 *seq, void **item
+) {
+
+	unsigned int retval = 1;
+
+	(void) pthread_mutex_lock (queue->mutex);
+
+	unsigned int idx = (unsigned int) (queue->next % queue->capacity);
+	if (queue->used[idx]) {
+		*seq = queue->next;
+		*item = queue->items[idx];
+
+		queue->items[idx] = NULL;
+		queue->used[idx] = false;
+		queue->next += 1;
+
+		retval = 0;
+	}
+
+	else {
+		queue->n_active -= 1;
+	}
+
+	(void) pthread_mutex_unlock (queue->mutex);
+
+	return retval;
+
+}
+
+// threads that are waiting for items exit once it is empty
+static void pipeline_queue_close (PipelineQueue *queue) {
+
+	(void) pthread_mutex_lock (queue->mutex);
+	queue->closed = true;
+	(void) pthread_cond_broadcast (queue->has_items);
+	(void) pthread_mutex_unlock (queue->mutex);
+
+}
+
+#pragma endregion
+
+#pragma region main
+
+Pipeline *pipeline_create (void *args) {
+
+	Pipeline *pipeline = (Pipeline *) malloc (sizeof (Pipeline));
+	if (pipeline) {
+		(void) memset (pipeline, 0, sizeof (Pipeline));
+
+		pipeline->args = args;
+
+		pipeline->n_stages = 0;
+
+		pipeline->executor = NULL;
+
+		pipeline->next_seq = 0;
+		pipeline->running = false;
+		pipeline->cancelled = false;
+
+		pipeline->n_in_flight = 0;
+		pipeline->max_in_flight = 0;
+
+		pipeline->done = NULL;
+		pipeline->done_args = NULL;
+
+		pipeline->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+		(void) pthread_mutex_init (pipeline->mutex, NULL);
+
+		pipeline->drained = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+		(void) pthread_cond_init (pipeline->drained, NULL);
+	}
+
+	return pipeline;
+
+}
+
+// the pipeline must have been stopped before
+void pipeline_delete (void *pipeline_ptr) {
+
+	if (pipeline_ptr) {
+		Pipeline *pipeline = (Pipeline *) pipeline_ptr;
+
+		for (unsigned int i = 0; i < pipeline->n_stages; i++) {
+			pipeline_queue_delete (pipeline->stages[i].queue);
+		}
+
+		(void) pthread_mutex_destroy (pipeline->mutex);
+		free (pipeline->mutex);
+
+		(void) pthread_cond_destroy (pipeline->drained);
+		free (pipeline->drained);
+
+		free (pipeline);
+	}
+
+}
+
+// adds a stage after the last one
+// returns 0 on success, 1 on error
+unsigned int pipeline_add_stage (
+	Pipeline *pipeline, PipelineStageType type, const char *name,
+	PipelineStageWork work, unsigned int n_threads, unsigned int queue_size
+) {
+
+	unsigned int retval = 1;
+
+	if (pipeline && work && !pipeline->running && (pipeline->n_stages < PIPELINE_MAX_STAGES)) {
+		PipelineStage *stage = &pipeline->stages[pipeline->n_stages];
+
+		stage->type = type;
+		(void) strncpy (stage->name, name, PIPELINE_STAGE_NAME_SIZE - 1);
+
+		stage->pipeline = pipeline;
+
+		stage->work = work;
+		stage->queue = pipeline_queue_create (
+			queue_size ? queue_size : DEFAULT_PIPELINE_QUEUE_SIZE
+		);
+
+		stage->n_threads = n_threads ? n_threads : 1;
+		if (stage->n_threads > PIPELINE_STAGE_MAX_THREADS) {
+			stage->n_threads = PIPELINE_STAGE_MAX_THREADS;
+		}
+
+		stage->n_items = 0;
+		stage->busy_ns = 0;
+
+		if (stage->queue) {
+			pipeline->n_stages += 1;
+			retval = 0;
+		}
+	}
+
+	return retval;
+
+}
+
+static void pipeline_stage_drain (void *stage_ptr);
+
+static void pipeline_stage_push (
+	PipelineStage *stage, u64 seq, void *item
+) {
+
+	if (pipeline_queue_push (stage->queue, seq, item)) {
+		executor_submit (stage->pipeline->executor, pipeline_stage_drain, stage);
+	}
+
+}
+
+// the item has gone through the last stage
+static void pipeline_item_done (Pipeline *pipeline) {
+
+	if (
+		!__atomic_sub_fetch (&pipeline->n_in_flight, 1, __ATOMIC_SEQ_CST)
+		&& !__atomic_load_n (&pipeline->running, __ATOMIC_SEQ_CST)
+	) {
+		(void) pthread_mutex_lock (pipeline->mutex);
+		(void) pthread_cond_broadcast (pipeline->drained);
+		(void) pthread_mutex_unlock (pipeline->mutex);
+	}
+
+	// after the item has left, so the producer sees the room
+	if (pipeline->done) pipeline->done (pipeline->done_args);
+
+}
+
+// works on the item & passes it to the next stage
+static void pipeline_stage_work (
+	PipelineStage *stage, u64 seq, void *item
+) {
+
+	Pipeline *pipeline = stage->pipeline;
+
+	unsigned int idx = (unsigned int) (stage - pipeline->stages);
+	bool last = ((idx + 1) == pipeline->n_stages);
+
+	// the last stage is the one that releases the items
+	if (last || !pipeline_is_cancelled (pipeline)) {
+		u64 start = pipeline_time_ns ();
+
+		stage->work (pipeline->args, item);
+
+		(void) __atomic_add_fetch (&stage->busy_ns, pipeline_time_ns () - start, __ATOMIC_RELAXED);
+		(void) __atomic_add_fetch (&stage->n_items, 1, __ATOMIC_RELAXED);
+	}
+
+	if (!last) {
+		pipeline_stage_push (&pipeline->stages[idx + 1], seq, item);
+	}
+
+	else {
+		pipeline_item_done (pipeline);
+	}
+
+}
+
+static void *pipeline_stage_thread (void *stage_ptr) {
+
+	PipelineStage *stage = (PipelineStage *) stage_ptr;
+
+	(void) thread_set_name (stage->name);
+
+	u64 seq = 0;
+	void *item = NULL;
+	while (!pipeline_queue_pop (stage->queue, &seq, &item)) {
+		pipeline_stage_work (stage, seq, item);
+	}
+
+	return NULL;
+
+}
+
+// executor's task that takes the stage's items in sequence
+// until the next one is not there yet
+static void pipeline_stage_drain (void *stage_ptr) {
+
+	PipelineStage *stage = (PipelineStage *) stage_ptr;
+
+	u64 seq = 0;
+	void *item = NULL;
+	unsigned int n_items = 0;
+	bool done = false;
+	while (!done) {
+		// is still an active task, so it can be queued again
+		if (n_items == PIPELINE_DRAIN_BATCH) {
+			executor_submit (stage->pipeline->executor, pipeline_stage_drain, stage);
+			done = true;
+		}
+
+		else if (pipeline_queue_take (stage->queue, &seq, &item)) {
+			done = true;
+		}
+
+		else {
+			pipeline_stage_work (stage, seq, item);
+			n_items += 1;
+		}
+	}
+
+}
+
+// runs the stages as the executor's tasks instead of their own threads
+// where each stage's threads are the max tasks that run at the same time
+// must be called before the pipeline is started
+void pipeline_set_executor (
+	Pipeline *pipeline, Executor *executor
+) {
+
+	if (pipeline && !pipeline->running) {
+		pipeline->executor = executor;
+	}
+
+}
+
+// sets the method to call every time an item leaves the pipeline
+// so the producer knows that there is room for a new one
+// must be called before the pipeline is started
+void pipeline_set_done (
+	Pipeline *pipeline, PipelineDone done, void *done_args
+) {
+
+	if (pipeline && !pipeline->running) {
+		pipeline->done = done;
+		pipeline->done_args = done_args;
+	}
+
+}
+
+// the executor's workers can never wait for room in the next stage
+// so every stage can hold all the items that can be in flight
+// that is every queue's items plus the ones being worked on
+static unsigned int pipeline_start_executor (Pipeline *pipeline) {
+
+	unsigned int errors = 0;
+
+	PipelineStage *stage = NULL;
+
+	pipeline->max_in_flight = 0;
+	for (unsigned int i = 0; i < pipeline->n_stages; i++) {
+		stage = &pipeline->stages[i];
+
+		pipeline->max_in_flight += stage->queue->capacity + stage->n_threads;
+		stage->queue->max_active = stage->n_threads;
+	}
+
+	// every item from a queue's next one up to the newest is still in flight
+	for (unsigned int i = 0; i < pipeline->n_stages; i++) {
+		stage = &pipeline->stages[i];
+
+		if (pipeline_queue_resize (stage->queue, pipeline->max_in_flight)) {
+			client_log_error (
+				"Failed to resize pipeline's %s stage queue!", stage->name
+			);
+
+			errors |= 1;
+		}
+	}
+
+	return errors;
+
+}
+
+// creates every stage's threads, unless they run in an executor
+// returns 0 on success, 1 on error
+unsigned int pipeline_start (Pipeline *pipeline) {
+
+	unsigned int errors = 0;
+
+	if (pipeline && !pipeline->running) {
+		PipelineStage *stage = NULL;
+
+		if (pipeline->executor) {
+			errors |= pipeline_start_executor (pipeline);
+		}
+
+		else {
+			for (unsigned int i = 0; i < pipeline->n_stages; i++) {
+				stage = &pipeline->stages[i];
+
+				for (unsigned int t = 0; t < stage->n_threads; t++) {
+					if (pthread_create (&stage->threads[t], NULL, pipeline_stage_thread, stage)) {
+						client_log_error (
+							"Failed to create pipeline's %s stage thread!", stage->name
+						);
+
+						stage->n_threads = t;
+						errors |= 1;
+						break;
+					}
+				}
+			}
+		}
+
+		pipeline->running = true;
+	}
+
+	return errors;
+
+}
+
+// adds a new item to the first stage
+// with its own threads, it waits if the stage is full
+// with an executor, it never waits and full pipelines don't take the item
+// returns 0 on success, 1 if the item was not taken
+unsigned int pipeline_push (Pipeline *pipeline, void *item) {
+
+	unsigned int retval = 1;
+
+	if (pipeline->n_stages) {
+		// counted before checking that it is running
+		// so pipeline_stop () always waits for the item
+		unsigned int n_in_flight = __atomic_add_fetch (&pipeline->n_in_flight, 1, __ATOMIC_SEQ_CST);
+		if (
+			__atomic_load_n (&pipeline->running, __ATOMIC_SEQ_CST)
+			&& (!pipeline->executor || (n_in_flight <= pipeline->max_in_flight))
+		) {
+			pipeline_stage_push (&pipeline->stages[0], pipeline->next_seq, item);
+			pipeline->next_seq += 1;
+
+			retval = 0;
+		}
+
+		else {
+			pipeline_item_done (pipeline);
+		}
+	}
+
+	return retval;
+
+}
+
+// returns true if the running pipeline can take a new item right away
+bool pipeline_has_room (const Pipeline *pipeline) {
+
+	return __atomic_load_n (&pipeline->running, __ATOMIC_SEQ_CST)
+		&& (
+			!pipeline->executor
+			|| (__atomic_load_n (&pipeline->n_in_flight, __ATOMIC_SEQ_CST) < pipeline->max_in_flight)
+		);
+
+}
+
+// waits up to timeout ms (0 for no limit) for the items in flight
+// returns 0 if every item went through every stage, 1 on timeout
+static unsigned int pipeline_wait_drained (
+	Pipeline *pipeline, unsigned int timeout
+) {
+
+	struct timespec deadline = { 0 };
+	(void) clock_gettime (CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000;
+	deadline.tv_nsec %= 1000000000;
+
+	bool timed_out = false;
+
+	(void) pthread_mutex_lock (pipeline->mutex);
+
+	while (__atomic_load_n (&pipeline->n_in_flight, __ATOMIC_SEQ_CST) && !timed_out) {
+		if (timeout) {
+			timed_out = (pthread_cond_timedwait (
+				pipeline->drained, pipeline->mutex, &deadline
+			) == ETIMEDOUT);
+		}
+
+		else {
+			(void) pthread_cond_wait (pipeline->drained, pipeline->mutex);
+		}
+	}
+
+	unsigned int retval = __atomic_load_n (&pipeline->n_in_flight, __ATOMIC_SEQ_CST) ? 1 : 0;
+
+	(void) pthread_mutex_unlock (pipeline->mutex);
+
+	return retval;
+
+}
+
+// waits up to timeout ms (0 for no limit) until every item has gone
+// through every stage, after it the items that are left only go through
+// the last one for up to PIPELINE_CANCEL_TIMEOUT, so it can still release them,
+// and then stops the stages' threads
+// returns 0 if every item was handled, 1 if some were cancelled
+unsigned int pipeline_stop (Pipeline *pipeline, unsigned int timeout) {
+
+	unsigned int retval = 0;
+
+	if (pipeline && pipeline->running) {
+		__atomic_store_n (&pipeline->running, false, __ATOMIC_SEQ_CST);
+
+		if (pipeline_wait_drained (pipeline, timeout)) {
+			__atomic_store_n (&pipeline->cancelled, true, __ATOMIC_SEQ_CST);
+
+			// only the last stage's work is left
+			// the ones that are still in the executor are handled by executor_stop ()
+			if (pipeline_wait_drained (pipeline, PIPELINE_CANCEL_TIMEOUT)) {
+				client_log_warning ("Pipeline stopped with cancelled items in flight!");
+			}
+
+			retval = 1;
+		}
+
+		// every stage is empty so its threads exit right away
+		if (!pipeline->executor) {
+			PipelineStage *stage = NULL;
+			for (unsigned int i = 0; i < pipeline->n_stages; i++) {
+				stage = &pipeline->stages[i];
+
+				pipeline_queue_close (stage->queue);
+
+				for (unsigned int t = 0; t < stage->n_threads; t++) {
+					(void) pthread_join (stage->threads[t], NULL);
+				}
+			}
+		}
+	}
+
+	return retval;
+
+}
+
+// the pipeline was stopped before its items were handled
+// so the last stage should only release them
+bool pipeline_is_cancelled (const Pipeline *pipeline) {
+
+	return __atomic_load_n (&pipeline->cancelled, __ATOMIC_SEQ_CST);
+
+}
+
+void pipeline_print (const Pipeline *pipeline) {
+
+	if (pipeline) {
+		(void) printf ("\tPipeline: \n");
+
+		const PipelineStage *stage = NULL;
+		for (unsigned int i = 0; i < pipeline->n_stages; i++) {
+			stage = &pipeline->stages[i];
+			(void) printf (
+				"\t\t%s - %s: %u -- items: %lu -- busy: %lu ms -- max queue: %u\n",
+				pipeline_stage_type_to_string (stage->type),
+				pipeline->executor ? "tasks" : "threads", stage->n_threads,
+				stage->n_items, stage->busy_ns / 1000000, stage->queue->max_size
+			);
+		}
+	}
+
+}
+
+#pragma endregion
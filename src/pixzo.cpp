@@ -13,10 +13,13 @@
 #include <client/utils/log.h>
 #include <client/utils/utils.h>
 
+#include "affinity.hpp"
 #include "camera.hpp"
 #include "errors.h"
 #include "frames.hpp"
 #include "global.h"
+#include "movement.hpp"
+#include "pipeline.hpp"
 #include "pixzo.h"
 #include "store.h"
 #include "stream.hpp"
@@ -50,6 +53,41 @@ static void pixzo_init_store_create_camera_resolution (
 
 }
 
+static void pixzo_init_store_create_camera_roi (
+	Camera *cam, json_t *roi_object
+) {
+
+	unsigned int x = 0;
+	unsigned int y = 0;
+	unsigned int width = 0;
+	unsigned int height = 0;
+
+	const char *key = NULL;
+	json_t *value = NULL;
+	if (json_typeof (roi_object) == JSON_OBJECT) {
+		json_object_foreach (roi_object, key, value) {
+			if (!strcmp (key, "x")) {
+				x = (unsigned int) json_integer_value (value);
+			}
+
+			else if (!strcmp (key, "y")) {
+				y = (unsigned int) json_integer_value (value);
+			}
+
+			else if (!strcmp (key, "width")) {
+				width = (unsigned int) json_integer_value (value);
+			}
+
+			else if (!strcmp (key, "height")) {
+				height = (unsigned int) json_integer_value (value);
+			}
+		}
+	}
+
+	camera_set_roi (cam, x, y, width, height);
+
+}
+
 static Camera *pixzo_init_store_create_camera (
 	json_t *cam_json
 ) {
@@ -69,6 +107,10 @@ static Camera *pixzo_init_store_create_camera (
 			);
 		}
 
+		else if (!strcmp (key, "roi")) {
+			pixzo_init_store_create_camera_roi (cam, value);
+		}
+
 		else if (!strcmp (key, "resolution")) {
 			pixzo_init_store_create_camera_resolution (
 				cam, value
@@ -79,6 +121,24 @@ static Camera *pixzo_init_store_create_camera (
 			(void) camera_set_fps (cam, (int) json_integer_value (value));
 		}
 
+		else if (!strcmp (key, "backend")) {
+			camera_set_backend (
+				cam, camera_backend_from_string (json_string_value (value))
+			);
+		}
+
+		else if (!strcmp (key, "pixel_format")) {
+			camera_set_pixel_format (cam, json_string_value (value));
+		}
+
+		else if (!strcmp (key, "mjpeg_passthrough")) {
+			camera_set_passthrough (cam, json_is_true (value));
+		}
+
+		else if (!strcmp (key, "buffers")) {
+			camera_set_n_buffers (cam, (unsigned int) json_integer_value (value));
+		}
+
 		else if (!strcmp (key, "auto_exposure")) {
 			cam->auto_exposure = json_real_value (value);
 		}
@@ -187,6 +247,30 @@ static void pixzo_init_store_create_stream_pose_output_offset (
 
 }
 
+// "pipeline": { "decode": 2, "encode": 2 }
+static void pixzo_init_store_create_stream_pipeline (
+	Stream *stream, json_t *pipeline_object
+) {
+
+	const char *key = NULL;
+	json_t *value = NULL;
+	if (json_typeof (pipeline_object) == JSON_OBJECT) {
+		json_object_foreach (pipeline_object, key, value) {
+			if (stream_set_stage_threads (
+				stream, pipeline_stage_type_from_string (key),
+				(unsigned int) json_integer_value (value)
+			)) {
+				client_log_error (
+					"Pipeline stage %s can't be configured - "
+					"only decode, preprocess, movement, encode & sink can!",
+					key
+				);
+			}
+		}
+	}
+
+}
+
 static Stream *pixzo_init_store_create_stream (
 	Camera *cam, json_t *cam_json
 ) {
@@ -233,6 +317,44 @@ static Stream *pixzo_init_store_create_stream (
 		else if (!strcmp (key, "max_no_movement_frames")) {
 			(void) stream_set_max_no_movement_frames (stream, (unsigned int) json_integer_value (value));
 		}
+
+		else if (!strcmp (key, "pre_roll_frames")) {
+			stream_set_pre_roll_frames (stream, (unsigned int) json_integer_value (value));
+		}
+
+		else if (!strcmp (key, "pre_roll_seconds")) {
+			stream_set_pre_roll_seconds (stream, (unsigned int) json_integer_value (value));
+		}
+
+		else if (!strcmp (key, "capture_cpus")) {
+			(void) stream_set_capture_cpus (stream, json_string_value (value));
+		}
+
+		else if (!strcmp (key, "capture_sched")) {
+			stream_set_capture_sched (
+				stream,
+				affinity_sched_from_string (json_string_value (value)),
+				stream->capture_affinity.priority
+			);
+		}
+
+		else if (!strcmp (key, "capture_priority")) {
+			stream_set_capture_sched (
+				stream,
+				stream->capture_affinity.sched,
+				(int) json_integer_value (value)
+			);
+		}
+
+		else if (!strcmp (key, "numa_node")) {
+			stream_set_numa_node (stream, (int) json_integer_value (value));
+		}
+
+		else if (!strcmp (key, "pipeline")) {
+			pixzo_init_store_create_stream_pipeline (
+				stream, value
+			);
+		}
 	}
 
 	return stream;
@@ -403,7 +525,9 @@ static u8 pixzo_init (void) {
 
 	u8 retval = 1;
 
-	if (!pixzo_frames_init ()) {
+	movement_init ();
+
+	if (!pixzo_frames_init (global->config.huge_pages)) {
 		retval = pixzo_init_store ();
 	}
 
@@ -519,19 +643,9 @@ static u8 pixzo_end (void) {
 
 	client_log_debug ("Closing %s...", global->store->name);
 
-	store_close (global->store);
-
-	pixzo_frames_end ();
-
-	// give a grace period for all streams to stop
-	client_log_warning ("Exiting in (3)...");
-	(void) sleep (1);
-	client_log_warning ("Exiting in (2)...");
-	(void) sleep (1);
-	client_log_warning ("Exiting in (1)...");
-	(void) sleep (1);
-
-	return 0;
+	// waits for the streams to handle their pending frames
+	// up to the configured shutdown timeout
+	return (u8) store_close (global->store);
 
 }
 
@@ -542,9 +656,13 @@ void pixzo_close (void) {
 	(void) printf ("\n");
 
 	// close the store locally
-	pixzo_end ();
+	// threads that are still running are left to exit with the process
+	if (!pixzo_end ()) {
+		global_end ();
 
-	global_end ();
+		// after every frame has been returned
+		pixzo_frames_end ();
+	}
 
 	(void) printf ("\n");
 	client_log_success ("Done!");
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <client/types/types.h>
+
+#include <client/utils/log.h>
+
+#include "frames.hpp"
+#include "ring.hpp"
+
+// creates a new ring that can hold at least capacity frames
+FramesRing *frames_ring_create (unsigned int capacity) {
+
+	FramesRing *ring = NULL;
+
+	void *ring_ptr = NULL;
+	if (!posix_memalign (&ring_ptr, FRAMES_RING_CACHE_LINE, sizeof (FramesRing))) {
+		ring = (FramesRing *) ring_ptr;
+		(void) memset (ring, 0, sizeof (FramesRing));
+
+		ring->capacity = 1;
+		while (ring->capacity < capacity) ring->capacity <<= 1;
+		ring->mask = ring->capacity - 1;
+
+		ring->frames = (PixzoFrame **) calloc (ring->capacity, sizeof (PixzoFrame *));
+		if (!ring->frames) {
+			client_log_error ("Failed to allocate frames ring!");
+
+			free (ring);
+			ring = NULL;
+		}
+	}
+
+	return ring;
+
+}
+
+// the ring must be empty, frames are not released
+void frames_ring_delete (void *ring_ptr) {
+
+	if (ring_ptr) {
+		FramesRing *ring = (FramesRing *) ring_ptr;
+
+		if (frames_ring_size (ring)) {
+			client_log_warning (
+				"Frames ring deleted with %u frames!", frames_ring_size (ring)
+			);
+		}
+
+		free (ring->frames);
+
+		free (ring);
+	}
+
+}
+
+// returns the number of frames in the ring
+unsigned int frames_ring_size (const FramesRing *ring) {
+
+	return (unsigned int) (
+		__atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)
+		- __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE)
+	);
+
+}
+
+// adds a frame to the ring
+// must only be called by the producer
+// returns true on success, false if the ring was full
+bool frames_ring_push (FramesRing *ring, PixzoFrame *frame) {
+
+	bool pushed = false;
+
+	u64 head = ring->head;
+	if ((head - __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE)) < ring->capacity) {
+		ring->frames[head & ring->mask] = frame;
+		__atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+
+		pushed = true;
+	}
+
+	else {
+		ring->n_full += 1;
+	}
+
+	return pushed;
+
+}
+
+static PixzoFrame *frames_ring_pop_internal (FramesRing *ring) {
+
+	PixzoFrame *frame = NULL;
+
+	u64 tail = ring->tail;
+	if (tail != __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE)) {
+		frame = ring->frames[tail & ring->mask];
+		__atomic_store_n (&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	return frame;
+
+}
+
+// takes one of the producer's drop requests, if there is any
+// the producer can also take back a request that it made
+// so the count is never decremented past 0
+static bool frames_ring_take_drop_request (FramesRing *ring) {
+
+	bool taken = false;
+
+	unsigned int requests = __atomic_load_n (&ring->drop_requests, __ATOMIC_SEQ_CST);
+	while (!taken && requests) {
+		taken = __atomic_compare_exchange_n (
+			&ring->drop_requests, &requests, requests - 1,
+			false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST
+		);
+	}
+
+	return taken;
+
+}
+
+// removes the oldest frame from the ring without waiting
+// must only be called by the consumer
+// returns NULL if the ring is empty
+PixzoFrame *frames_ring_pop (FramesRing *ring) {
+
+	PixzoFrame *frame = frames_ring_pop_internal (ring);
+
+	// pairs with the producer's request & size check
+	// so that a request is either seen here or taken back by the producer
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+	// the oldest frames are dropped first
+	// every request has its own frame that is still in the ring
+	while (frame && frames_ring_take_drop_request (ring)) {
+		pixzo_frame_release (frame);
+		ring->n_dropped += 1;
+
+		frame = frames_ring_pop_internal (ring);
+	}
+
+	return frame;
+
+}
+
+// asks the consumer to drop (release) the oldest frame
+// as the producer can't remove frames from the ring
+// must only be called by the producer
+// returns true if the request was accepted
+// false if every frame in the ring is already going to be dropped
+bool frames_ring_request_drop (FramesRing *ring) {
+
+	bool requested = false;
+
+	unsigned int size = frames_ring_size (ring);
+	unsigned int requests = __atomic_load_n (&ring->drop_requests, __ATOMIC_SEQ_CST);
+	while (!requested && (size > requests)) {
+		requested = __atomic_compare_exchange_n (
+			&ring->drop_requests, &requests, requests + 1,
+			false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST
+		);
+	}
+
+	if (requested) {
+		__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+		// the consumer might have taken the frames without seeing the request
+		// so it is taken back instead of dropping a newer frame later
+		// the ring only shrinks while we check it
+		if (
+			(__atomic_load_n (&ring->drop_requests, __ATOMIC_SEQ_CST) > frames_ring_size (ring))
+			&& frames_ring_take_drop_request (ring)
+		) {
+			requested = false;
+		}
+	}
+
+	return requested;
+
+}
+
+void frames_ring_print (const FramesRing *ring) {
+
+	if (ring) {
+		(void) printf ("\t\tCapacity: %u\n", ring->capacity);
+		(void) printf ("\t\tSize: %u\n", frames_ring_size (ring));
+		(void) printf ("\t\tFull: %lu\n", ring->n_full);
+		(void) printf ("\t\tDropped: %lu\n", ring->n_dropped);
+	}
+
+}
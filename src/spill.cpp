@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <pthread.h>
+
+#include <sys/mman.h>
+
+#include <opencv2/core/mat.hpp>
+
+#include <client/types/types.h>
+
+#include <client/utils/log.h>
+
+#include "frames.hpp"
+#include "spill.hpp"
+
+// written before every frame's data
+struct _SpillRecord {
+
+	u32 magic;
+	u32 format;
+
+	PixzoFrameInfo info;
+	CameraRoi crop;
+
+	u64 size;				// the data's size
+
+};
+
+typedef struct _SpillRecord SpillRecord;
+
+// records start aligned so their headers can be read in place
+#define SPILL_LOG_ALIGN(size)		(((size) + 7) & ~((size_t) 7))
+
+static unsigned int spill_segment_open (
+	SpillSegment *segment, const char *path, const char *name,
+	unsigned int idx, size_t size
+) {
+
+	unsigned int retval = 1;
+
+	(void) snprintf (
+		segment->filename, SPILL_LOG_PATH_SIZE - 1,
+		"%s/%s-%u.spill", path, name, idx
+	);
+
+	segment->fd = open (segment->filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (segment->fd >= 0) {
+		// the blocks are reserved now so that writing into the mapping
+		// never raises SIGBUS when the disk is full (no sparse file)
+		int error = posix_fallocate (segment->fd, 0, (off_t) size);
+		if (error) {
+			client_log_error (
+				"Failed to reserve %lu bytes for spill segment %s: %s",
+				(unsigned long) size, segment->filename, strerror (error)
+			);
+		}
+
+		else {
+			void *data = mmap (
+				NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0
+			);
+
+			if (data != MAP_FAILED) {
+				segment->data = (unsigned char *) data;
+				segment->size = size;
+				retval = 0;
+			}
+		}
+	}
+
+	if (retval) {
+		client_log_error (
+			"Failed to create spill segment %s!", segment->filename
+		);
+	}
+
+	return retval;
+
+}
+
+static void spill_segment_close (SpillSegment *segment) {
+
+	if (segment->data) {
+		(void) munmap (segment->data, segment->size);
+		segment->data = NULL;
+	}
+
+	if (segment->fd >= 0) {
+		(void) close (segment->fd);
+		(void) unlink (segment->filename);
+		segment->fd = -1;
+	}
+
+}
+
+// creates & maps the log's segments in path
+// using name to create their filenames
+// returns NULL on error
+SpillLog *spill_log_create (
+	const char *path, const char *name,
+	size_t segment_size, unsigned int n_segments
+) {
+
+	SpillLog *log = NULL;
+
+	if (path && name && segment_size && n_segments) {
+		log = (SpillLog *) malloc (sizeof (SpillLog));
+		if (log) {
+			log->segments = (SpillSegment *) calloc (n_segments, sizeof (SpillSegment));
+			log->n_segments = n_segments;
+			log->segment_size = segment_size;
+
+			log->current = 0;
+			log->offset = 0;
+			log->next_generation = 1;
+
+			log->n_spilled = 0;
+			log->n_recycled = 0;
+			log->n_bytes = 0;
+
+			log->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+
+			if (log->segments && log->mutex) {
+				(void) pthread_mutex_init (log->mutex, NULL);
+
+				unsigned int errors = 0;
+				for (unsigned int i = 0; i < n_segments; i++) {
+					log->segments[i].fd = -1;
+					log->segments[i].data = NULL;
+					log->segments[i].generation = 0;
+
+					errors |= spill_segment_open (
+						&log->segments[i], path, name, i, segment_size
+					);
+				}
+
+				if (errors) {
+					spill_log_delete (log);
+					log = NULL;
+				}
+
+				else {
+					log->segments[0].generation = log->next_generation++;
+				}
+			}
+
+			else {
+				client_log_error ("Failed to allocate spill log!");
+
+				free (log->segments);
+				free (log->mutex);
+				free (log);
+				log = NULL;
+			}
+		}
+	}
+
+	return log;
+
+}
+
+// unmaps & removes the log's segments
+void spill_log_delete (void *log_ptr) {
+
+	if (log_ptr) {
+		SpillLog *log = (SpillLog *) log_ptr;
+
+		for (unsigned int i = 0; i < log->n_segments; i++) {
+			spill_segment_close (&log->segments[i]);
+		}
+
+		free (log->segments);
+
+		(void) pthread_mutex_destroy (log->mutex);
+		free (log->mutex);
+
+		free (log);
+	}
+
+}
+
+// moves to the next segment in the ring
+// any frame that was in it can't be read anymore
+static void spill_log_next_segment (SpillLog *log) {
+
+	log->current = (log->current + 1) % log->n_segments;
+	log->offset = 0;
+
+	SpillSegment *segment = &log->segments[log->current];
+	if (segment->generation) log->n_recycled += 1;
+
+	segment->generation = log->next_generation++;
+	if (!log->next_generation) log->next_generation = 1;
+
+}
+
+// writes the frame's compressed data to the log
+// with the action it belongs to in the record's info
+// the frame's data must already be compressed (MJPEG or PNG)
+// returns 0 on success, 1 on error
+unsigned int spill_log_append (
+	SpillLog *log, const PixzoFrame *pixzo_frame,
+	u32 action_id, SpillLocation *location
+) {
+
+	unsigned int retval = 1;
+
+	size_t data_size = pixzo_frame_data_size (pixzo_frame);
+	size_t record_size = SPILL_LOG_ALIGN (sizeof (SpillRecord) + data_size);
+
+	if (
+		data_size && pixzo_frame->raw->isContinuous ()
+		&& (record_size <= log->segment_size)
+	) {
+		(void) pthread_mutex_lock (log->mutex);
+
+		if ((log->offset + record_size) > log->segment_size) {
+			spill_log_next_segment (log);
+		}
+
+		SpillSegment *segment = &log->segments[log->current];
+
+		SpillRecord *record = (SpillRecord *) (segment->data + log->offset);
+		record->magic = SPILL_LOG_RECORD_MAGIC;
+		record->format = (u32) pixzo_frame->format;
+		(void) memcpy (&record->info, &pixzo_frame->info, sizeof (PixzoFrameInfo));
+		record->info.action_id = action_id;
+		record->crop = pixzo_frame->crop;
+		record->size = data_size;
+
+		(void) memcpy (record + 1, pixzo_frame->raw->ptr (), data_size);
+
+		location->segment = log->current;
+		location->generation = segment->generation;
+		location->offset = log->offset;
+
+		log->offset += record_size;
+
+		log->n_spilled += 1;
+		log->n_bytes += data_size;
+
+		(void) pthread_mutex_unlock (log->mutex);
+
+		retval = 0;
+	}
+
+	return retval;
+
+}
+
+// reads a frame back from the log into a new frame
+// that decodes its data on demand
+// returns NULL if the frame's segment has already been recycled
+// or a new reference that must be released with pixzo_frame_release ()
+PixzoFrame *spill_log_read (
+	SpillLog *log, const SpillLocation *location,
+	u32 action_id, u64 frame_id
+) {
+
+	PixzoFrame *pixzo_frame = NULL;
+
+	if (log && location->generation && (location->segment < log->n_segments)) {
+		(void) pthread_mutex_lock (log->mutex);
+
+		const SpillSegment *segment = &log->segments[location->segment];
+		if (segment->generation == location->generation) {
+			const SpillRecord *record = (const SpillRecord *) (segment->data + location->offset);
+			if (
+				(record->magic == SPILL_LOG_RECORD_MAGIC)
+				&& (record->info.action_id == action_id)
+				&& (record->info.frame_id == frame_id)
+			) {
+				pixzo_frame = pixzo_frame_get ();
+				if (pixzo_frame) {
+					(void) memcpy (&pixzo_frame->info, &record->info, sizeof (PixzoFrameInfo));
+					pixzo_frame->format = (PixzoFrameFormat) record->format;
+					pixzo_frame->crop = record->crop;
+
+					// copied as the segment can be recycled at any time
+					cv::Mat (
+						1, (int) record->size, CV_8UC1, (void *) (record + 1)
+					).copyTo (*pixzo_frame->raw);
+
+					pixzo_frame_set_refs (pixzo_frame, 1);
+				}
+			}
+		}
+
+		(void) pthread_mutex_unlock (log->mutex);
+	}
+
+	return pixzo_frame;
+
+}
+
+void spill_log_print (const SpillLog *log) {
+
+	if (log) {
+		(void) printf ("\tSpill log: \n");
+		(void) printf ("\t\tSegments: %u x %zu bytes\n", log->n_segments, log->segment_size);
+		(void) printf ("\t\tSpilled: %lu\n", log->n_spilled);
+		(void) printf ("\t\tBytes: %lu\n", log->n_bytes);
+		(void) printf ("\t\tRecycled: %lu\n", log->n_recycled);
+	}
+
+}
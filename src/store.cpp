@@ -1,5 +1,8 @@
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <time.h>
 
 #include <string>
 
@@ -15,10 +18,14 @@
 #include <client/utils/log.h>
 
 #include "global.h"
+#include "budget.hpp"
 #include "frames.hpp"
 
 #include "store.h"
+#include "affinity.hpp"
 #include "camera.hpp"
+#include "executor.hpp"
+#include "memory.hpp"
 #include "stream.hpp"
 
 const char *store_status_to_string (StoreStatus status) {
@@ -44,10 +51,24 @@ static Store *store_new (void) {
         store->status = STORE_STATUS_NONE;
 
         store->active = false;
+		store->stop_deadline_ns = 0;
 
         store->next_stream_id = 0;
 		store->streams = NULL;
 
+		store->sync_capture = false;
+		store->capture_thread_id = 0;
+		store->capture_tick = 0;
+		store->pending_retrieves = 0;
+		store->capture_mutex = NULL;
+		store->capture_cond = NULL;
+
+		store->n_detached = 0;
+
+		store->budget = NULL;
+
+		store->executor = NULL;
+
         store->mutex = NULL;
 	}
 
@@ -55,11 +76,44 @@ static Store *store_new (void) {
 
 }
 
+// only the streams whose threads have exited are deleted
+// the rest of the store is kept for the detached ones
+static void store_delete_detached (Store *store) {
+
+	client_log_warning (
+		"Store %s is not deleted as %u of its threads are still running!",
+		store->name, store->n_detached
+	);
+
+	(void) pthread_mutex_lock (store->mutex);
+
+	Stream *stream = NULL;
+	ListElement *next = NULL;
+	for (ListElement *le = dlist_start (store->streams); le; le = next) {
+		next = le->next;
+
+		stream = (Stream *) le->data;
+		if (!stream->detached) {
+			stream_delete (dlist_remove (store->streams, stream, NULL));
+		}
+	}
+
+	(void) pthread_mutex_unlock (store->mutex);
+
+}
+
 void store_delete (void *store_ptr) {
 
-	if (store_ptr) {
+	if (store_ptr && ((Store *) store_ptr)->n_detached) {
+		store_delete_detached ((Store *) store_ptr);
+	}
+
+	else if (store_ptr) {
 		Store *store = (Store *) store_ptr;
 
+		// the streams' pipelines have no tasks left
+		executor_delete (store->executor);
+
         (void) pthread_mutex_lock (store->mutex);
 
 		dlist_delete (store->streams);
@@ -68,6 +122,15 @@ void store_delete (void *store_ptr) {
 		(void) pthread_mutex_destroy (store->mutex);
 		free (store->mutex);
 
+		(void) pthread_mutex_destroy (store->capture_mutex);
+		free (store->capture_mutex);
+
+		(void) pthread_cond_destroy (store->capture_cond);
+		free (store->capture_cond);
+
+		// the streams' frames have been released
+		memory_budget_delete (store->budget);
+
 		free (store);
 	}
 
@@ -81,6 +144,12 @@ Store *store_create (void) {
 
         store->mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
 		(void) pthread_mutex_init (store->mutex, NULL);
+
+		store->capture_mutex = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
+		(void) pthread_mutex_init (store->capture_mutex, NULL);
+
+		store->capture_cond = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
+		(void) pthread_cond_init (store->capture_cond, NULL);
     }
 
 	return store;
@@ -149,6 +218,8 @@ void store_print (Store *store) {
 		(void) printf ("Location: %s\n", store->location);
 		(void) printf ("N streams: %lu\n", store->streams->size);
 
+		memory_budget_print (store->budget);
+
 		for (ListElement *le = dlist_start (store->streams); le; le = le->next) {
 			stream_print ((Stream *) le->data);
 		}
@@ -309,11 +380,47 @@ unsigned int store_start (void *store_ptr) {
 
 		client_log_debug ("Starting store %s ...", store->name);
 
-		store->active = true;
+		__atomic_store_n (&store->active, true, __ATOMIC_SEQ_CST);
+		store->stop_deadline_ns = 0;
+
+		// only real cameras can be grabbed at the same time
+		store->sync_capture = global->config.sync_capture
+			&& (global->type == PIXZO_GLOBAL_TYPE_SINGLE);
+
+		if (global->config.memory_budget && !store->budget) {
+			store->budget = memory_budget_create (
+				(u64) global->config.memory_budget * 1024 * 1024,
+				memory_budget_policy_from_string (global->config.memory_policy)
+			);
+		}
+
+		// the streams' frames are handled by a shared set of workers
+		// that also replace opencv's own threads
+		if (
+			((global->type == PIXZO_GLOBAL_TYPE_SINGLE) || (global->type == PIXZO_GLOBAL_TYPE_RECORD))
+			&& !store->executor
+		) {
+			store->executor = executor_create (global->config.workers);
+			if (store->executor && global->config.workers_cpus) {
+				ThreadAffinity affinity;
+				thread_affinity_init (&affinity);
+				if (!thread_affinity_set_cpus (&affinity, global->config.workers_cpus)) {
+					executor_set_affinity (store->executor, &affinity);
+				}
+			}
+
+			if (!store->executor || executor_start (store->executor)) {
+				client_log_error ("store_start () - failed to start store's executor!");
+				errors |= 1;
+			}
+
+			cv::setNumThreads (0);
+		}
 
 		void *(*stream_thread_work) (void *) = NULL;
 		switch (global->type) {
-			case PIXZO_GLOBAL_TYPE_SINGLE: {
+			case PIXZO_GLOBAL_TYPE_SINGLE:
+			case PIXZO_GLOBAL_TYPE_RECORD: {
 				stream_thread_work = stream_thread;
 			} break;
 
@@ -329,9 +436,40 @@ unsigned int store_start (void *store_ptr) {
 		for (ListElement *le = dlist_start (store->streams); le; le = le->next) {
 			stream = (Stream *) le->data;
 
-			// TODO: move logic to stream thread
-			if (thread_create_detachable (
-				&stream->stream_thread_id, 
+			actions_memory_set_budget (
+				stream->memory, store->budget, &stream->budget_bytes
+			);
+
+			if (global->config.spill_path) {
+				if (stream_set_spill (
+					stream, global->config.spill_path,
+					(size_t) global->config.spill_segment_size * 1024 * 1024,
+					global->config.spill_segments
+				)) {
+					client_log_error (
+						"store_start () - "
+						"failed to create stream's %d spill log!",
+						stream->id
+					);
+				}
+			}
+
+			// the pipeline gets the frames as soon as they are captured
+			if (store->executor) {
+				if (stream_pipeline_start (stream, store->executor)) {
+					client_log_error (
+						"store_start () - "
+						"failed to start stream's %d pipeline!",
+						stream->id
+					);
+
+					errors |= 1;
+				}
+			}
+
+			// joined when the store is closed
+			if (pthread_create (
+				&stream->stream_thread_id, NULL,
 				stream_thread_work, 
 				stream
 			)) {
@@ -341,44 +479,25 @@ unsigned int store_start (void *store_ptr) {
 					stream->id
 				);
 
+				stream->stream_thread_id = 0;
 				errors |= 1;
 			}
+		}
 
-			// create stream's custom thread
-			switch (global->type) {
-				case PIXZO_GLOBAL_TYPE_SINGLE: {
-					if (thread_create_detachable (
-						&stream->movement_thread_id, 
-						stream_movement_thread,
-						stream
-					)) {
-						client_log_error (
-							"store_start () - "
-							"failed to create stream's %d MOVEMENT thread!",
-							stream->id
-						);
-
-						errors |= 1;
-					}
-				} break;
-
-				case PIXZO_GLOBAL_TYPE_RECORD: {
-					if (thread_create_detachable (
-						&stream->record_thread_id,
-						stream_record_thread,
-						stream
-					)) {
-						client_log_error (
-							"store_start () - "
-							"failed to create stream's %d RECORD thread!",
-							stream->id
-						);
-
-						errors |= 1;
-					}
-				} break;
-
-				default: break;
+		// every stream thread now retrieves the frames grabbed by this one
+		if (store->sync_capture) {
+			if (pthread_create (
+				&store->capture_thread_id, NULL,
+				store_capture_thread,
+				store
+			)) {
+				client_log_error (
+					"store_start () - "
+					"failed to create store's CAPTURE thread!"
+				);
+
+				store->capture_thread_id = 0;
+				errors |= 1;
 			}
 		}
 
@@ -392,19 +511,234 @@ unsigned int store_start (void *store_ptr) {
 
 }
 
+// the store is running until it is closed
+bool store_is_active (const Store *store) {
+
+	return __atomic_load_n (&store->active, __ATOMIC_SEQ_CST);
+
+}
+
+// ms left until the store's shutdown deadline, at least 1
+// or 0 if there is no deadline
+unsigned int store_shutdown_remaining (const Store *store) {
+
+	unsigned int remaining = 0;
+
+	if (store->stop_deadline_ns) {
+		u64 now = pixzo_frame_time_ns ();
+		remaining = (now < store->stop_deadline_ns) ?
+			(unsigned int) ((store->stop_deadline_ns - now) / 1000000) + 1 : 1;
+	}
+
+	return remaining;
+
+}
+
+// waits for the thread until the store's shutdown deadline
+// a thread that doesn't exit in time is detached
+// and the memory it uses is never freed
+static unsigned int store_join_thread (
+	const Store *store, pthread_t thread_id, const char *name
+) {
+
+	unsigned int retval = 1;
+
+	unsigned int timeout = store_shutdown_remaining (store);
+	if (timeout) {
+		struct timespec deadline = { 0 };
+		(void) clock_gettime (CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+
+		retval = pthread_timedjoin_np (thread_id, NULL, &deadline) ? 1 : 0;
+	}
+
+	else {
+		retval = pthread_join (thread_id, NULL) ? 1 : 0;
+	}
+
+	if (retval) {
+		client_log_error ("%s thread did not exit in time!", name);
+		(void) pthread_detach (thread_id);
+	}
+
+	return retval;
+
+}
+
 // correctly closes the store
-void store_close (Store *store) {
+// the streams handle their pending frames until the shutdown deadline
+// returns 0 on success, 1 if any thread did not exit in time
+unsigned int store_close (Store *store) {
+
+	unsigned int errors = 0;
 
 	if (store) {
 		// set the store status in the db
 		store_status_set (store, STORE_STATUS_CLOSED);
 
-		// streams threads are created as detachable that listen to this condition
-		store->active = false;
+		if (global->config.shutdown_timeout) {
+			store->stop_deadline_ns = pixzo_frame_time_ns ()
+				+ ((u64) global->config.shutdown_timeout * 1000000);
+		}
+
+		// every store's thread listens to this condition
+		__atomic_store_n (&store->active, false, __ATOMIC_SEQ_CST);
+
+		// wake up any thread waiting for the next capture tick
+		(void) pthread_mutex_lock (store->capture_mutex);
+		(void) pthread_cond_broadcast (store->capture_cond);
+		(void) pthread_mutex_unlock (store->capture_mutex);
+
+		// and any capture that is blocked by the budget
+		if (store->budget) memory_budget_wake (store->budget);
+
+		// it retrieves every stream's frames
+		if (store->capture_thread_id) {
+			if (store_join_thread (store, store->capture_thread_id, "store-capture")) {
+				for (ListElement *le = dlist_start (store->streams); le; le = le->next) {
+					((Stream *) le->data)->detached = true;
+				}
+
+				store->n_detached += 1;
+				errors |= 1;
+			}
+
+			store->capture_thread_id = 0;
+		}
 
-		client_log_success ("Store %s has been closed!", store->name);
+		// each stream drains its pipeline before exiting
+		char name[STORE_THREAD_NAME_SIZE] = { 0 };
+		Stream *stream = NULL;
+		for (ListElement *le = dlist_start (store->streams); le; le = le->next) {
+			stream = (Stream *) le->data;
+			if (stream->stream_thread_id) {
+				(void) snprintf (name, STORE_THREAD_NAME_SIZE, "stream-%u", stream->id);
+				if (store_join_thread (store, stream->stream_thread_id, name)) {
+					stream->detached = true;
+					store->n_detached += 1;
+					errors |= 1;
+				}
+
+				stream->stream_thread_id = 0;
+			}
+		}
+
+		// the pipelines have no tasks left
+		executor_stop (store->executor);
+
+		if (errors) {
+			client_log_warning ("Store %s has been closed before its threads ended!", store->name);
+		}
+
+		else {
+			client_log_success ("Store %s has been closed!", store->name);
+		}
 	}
 
+	return errors;
+
+}
+
+#pragma endregion
+
+#pragma region capture
+
+// dedicated thread that grabs every stream's camera back to back
+// so that all the frames from the same tick are time aligned
+void *store_capture_thread (void *store_ptr) {
+
+	Store *store = (Store *) store_ptr;
+
+	(void) thread_set_name ("store-capture");
+	client_log_success ("store-capture THREAD has started!");
+
+	Stream *stream = NULL;
+	unsigned int grabbed = 0;
+	while (store_is_active (store)) {
+		// the previous frames must be retrieved before grabbing again
+		(void) pthread_mutex_lock (store->capture_mutex);
+		while (store->pending_retrieves && store_is_active (store)) {
+			(void) pthread_cond_wait (store->capture_cond, store->capture_mutex);
+		}
+		(void) pthread_mutex_unlock (store->capture_mutex);
+
+		if (store_is_active (store)) {
+			grabbed = 0;
+			for (ListElement *le = dlist_start (store->streams); le; le = le->next) {
+				stream = (Stream *) le->data;
+
+				// disconnected cameras are reconnected by their stream's thread
+				// streams that were not grabbed don't retrieve in this tick
+				// so they are not counted in the pending retrieves
+				if (
+					(camera_get_state (stream->cam) == CAMERA_STATE_CONNECTED)
+					&& !camera_grab (stream->cam)
+				) {
+					__atomic_store_n (
+						&stream->grabbed_tick, store->capture_tick + 1, __ATOMIC_RELAXED
+					);
+
+					grabbed += 1;
+				}
+			}
+
+			// let the streams' threads retrieve & decode their frames
+			(void) pthread_mutex_lock (store->capture_mutex);
+			store->capture_tick += 1;
+			store->pending_retrieves = grabbed;
+			(void) pthread_cond_broadcast (store->capture_cond);
+			(void) pthread_mutex_unlock (store->capture_mutex);
+
+			// avoid spinning while every camera is away
+			if (!grabbed) {
+				(void) usleep (STREAM_RECONNECT_SLEEP_STEP * 1000);
+			}
+		}
+	}
+
+	client_log_success ("store-capture has exited!");
+
+	return NULL;
+
+}
+
+// waits until the store's capture thread has grabbed a new tick
+// returns the new tick or 0 if the store is no longer active
+u64 store_capture_wait (Store *store, u64 last_tick) {
+
+	u64 tick = 0;
+
+	(void) pthread_mutex_lock (store->capture_mutex);
+
+	while ((store->capture_tick == last_tick) && store_is_active (store)) {
+		(void) pthread_cond_wait (store->capture_cond, store->capture_mutex);
+	}
+
+	if (store_is_active (store)) tick = store->capture_tick;
+
+	(void) pthread_mutex_unlock (store->capture_mutex);
+
+	return tick;
+
+}
+
+// signals that a stream has retrieved its frame for the current tick
+void store_capture_done (Store *store) {
+
+	(void) pthread_mutex_lock (store->capture_mutex);
+
+	if (store->pending_retrieves) {
+		store->pending_retrieves -= 1;
+		if (!store->pending_retrieves) {
+			(void) pthread_cond_broadcast (store->capture_cond);
+		}
+	}
+
+	(void) pthread_mutex_unlock (store->capture_mutex);
+
 }
 
 #pragma endregion
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <client/config.h>
 
@@ -13,19 +14,26 @@
 #include <client/types/string.h>
 
 #include <client/collections/dlist.h>
+#include <client/collections/pool.h>
 
 #include <client/client.h>
 #include <client/packets.h>
 
 #include <client/threads/thread.h>
-#include <client/threads/jobs.h>
 
 #include <client/utils/utils.h>
 #include <client/utils/log.h>
 
+#include "affinity.hpp"
+#include "budget.hpp"
 #include "camera.hpp"
+#include "executor.hpp"
 #include "frames.hpp"
 #include "global.h"
+#include "memory.hpp"
+#include "movement.hpp"
+#include "pipeline.hpp"
+#include "spill.hpp"
 #include "stream.hpp"
 
 const char *stream_type_to_string (StreamType type) {
@@ -40,6 +48,10 @@ const char *stream_type_to_string (StreamType type) {
 
 }
 
+static void stream_pre_roll_clear (Stream *stream);
+
+static void stream_pipeline_delete (StreamConsumer *consumer);
+
 #pragma region main
 
 Stream *stream_new (void) {
@@ -53,24 +65,63 @@ Stream *stream_new (void) {
 		stream->type = STREAM_TYPE_NONE;
 
 		stream->stream_thread_id = 0;
+		stream->detached = false;
+		thread_affinity_init (&stream->capture_affinity);
 
 		stream->videos = NULL;
 
 		stream->cam = NULL;
+		stream->grabbed_tick = 0;
+		stream->capture_tick = 0;
 		stream->width = stream->height = 0;
 
 		stream->scale_factor = 0;
 
-		stream->frames_buffer = NULL;
+		stream->frames_pool = NULL;
+
+		StreamConsumer *consumer = NULL;
+		for (unsigned int i = 0; i < STREAM_MAX_CONSUMERS; i++) {
+			consumer = &stream->consumers[i];
+
+			consumer->type = STREAM_CONSUMER_TYPE_NONE;
+			consumer->ring = NULL;
+
+			consumer->stream = stream;
+			consumer->pipeline = NULL;
+
+			consumer->idle = true;
+			consumer->pending = NULL;
+
+			consumer->last_latency_ns = 0;
+			consumer->max_latency_ns = 0;
+		}
+
+		stream->n_consumers = 0;
+
+		stream->budget_bytes = 0;
+		stream->n_budget_drops = 0;
+		stream->decimate_skip = false;
 
-		stream->movement_thread_id = 0;
 		stream->movement = false;
 		stream->movement_count = 0;
 		stream->no_movement_frames = 0;
 		stream->movement_thresh = 0;
 		stream->max_no_movement_frames = 0;
 
-		stream->record_thread_id = 0;
+		for (unsigned int i = 0; i < PIPELINE_STAGE_TYPES; i++) {
+			stream->stage_threads[i] = DEFAULT_STREAM_STAGE_THREADS;
+		}
+
+		stream->memory = NULL;
+		stream->action_id = 0;
+		stream->spill = NULL;
+
+		stream->pre_roll_frames = 0;
+		stream->pre_roll_seconds = DEFAULT_STREAM_PRE_ROLL_SECONDS;
+		stream->pre_roll = NULL;
+		stream->pre_roll_size = 0;
+		stream->pre_roll_head = 0;
+		stream->pre_roll_count = 0;
 
 		stream->next_frame_id = 0;
 		stream->raw_frame_saved_count = 0;
@@ -88,6 +139,8 @@ Stream *stream_new (void) {
 		stream->pose_output_y_offset = 0;
 
 		stream->writer = NULL;
+		stream->writer_start_ns = 0;
+		stream->writer_frames = 0;
 
 		stream->n_frames_read = 0;
 		stream->n_frames_good = 0;
@@ -107,9 +160,34 @@ void stream_delete (void *stream_ptr) {
 
 		dlist_delete (stream->videos);
 
-		camera_delete (stream->cam);
+		// frames must be returned before their pool & camera are gone
+		// the executor has already stopped so no task is feeding them
+		PixzoFrame *pixzo_frame = NULL;
+		StreamConsumer *consumer = NULL;
+		for (unsigned int i = 0; i < stream->n_consumers; i++) {
+			consumer = &stream->consumers[i];
+
+			pixzo_frame_release (consumer->pending);
+			consumer->pending = NULL;
 
-		job_queue_delete (stream->frames_buffer);
+			while ((pixzo_frame = frames_ring_pop (consumer->ring))) {
+				pixzo_frame_release (pixzo_frame);
+			}
+
+			frames_ring_delete (consumer->ring);
+
+			stream_pipeline_delete (consumer);
+		}
+
+		stream_pre_roll_clear (stream);
+		free (stream->pre_roll);
+
+		actions_memory_delete (stream->memory);
+		spill_log_delete (stream->spill);
+
+		pixzo_frames_pool_delete (stream->frames_pool);
+
+		camera_delete (stream->cam);
 
 		free (stream);
 	}
@@ -133,6 +211,62 @@ int stream_comparator_by_id (
 
 }
 
+const char *stream_consumer_type_to_string (
+	StreamConsumerType type
+) {
+
+	switch (type) {
+		#define XX(num, name, string) case STREAM_CONSUMER_TYPE_##name: return #string;
+		STREAM_CONSUMER_TYPE_MAP(XX)
+		#undef XX
+	}
+
+	return stream_consumer_type_to_string (STREAM_CONSUMER_TYPE_NONE);
+
+}
+
+// registers a new consumer that will get every captured frame
+// must be called before the stream's thread has started
+// returns the registered consumer, NULL on error
+StreamConsumer *stream_register_consumer (
+	Stream *stream, StreamConsumerType type
+) {
+
+	StreamConsumer *consumer = stream_get_consumer (stream, type);
+
+	if (!consumer && (stream->n_consumers < STREAM_MAX_CONSUMERS)) {
+		FramesRing *ring = frames_ring_create (STREAM_CONSUMER_RING_SIZE);
+		if (ring) {
+			consumer = &stream->consumers[stream->n_consumers];
+			consumer->type = type;
+			consumer->ring = ring;
+
+			stream->n_consumers += 1;
+		}
+	}
+
+	return consumer;
+
+}
+
+// returns a registered consumer, NULL if not found
+StreamConsumer *stream_get_consumer (
+	Stream *stream, StreamConsumerType type
+) {
+
+	StreamConsumer *consumer = NULL;
+
+	for (unsigned int i = 0; i < stream->n_consumers; i++) {
+		if (stream->consumers[i].type == type) {
+			consumer = &stream->consumers[i];
+			break;
+		}
+	}
+
+	return consumer;
+
+}
+
 // sets the stream's name to be used for output filenames
 void stream_set_name (
 	Stream *stream, const char *name
@@ -188,6 +322,100 @@ void stream_set_max_no_movement_frames (
 
 }
 
+// sets how many frames before an action starts are kept
+// to be included in the action's video & memory
+// takes precedence over the pre roll seconds, 0 to use them
+void stream_set_pre_roll_frames (
+	Stream *stream, unsigned int pre_roll_frames
+) {
+
+	if (stream) {
+		stream->pre_roll_frames = pre_roll_frames;
+	}
+
+}
+
+// sets how many seconds before an action starts are kept
+// based on the camera's fps, 0 to disable pre roll
+void stream_set_pre_roll_seconds (
+	Stream *stream, unsigned int pre_roll_seconds
+) {
+
+	if (stream) {
+		stream->pre_roll_seconds = pre_roll_seconds;
+	}
+
+}
+
+// pins the stream's capture thread to a cpu list like "0-3,8"
+// returns 0 on success, 1 on error
+unsigned int stream_set_capture_cpus (
+	Stream *stream, const char *cpu_list
+) {
+
+	return stream ?
+		thread_affinity_set_cpus (&stream->capture_affinity, cpu_list) : 1;
+
+}
+
+// sets the scheduling policy & priority (fifo & rr) of the capture thread
+void stream_set_capture_sched (
+	Stream *stream, AffinitySched sched, int priority
+) {
+
+	if (stream) {
+		thread_affinity_set_sched (&stream->capture_affinity, sched, priority);
+	}
+
+}
+
+// the capture thread & its frames are kept in the numa node
+// using the node's cpus if none were set
+void stream_set_numa_node (
+	Stream *stream, int numa_node
+) {
+
+	if (stream) {
+		thread_affinity_set_numa_node (&stream->capture_affinity, numa_node);
+	}
+
+}
+
+// sets how many workers can run a stage of the stream's pipeline at the same time
+// the movement & sink stages always use a single thread
+// as they must see the frames in order
+// the capture is always done by the stream's own thread
+// returns 0 on success, 1 if the stage can't be configured
+unsigned int stream_set_stage_threads (
+	Stream *stream, PipelineStageType type, unsigned int n_threads
+) {
+
+	unsigned int retval = 1;
+
+	if (stream && n_threads) {
+		switch (type) {
+			case PIPELINE_STAGE_TYPE_MOVEMENT:
+			case PIPELINE_STAGE_TYPE_SINK:
+				stream->stage_threads[type] = 1;
+				retval = 0;
+				break;
+
+			case PIPELINE_STAGE_TYPE_DECODE:
+			case PIPELINE_STAGE_TYPE_PREPROCESS:
+			case PIPELINE_STAGE_TYPE_ENCODE:
+				stream->stage_threads[type] = (n_threads < PIPELINE_STAGE_MAX_THREADS) ?
+					n_threads : PIPELINE_STAGE_MAX_THREADS;
+				retval = 0;
+				break;
+
+			default: break;
+		}
+	}
+
+	return retval;
+
+}
+
 // sets the stream's type
 // can only be called when a new stream is created
 void stream_set_type (
@@ -248,6 +476,105 @@ void stream_set_pose_output_offset (
 
 }
 
+#pragma region pre roll
+
+static void stream_pre_roll_create (Stream *stream) {
+
+	unsigned int size = stream->pre_roll_frames;
+	if (!size) {
+		unsigned int fps = stream->cam->real_fps ?
+			stream->cam->real_fps : DEFAULT_STREAM_FPS;
+
+		size = stream->pre_roll_seconds * fps;
+	}
+
+	if (size > STREAM_PRE_ROLL_MAX_FRAMES) size = STREAM_PRE_ROLL_MAX_FRAMES;
+
+	if (size) {
+		stream->pre_roll = (PixzoFrame **) calloc (size, sizeof (PixzoFrame *));
+		if (stream->pre_roll) {
+			stream->pre_roll_size = size;
+		}
+	}
+
+}
+
+// holds a reference to the frame, replacing the oldest one
+// the frame is not copied, only frames that wrap a driver buffer
+// are detached from it, as the camera needs it back to keep capturing
+// the rest are kept or copied when the action starts
+static void stream_pre_roll_push (
+	Stream *stream, PixzoFrame *pixzo_frame
+) {
+
+	if (stream->pre_roll_size) {
+		PixzoFrame *kept = pixzo_frame;
+		if (__atomic_load_n (&pixzo_frame->cam, __ATOMIC_ACQUIRE)) kept = pixzo_frame_keep (pixzo_frame);
+		else pixzo_frame_ref (pixzo_frame);
+
+		if (kept) {
+			unsigned int idx = 0;
+			if (stream->pre_roll_count < stream->pre_roll_size) {
+				idx = (stream->pre_roll_head + stream->pre_roll_count) % stream->pre_roll_size;
+				stream->pre_roll_count += 1;
+			}
+
+			else {
+				idx = stream->pre_roll_head;
+				pixzo_frame_release (stream->pre_roll[idx]);
+				stream->pre_roll_head = (stream->pre_roll_head + 1) % stream->pre_roll_size;
+			}
+
+			stream->pre_roll[idx] = kept;
+		}
+	}
+
+}
+
+static void stream_pre_roll_clear (Stream *stream) {
+
+	unsigned int idx = 0;
+	for (unsigned int i = 0; i < stream->pre_roll_count; i++) {
+		idx = (stream->pre_roll_head + i) % stream->pre_roll_size;
+		pixzo_frame_release (stream->pre_roll[idx]);
+		stream->pre_roll[idx] = NULL;
+	}
+
+	stream->pre_roll_head = 0;
+	stream->pre_roll_count = 0;
+
+}
+
+#pragma endregion
+
+// creates the log where the actions' frames that don't fit
+// in memory are written to, in path
+// returns 0 on success, 1 on error
+unsigned int stream_set_spill (
+	Stream *stream, const char *path,
+	size_t segment_size, unsigned int n_segments
+) {
+
+	unsigned int retval = 1;
+
+	if (stream && stream->memory && !stream->spill) {
+		char name[STREAM_NAME_SIZE] = { 0 };
+		(void) snprintf (
+			name, STREAM_NAME_SIZE - 1, "%s-%u",
+			stream->store ? stream->store->store_id : "stream", stream->id
+		);
+
+		stream->spill = spill_log_create (path, name, segment_size, n_segments);
+		if (stream->spill) {
+			actions_memory_set_spill (stream->memory, stream->spill);
+			retval = 0;
+		}
+	}
+
+	return retval;
+
+}
+
 // sets the stream's values now that we have all the required info
 // called automatically in store_stream_thread () after the camera has been opened
 int stream_populate_values (Stream *stream) {
@@ -285,6 +612,9 @@ unsigned int stream_set_video_writer (
 				time (NULL)
 			);
 
+			stream->writer_start_ns = 0;
+			stream->writer_frames = 0;
+
 			// configured to output at pose size resolution
 			stream->writer = new cv::VideoWriter (
 				stream->video_output,
@@ -311,6 +641,55 @@ unsigned int stream_set_video_writer (
 
 }
 
+// writes the frame to the current video based on its capture time
+// frames are repeated (or skipped) to keep the real timing
+// even when the camera is not delivering at its real fps
+// returns 0 on success, 1 on error
+unsigned int stream_write_video_frame (
+	Stream *stream,
+	const PixzoFrame *pixzo_frame, const cv::Mat &frame
+) {
+
+	unsigned int retval = 1;
+
+	if (stream && stream->writer) {
+		u64 n_writes = 1;
+
+		// video files don't have real capture times
+		if (
+			(stream->cam->type != CAMERA_TYPE_VIDEO)
+			&& pixzo_frame->info.capture_ns && stream->cam->real_fps
+		) {
+			if (!stream->writer_start_ns) {
+				stream->writer_start_ns = pixzo_frame->info.capture_ns;
+			}
+
+			u64 elapsed = (pixzo_frame->info.capture_ns > stream->writer_start_ns) ?
+				pixzo_frame->info.capture_ns - stream->writer_start_ns : 0;
+
+			// how many frames the video should have after this one
+			u64 expected = ((elapsed * stream->cam->real_fps) / 1000000000) + 1;
+
+			n_writes = (expected > stream->writer_frames) ?
+				expected - stream->writer_frames : 0;
+
+			// don't fill more than a second of a camera stall
+			if (n_writes > stream->cam->real_fps) n_writes = stream->cam->real_fps;
+		}
+
+		for (u64 i = 0; i < n_writes; i++) {
+			stream->writer->write (frame);
+		}
+
+		stream->writer_frames += n_writes;
+
+		retval = 0;
+	}
+
+	return retval;
+
+}
+
 // ends the current stream's video writer recording
 // returns 0 on success, 1 on error
 unsigned int stream_close_video_writer (
@@ -344,7 +723,18 @@ static Stream *stream_create_internal (void) {
 
 	Stream *stream = stream_new ();
 	if (stream) {
-		stream->frames_buffer = job_queue_create (JOB_QUEUE_TYPE_JOBS);
+		stream->memory = actions_memory_create (
+			global->config.max_actions_memory_size,
+			global->config.max_action_frames, DEFAULT_STREAM_MEMORY_BATCH_SIZE,
+			memory_compression_from_string (global->config.memory_compression)
+		);
+
+		// can be overwritten by each camera's settings
+		stream_set_capture_sched (
+			stream,
+			affinity_sched_from_string (global->config.capture_sched),
+			(int) global->config.capture_priority
+		);
 	}
 
 	return stream;
@@ -411,11 +801,45 @@ void stream_print (const Stream *stream) {
 
 		(void) printf ("\tPose output x offset: %d\n", stream->pose_output_x_offset);
 		(void) printf ("\tPose output y offset: %d\n", stream->pose_output_y_offset);
+
+		(void) printf ("\tPre roll frames: %u\n", stream->pre_roll_size);
+
+		pixzo_frames_pool_print (stream->frames_pool);
+
+		for (unsigned int i = 0; i < stream->n_consumers; i++) {
+			(void) printf (
+				"\tConsumer %s - latency: %lu ns -- max latency: %lu ns\n",
+				stream_consumer_type_to_string (stream->consumers[i].type),
+				stream->consumers[i].last_latency_ns, stream->consumers[i].max_latency_ns
+			);
+
+			frames_ring_print (stream->consumers[i].ring);
+			pipeline_print (stream->consumers[i].pipeline);
+		}
+
+		actions_memory_print (stream->memory);
 	}
 
 }
 
 
+#pragma endregion
+
+#pragma region frames
+
+// get the original frame by searching it by its id
+// in the stream's actions memories
+// returns a new reference that must be released
+// with pixzo_frame_release (), NULL if not found
+PixzoFrame *stream_memory_get_frame (
+	Stream *stream, u32 action_id, u64 frame_id
+) {
+
+	return stream ?
+		actions_memory_get_frame (stream->memory, action_id, frame_id) : NULL;
+
+}
+
 #pragma endregion
 
 #pragma region thread
@@ -530,39 +954,49 @@ unsigned int stream_open (Stream *stream) {
 
 }
 
+// the actions are recorded into their own videos
+// unless the record consumer is already recording every frame
+static bool stream_records_actions (Stream *stream) {
+
+	return global->config.record
+		&& !stream_get_consumer (stream, STREAM_CONSUMER_TYPE_RECORD);
+
+}
+
+// pose_frame is used if it was already created by the pipeline
+// the frame might be shared with other consumers so it is not changed
 static u8 stream_thread_handle_frame (
-	Stream *stream, PixzoFrame *pixzo_frame
+	Stream *stream, PixzoFrame *pixzo_frame, const cv::Mat *pose_frame
 ) {
 
 	u8 retval = 1;
 
-	(void) strncpy (
-		pixzo_frame->info.store_id,
-		stream->store->store_id,
-		STORE_ID_SIZE - 1
-	);
-
-	pixzo_frame->info.stream_id = stream->id;
-	(void) time (&pixzo_frame->info.timestamp);
-
-	pixzo_frame->info.width = stream->cam->real_width;
-	pixzo_frame->info.height = stream->cam->real_height;
+	bool record = stream_records_actions (stream);
 
 	stream->n_frames_good += 1;
 
-	if (global->connected || global->config.record) {
+	if (stream->memory && stream->action_id) {
+		(void) actions_memory_push (stream->memory, pixzo_frame, stream->action_id);
+	}
+
+	if (global->connected || record) {
 		// create a scaled version of the frame
 		// resize raw frame to correct size to be used as pose input
-		cv::Mat pose_frame;
-		cv::resize (*pixzo_frame->frame, pose_frame, stream->pose_size);
+		cv::Mat scaled;
+		cv::Mat resized;
+		if (!pose_frame || pose_frame->empty ()) {
+			pixzo_frame_resize (pixzo_frame, stream->pose_size, scaled, resized);
+			pose_frame = &resized;
+		}
 
 		if (global->type == PIXZO_GLOBAL_TYPE_VIDEOS) {
-			cv::imshow ("video", pose_frame);
+			cv::imshow ("video", *pose_frame);
 		}
 
 		// save frame to current video
-		if (global->config.record) {
-			stream->writer->write (pose_frame);
+		// a frame that could not be decoded is covered by the next one
+		if (record && !pose_frame->empty ()) {
+			(void) stream_write_video_frame (stream, pixzo_frame, *pose_frame);
 		}
 	}
 
@@ -572,212 +1006,1002 @@ static u8 stream_thread_handle_frame (
 
 }
 
-static unsigned int stream_thread_check_movement (
-	cv::Mat frame
-) {
-
-	unsigned int contador = 0;
-	uchar *data = (uchar *) frame.data;
+// the frames that were kept before the action started
+// are handled as part of it, from the oldest one
+static void stream_thread_flush_pre_roll (Stream *stream) {
 
-	// client_log_line_break ();
-	// client_log_debug (
-	// 	"Frame rows x cols: %d",
-	// 	frame.rows * frame.cols
-	// );
-	// client_log_line_break ();
+	unsigned int idx = 0;
+	for (unsigned int i = 0; i < stream->pre_roll_count; i++) {
+		idx = (stream->pre_roll_head + i) % stream->pre_roll_size;
 
-	register int x = 0;
-	register int y = 0;
-	for (; y < frame.rows; y++) {
-		for (x = 0; x < frame.cols; x++) {
-			if (*data) {
-				contador++;
-			}
+		(void) stream_thread_handle_frame (stream, stream->pre_roll[idx], NULL);
 
-			data++;
-		}
+		pixzo_frame_release (stream->pre_roll[idx]);
+		stream->pre_roll[idx] = NULL;
 	}
 
-	return contador;
+	stream->pre_roll_head = 0;
+	stream->pre_roll_count = 0;
 
 }
 
-static void stream_thread_handle_movement (
-	Stream *stream, PixzoFrame *pixzo_frame
-) {
-
-	if (!stream->movement) {
-		if (stream->movement_count >= stream->movement_thresh) {
-			client_log_success ("First movement...");
+// starts a new action with the frames that were kept before it
+static void stream_thread_action_start (Stream *stream) {
 
-			if (global->config.record) {
-				if (stream_set_video_writer (stream)) {
-					client_log_error (
-						"Failed to open stream's %d new video writer!",
-						stream->id
-					);
-				}
-			}
+	if (stream->memory) {
+		stream->action_id = actions_memory_action_start (stream->memory);
+	}
 
-			(void) stream_thread_handle_frame (
-				stream, pixzo_frame
+	if (stream_records_actions (stream)) {
+		if (stream_set_video_writer (stream)) {
+			client_log_error (
+				"Failed to open stream's %d new video writer!",
+				stream->id
 			);
-			
-			stream->no_movement_frames = 0;
-			stream->movement = true;
 		}
 	}
 
-	else {
-		(void) stream_thread_handle_frame (
-			stream, pixzo_frame
-		);
+	// the action includes the frames before the trigger
+	stream_thread_flush_pre_roll (stream);
 
-		// check if there is still movement
-		if (stream->movement_count >= stream->movement_thresh) {
-			stream->no_movement_frames = 0;
-		}
+}
 
-		else {
-			stream->no_movement_frames += 1;
-			if (stream->no_movement_frames >= stream->max_no_movement_frames) {
-				client_log_warning ("Max no movement frames reached!");
-				stream->movement = false;
+static void stream_thread_action_end (Stream *stream) {
 
-				(void) stream_thread_handle_frame (
-					stream, pixzo_frame
-				);
+	if (stream_records_actions (stream)) {
+		(void) stream_close_video_writer (stream);
+	}
 
-				(void) stream_close_video_writer (stream);
-			}
-		}
+	if (stream->memory) {
+		actions_memory_action_end (stream->memory, stream->action_id);
 	}
 
+	stream->action_id = 0;
+
 }
 
-void *stream_movement_thread (void *stream_ptr) {
+// end to end latency from the frame's capture until it has been handled
+// only updated by the consumer's sink
+static void stream_update_latency (
+	StreamConsumer *consumer, const PixzoFrame *pixzo_frame
+) {
 
-	Stream *stream = (Stream *) stream_ptr;
+	if (pixzo_frame->info.capture_ns) {
+		consumer->last_latency_ns = pixzo_frame_latency_ns (pixzo_frame);
+		if (consumer->last_latency_ns > consumer->max_latency_ns) {
+			consumer->max_latency_ns = consumer->last_latency_ns;
+		}
 
-	char thread_name[THREAD_NAME_BUFFER_SIZE] = { 0 };
-	(void) snprintf (
-		thread_name, THREAD_NAME_BUFFER_SIZE,
-		"stream-movement-%u", stream->id
-	);
+		#ifdef STREAM_DEBUG
+		client_log_debug (
+			"Stream %u %s frame %lu latency: %lu ns",
+			consumer->stream->id, stream_consumer_type_to_string (consumer->type),
+			pixzo_frame->info.frame_id, consumer->last_latency_ns
+		);
+		#endif
+	}
 
-	(void) thread_set_name (thread_name);
-	client_log_success ("%s THREAD has started!", thread_name);
+}
 
-	int scaled_width = (int) (stream->cam->real_width / stream->scale_factor);
-	int scaled_height = (int) (stream->cam->real_height / stream->scale_factor);
+#pragma region pipeline
 
-	#ifdef PIXZO_DEBUG
-	client_log_debug ("Scaled width: %d", scaled_width);
-	client_log_debug ("Scaled height: %d", scaled_height);
-	#endif
+// what the sink has to do with a frame
+// based on the movement that was found in it
+typedef enum StreamPipelineAction {
 
-	cv::Mat previous_frame_gray (scaled_height, scaled_width, CV_8U, cv::Scalar (0));
-	cv::Mat gray_scale; // (scaled_height, scaled_with, CV_8U, Scalar (0));
-	cv::Mat diference (scaled_height, scaled_width, CV_8U, cv::Scalar (0));
+	STREAM_PIPELINE_ACTION_NONE			= 0,	// kept as pre roll
+	STREAM_PIPELINE_ACTION_START		= 1,
+	STREAM_PIPELINE_ACTION_CONTINUE		= 2,
+	STREAM_PIPELINE_ACTION_END			= 3,
+	STREAM_PIPELINE_ACTION_CANCELLED	= 4,	// only released
+	STREAM_PIPELINE_ACTION_SKIPPED		= 5,	// bad frame outside an action
 
-	cv::Mat resized;
+} StreamPipelineAction;
 
-	Job *job = NULL;
-	PixzoFrame *pixzo_frame = NULL;
-	while (stream->store->active) {
-		bsem_wait (stream->frames_buffer->has_jobs);
+// a frame going through the movement pipeline
+// with the results of every stage
+struct _StreamPipelineItem {
 
-		if (stream->store->active) {
-			job = (Job *) job_queue_pull (stream->frames_buffer);
-			if (job) {
-				pixzo_frame = (PixzoFrame *) job->args;
+	PixzoFrame *frame;
+	StreamPipelineAction action;
 
-				// check for movement in frame
-				cv::resize (*pixzo_frame->frame, resized, cv::Size (scaled_width, scaled_height));
-				cv::cvtColor (resized, gray_scale, cv::COLOR_BGR2GRAY);
-				// fastNlMeansDenoising (gray_scale, gray_scale, 3.0, 3, 3);
-				cv::absdiff (gray_scale, previous_frame_gray, diference);
-				(void) cv::threshold (diference, diference, 45, 255, cv::THRESH_BINARY);
+	cv::Mat resized;			// working buffer
+	cv::Mat reduced;			// working buffer, the gray before it is rotated
+	cv::Mat gray;				// scaled gray to check for movement
 
-				stream->movement_count = stream_thread_check_movement (diference);
+	cv::Mat scaled;				// working buffer
+	cv::Mat pose;				// pose input
 
-				#ifdef STREAM_DEBUG
-				client_log_debug ("Movement: %u", stream->movement_count);
-				#endif
+};
 
-				stream_thread_handle_movement (
-					stream, pixzo_frame
-				);
+typedef struct _StreamPipelineItem StreamPipelineItem;
 
-				if (!stream->movement) {
-					pixzo_frame_delete (pixzo_frame);
-				}
+static void *stream_pipeline_item_new (void) {
+
+	StreamPipelineItem *item = new StreamPipelineItem;
+	item->frame = NULL;
+	item->action = STREAM_PIPELINE_ACTION_NONE;
+
+	return item;
+
+}
+
+static void stream_pipeline_item_delete (void *item_ptr) {
+
+	if (item_ptr) {
+		StreamPipelineItem *item = (StreamPipelineItem *) item_ptr;
+
+		pixzo_frame_release (item->frame);
+
+		delete item;
+	}
+
+}
+
+// shared by every stage's work
+struct _StreamPipelineContext {
+
+	Stream *stream;
+	StreamConsumer *consumer;
+
+	Pool *items;
+
+	cv::Size scaled_size;
+	cv::Mat previous_gray;
+
+};
+
+typedef struct _StreamPipelineContext StreamPipelineContext;
+
+// the frame is only decoded & resized if it will be handled
+static inline bool stream_pipeline_item_handled (
+	Stream *stream, const StreamPipelineItem *item
+) {
+
+	return (item->action >= STREAM_PIPELINE_ACTION_START)
+		&& (item->action <= STREAM_PIPELINE_ACTION_END)
+		&& (global->connected || stream_records_actions (stream));
+
+}
+
+// frames might be wrapping driver buffers
+// so we can't hold them after they have been handled
+static void stream_pipeline_item_done (
+	StreamPipelineContext *context, StreamPipelineItem *item
+) {
+
+	stream_update_latency (context->consumer, item->frame);
+
+	pixzo_frame_release (item->frame);
+	item->frame = NULL;
+
+	(void) pool_push (context->items, item);
+
+}
+
+static void stream_pipeline_preprocess (void *args, void *item_ptr) {
+
+	StreamPipelineContext *context = (StreamPipelineContext *) args;
+	StreamPipelineItem *item = (StreamPipelineItem *) item_ptr;
+
+	// check for movement in frame
+	// without decoding the full resolution frame
+	// a frame that fails is skipped by the movement stage
+	(void) pixzo_frame_gray_scaled (
+		item->frame, context->scaled_size,
+		item->resized, item->reduced, item->gray
+	);
+
+}
+
+static StreamPipelineAction stream_pipeline_check_action (Stream *stream) {
+
+	StreamPipelineAction action = STREAM_PIPELINE_ACTION_NONE;
+
+	if (!stream->movement) {
+		if (stream->movement_count >= stream->movement_thresh) {
+			client_log_success ("First movement...");
+
+			stream->no_movement_frames = 0;
+			stream->movement = true;
+
+			action = STREAM_PIPELINE_ACTION_START;
+		}
+	}
+
+	else {
+		action = STREAM_PIPELINE_ACTION_CONTINUE;
+
+		// check if there is still movement
+		if (stream->movement_count >= stream->movement_thresh) {
+			stream->no_movement_frames = 0;
+		}
 
-				previous_frame_gray = gray_scale.clone ();
+		else {
+			stream->no_movement_frames += 1;
+			if (stream->no_movement_frames >= stream->max_no_movement_frames) {
+				client_log_warning ("Max no movement frames reached!");
+				stream->movement = false;
 
-				job_return (stream->frames_buffer, job);
+				action = STREAM_PIPELINE_ACTION_END;
 			}
 		}
 	}
 
-	client_log_success ("%s has exited!", thread_name);
+	return action;
 
-	return NULL;
+}
+
+// compares each frame with the previous one
+// so it always runs in a single thread
+static void stream_pipeline_movement (void *args, void *item_ptr) {
+
+	StreamPipelineContext *context = (StreamPipelineContext *) args;
+	StreamPipelineItem *item = (StreamPipelineItem *) item_ptr;
+	Stream *stream = context->stream;
+
+	// the frame could not be reduced (bad data)
+	// so it is not compared & the previous gray is kept
+	// but it still belongs to the action that is going on
+	// counted as a frame without movement
+	if (item->gray.empty ()) {
+		if (stream->movement) {
+			stream->movement_count = 0;
+			item->action = stream_pipeline_check_action (stream);
+		}
+
+		else {
+			item->action = STREAM_PIPELINE_ACTION_SKIPPED;
+		}
+	}
+
+	else {
+		// fastNlMeansDenoising (gray_scale, gray_scale, 3.0, 3, 3);
+		stream->movement_count = movement_count (
+			item->gray, context->previous_gray, STREAM_MOVEMENT_THRESHOLD
+		);
+
+		#ifdef STREAM_DEBUG
+		client_log_debug ("Movement: %u", stream->movement_count);
+		#endif
+
+		item->action = stream_pipeline_check_action (stream);
+
+		// the previous gray is double buffered with the items' ones
+		// so the old buffer is reused by the next frames without any copies
+		cv::swap (item->gray, context->previous_gray);
+	}
 
 }
 
-void *stream_record_thread (void *stream_ptr) {
+static void stream_pipeline_decode (void *args, void *item_ptr) {
 
-	Stream *stream = (Stream *) stream_ptr;
+	StreamPipelineContext *context = (StreamPipelineContext *) args;
+	StreamPipelineItem *item = (StreamPipelineItem *) item_ptr;
 
-	char thread_name[THREAD_NAME_BUFFER_SIZE] = { 0 };
-	(void) snprintf (
-		thread_name, THREAD_NAME_BUFFER_SIZE,
-		"stream-record-%u", stream->id
+	if (stream_pipeline_item_handled (context->stream, item)) {
+		(void) pixzo_frame_decode (item->frame);
+	}
+
+}
+
+static void stream_pipeline_encode (void *args, void *item_ptr) {
+
+	StreamPipelineContext *context = (StreamPipelineContext *) args;
+	StreamPipelineItem *item = (StreamPipelineItem *) item_ptr;
+
+	// resize raw frame to correct size to be used as pose input
+	if (stream_pipeline_item_handled (context->stream, item)) {
+		pixzo_frame_resize (
+			item->frame, context->stream->pose_size, item->scaled, item->pose
+		);
+	}
+
+	else {
+		item->pose.release ();
+	}
+
+}
+
+// handles the frames in the same order they were captured
+// and is the only stage that touches the actions & video writer
+static void stream_pipeline_sink (void *args, void *item_ptr) {
+
+	StreamPipelineContext *context = (StreamPipelineContext *) args;
+	StreamPipelineItem *item = (StreamPipelineItem *) item_ptr;
+	Stream *stream = context->stream;
+
+	if (pipeline_is_cancelled (context->consumer->pipeline)) {
+		item->action = STREAM_PIPELINE_ACTION_CANCELLED;
+	}
+
+	switch (item->action) {
+		case STREAM_PIPELINE_ACTION_START: {
+			stream_thread_action_start (stream);
+			(void) stream_thread_handle_frame (stream, item->frame, &item->pose);
+		} break;
+
+		case STREAM_PIPELINE_ACTION_CONTINUE: {
+			(void) stream_thread_handle_frame (stream, item->frame, &item->pose);
+		} break;
+
+		case STREAM_PIPELINE_ACTION_END: {
+			(void) stream_thread_handle_frame (stream, item->frame, &item->pose);
+			stream_thread_action_end (stream);
+		} break;
+
+		case STREAM_PIPELINE_ACTION_NONE: {
+			stream_pre_roll_push (stream, item->frame);
+		} break;
+
+		// it would be replayed out of order by the next action
+		case STREAM_PIPELINE_ACTION_SKIPPED: {
+			(void) __atomic_add_fetch (&stream->n_frames_bad, 1, __ATOMIC_RELAXED);
+		} break;
+
+		default: break;
+	}
+
+	stream_pipeline_item_done (context, item);
+
+}
+
+// every frame is recorded as it is
+static void stream_pipeline_record_encode (void *args, void *item_ptr) {
+
+	StreamPipelineContext *context = (StreamPipelineContext *) args;
+	StreamPipelineItem *item = (StreamPipelineItem *) item_ptr;
+
+	// create a scaled version of the frame
+	// resize raw frame to correct size to be used as pose input
+	pixzo_frame_resize (
+		item->frame, context->stream->pose_size, item->scaled, item->pose
 	);
 
-	(void) thread_set_name (thread_name);
-	client_log_success ("%s THREAD has started!", thread_name);
+}
 
-	// create video file
-	if (stream_set_video_writer (stream)) {
-		client_log_error (
-			"Failed to open stream's %d new video writer!",
-			stream->id
+static void stream_pipeline_record_sink (void *args, void *item_ptr) {
+
+	StreamPipelineContext *context = (StreamPipelineContext *) args;
+	StreamPipelineItem *item = (StreamPipelineItem *) item_ptr;
+
+	// save frame to current video
+	// a frame that could not be decoded is covered by the next one
+	if (!pipeline_is_cancelled (context->consumer->pipeline) && !item->pose.empty ()) {
+		(void) stream_write_video_frame (context->stream, item->frame, item->pose);
+	}
+
+	stream_pipeline_item_done (context, item);
+
+}
+
+static StreamPipelineContext *stream_pipeline_context_create (
+	Stream *stream, StreamConsumer *consumer
+) {
+
+	StreamPipelineContext *context = new StreamPipelineContext;
+
+	context->stream = stream;
+	context->consumer = consumer;
+
+	context->items = pool_create (stream_pipeline_item_delete);
+	if (context->items) {
+		pool_set_create (context->items, stream_pipeline_item_new);
+		pool_set_produce_if_empty (context->items, true);
+	}
+
+	int scaled_width = (int) (stream->cam->real_width / stream->scale_factor);
+	int scaled_height = (int) (stream->cam->real_height / stream->scale_factor);
+
+	#ifdef PIXZO_DEBUG
+	client_log_debug ("Scaled width: %d", scaled_width);
+	client_log_debug ("Scaled height: %d", scaled_height);
+	#endif
+
+	context->scaled_size = cv::Size (scaled_width, scaled_height);
+	context->previous_gray = cv::Mat (scaled_height, scaled_width, CV_8U, cv::Scalar (0));
+
+	return context;
+
+}
+
+static void stream_pipeline_context_delete (StreamPipelineContext *context) {
+
+	if (context) {
+		pool_delete (context->items);
+
+		delete context;
+	}
+
+}
+
+// the consumer's pipeline must have been stopped
+static void stream_pipeline_delete (StreamConsumer *consumer) {
+
+	if (consumer->pipeline) {
+		stream_pipeline_context_delete (
+			(StreamPipelineContext *) consumer->pipeline->args
 		);
+
+		pipeline_delete (consumer->pipeline);
+		consumer->pipeline = NULL;
+	}
+
+}
+
+static Pipeline *stream_pipeline_create (
+	Stream *stream, StreamConsumerType type, StreamPipelineContext *context
+) {
+
+	typedef struct {
+		PipelineStageType type;
+		PipelineStageWork work;
+	} StreamPipelineStage;
+
+	const StreamPipelineStage movement_stages[] = {
+		{ PIPELINE_STAGE_TYPE_PREPROCESS, stream_pipeline_preprocess },
+		{ PIPELINE_STAGE_TYPE_MOVEMENT, stream_pipeline_movement },
+		{ PIPELINE_STAGE_TYPE_DECODE, stream_pipeline_decode },
+		{ PIPELINE_STAGE_TYPE_ENCODE, stream_pipeline_encode },
+		{ PIPELINE_STAGE_TYPE_SINK, stream_pipeline_sink }
+	};
+
+	const StreamPipelineStage record_stages[] = {
+		{ PIPELINE_STAGE_TYPE_ENCODE, stream_pipeline_record_encode },
+		{ PIPELINE_STAGE_TYPE_SINK, stream_pipeline_record_sink }
+	};
+
+	const StreamPipelineStage *stages = movement_stages;
+	unsigned int n_stages = sizeof (movement_stages) / sizeof (movement_stages[0]);
+	if (type == STREAM_CONSUMER_TYPE_RECORD) {
+		stages = record_stages;
+		n_stages = sizeof (record_stages) / sizeof (record_stages[0]);
 	}
 
-	Job *job = NULL;
+	Pipeline *pipeline = pipeline_create (context);
+	if (pipeline) {
+		char name[PIPELINE_STAGE_NAME_SIZE] = { 0 };
+		unsigned int errors = 0;
+		for (unsigned int i = 0; i < n_stages; i++) {
+			(void) snprintf (
+				name, PIPELINE_STAGE_NAME_SIZE,
+				"stream-%s-%s-%u",
+				stream_consumer_type_to_string (type),
+				pipeline_stage_type_to_string (stages[i].type), stream->id
+			);
+
+			errors |= pipeline_add_stage (
+				pipeline, stages[i].type, name, stages[i].work,
+				stream->stage_threads[stages[i].type],
+				DEFAULT_STREAM_PIPELINE_QUEUE_SIZE
+			);
+		}
+
+		if (errors) {
+			pipeline_delete (pipeline);
+			pipeline = NULL;
+		}
+	}
+
+	return pipeline;
+
+}
+
+// passes a captured frame to the consumer's pipeline
+// returns 0 on success, 1 if the pipeline is full
+static unsigned int stream_pipeline_push (
+	StreamConsumer *consumer, PixzoFrame *pixzo_frame
+) {
+
+	unsigned int retval = 1;
+
+	StreamPipelineContext *context = (StreamPipelineContext *) consumer->pipeline->args;
+
+	StreamPipelineItem *item = (StreamPipelineItem *) pool_pop (context->items);
+	if (item) {
+		item->frame = pixzo_frame;
+		item->action = STREAM_PIPELINE_ACTION_NONE;
+
+		retval = pipeline_push (consumer->pipeline, item);
+		if (retval) {
+			item->frame = NULL;
+			(void) pool_push (context->items, item);
+		}
+	}
+
+	return retval;
+
+}
+
+static void stream_consumer_feed (void *consumer_ptr);
+
+// makes sure that an executor's task is feeding the consumer's pipeline
+// called after a new frame was pushed to its ring
+// and every time a frame leaves its pipeline
+static void stream_consumer_kick (void *consumer_ptr) {
+
+	StreamConsumer *consumer = (StreamConsumer *) consumer_ptr;
+
+	// pairs with stream_consumer_idle () checking again after setting it
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+	bool idle = true;
+	if (
+		__atomic_load_n (&consumer->idle, __ATOMIC_RELAXED)
+		&& __atomic_compare_exchange_n (
+			&consumer->idle, &idle, false,
+			false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED
+		)
+	) {
+		executor_submit (consumer->pipeline->executor, stream_consumer_feed, consumer);
+	}
+
+}
+
+// the consumer's task stops until there is a new frame
+// or room in the pipeline for the pending one
+// returns false if it arrived meanwhile & the task has to keep going
+static bool stream_consumer_idle (StreamConsumer *consumer) {
+
+	bool idle = true;
+
+	__atomic_store_n (&consumer->idle, true, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+	bool ready = __atomic_load_n (&consumer->pending, __ATOMIC_RELAXED) ?
+		pipeline_has_room (consumer->pipeline) : (frames_ring_size (consumer->ring) > 0);
+
+	// unless a kick already took it & submitted a new task
+	if (ready) {
+		idle = !__atomic_compare_exchange_n (
+			&consumer->idle, &idle, false,
+			false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED
+		);
+	}
+
+	return idle;
+
+}
+
+// executor's task that moves the frames from the consumer's ring
+// into its pipeline while there is room for them
+// the ring buffers the frames while the pipeline is full
+static void stream_consumer_feed (void *consumer_ptr) {
+
+	StreamConsumer *consumer = (StreamConsumer *) consumer_ptr;
+
 	PixzoFrame *pixzo_frame = NULL;
-	while (stream->store->active) {
-		bsem_wait (stream->frames_buffer->has_jobs);
+	bool done = false;
+	while (!done) {
+		pixzo_frame = __atomic_load_n (&consumer->pending, __ATOMIC_RELAXED);
+		if (!pixzo_frame) {
+			// only the frames that were really dropped are counted
+			u64 n_dropped = consumer->ring->n_dropped;
+			pixzo_frame = frames_ring_pop (consumer->ring);
+			if (consumer->ring->n_dropped > n_dropped) {
+				(void) __atomic_add_fetch (
+					&consumer->stream->n_budget_drops,
+					consumer->ring->n_dropped - n_dropped, __ATOMIC_RELAXED
+				);
+			}
+		}
+
+		if (pixzo_frame && !stream_pipeline_push (consumer, pixzo_frame)) {
+			__atomic_store_n (&consumer->pending, (PixzoFrame *) NULL, __ATOMIC_RELAXED);
+		}
+
+		else {
+			__atomic_store_n (&consumer->pending, pixzo_frame, __ATOMIC_RELAXED);
+			done = stream_consumer_idle (consumer);
+		}
+	}
+
+}
+
+// returns true if the consumer still has frames that are not in its pipeline
+static bool stream_consumer_has_frames (StreamConsumer *consumer) {
+
+	return __atomic_load_n (&consumer->pending, __ATOMIC_RELAXED)
+		|| frames_ring_size (consumer->ring);
+
+}
+
+// registers the consumer & starts its pipeline
+// returns 0 on success, 1 on error
+static unsigned int stream_consumer_start (
+	Stream *stream, StreamConsumerType type, struct _Executor *executor
+) {
+
+	unsigned int retval = 1;
+
+	StreamConsumer *consumer = stream_register_consumer (stream, type);
+	if (consumer && !consumer->pipeline) {
+		StreamPipelineContext *context = stream_pipeline_context_create (stream, consumer);
+		if (context->items) {
+			consumer->pipeline = stream_pipeline_create (stream, type, context);
+		}
+
+		if (consumer->pipeline) {
+			pipeline_set_executor (consumer->pipeline, executor);
+			pipeline_set_done (consumer->pipeline, stream_consumer_kick, consumer);
+
+			retval = pipeline_start (consumer->pipeline);
+		}
+
+		else {
+			stream_pipeline_context_delete (context);
+		}
+	}
+
+	return retval;
+
+}
+
+// registers the stream's consumers with their pipelines to handle
+// the captured frames in the executor's workers
+// must be called before the stream's thread has started
+// returns 0 on success, 1 on error
+unsigned int stream_pipeline_start (
+	Stream *stream, struct _Executor *executor
+) {
+
+	unsigned int errors = 1;
+
+	if (stream && executor && !stream->n_consumers) {
+		errors = 0;
+
+		// recordings go into a single video
+		// while the actions are still found in the same frames
+		if (global->type == PIXZO_GLOBAL_TYPE_RECORD) {
+			errors |= stream_consumer_start (stream, STREAM_CONSUMER_TYPE_RECORD, executor);
+
+			if (stream_set_video_writer (stream)) {
+				client_log_error (
+					"Failed to open stream's %d new video writer!",
+					stream->id
+				);
+			}
+		}
+
+		errors |= stream_consumer_start (stream, STREAM_CONSUMER_TYPE_MOVEMENT, executor);
+	}
+
+	return errors;
+
+}
+
+// waits up to timeout ms (0 for no limit) for the frames
+// that are in the consumers' rings & pipelines to be handled
+// called by the stream's thread after it has stopped capturing
+// returns 0 on success, 1 if some frames were dropped
+unsigned int stream_pipeline_stop (
+	Stream *stream, unsigned int timeout
+) {
+
+	unsigned int retval = 0;
+
+	if (stream) {
+		u64 deadline = timeout ?
+			pixzo_frame_time_ns () + ((u64) timeout * 1000000) : 0;
+
+		u64 now = 0;
+		unsigned int remaining = 0;
+		StreamConsumer *consumer = NULL;
+		for (unsigned int i = 0; i < stream->n_consumers; i++) {
+			consumer = &stream->consumers[i];
+
+			// the frames that are still in the ring go into the pipeline first
+			now = pixzo_frame_time_ns ();
+			while (stream_consumer_has_frames (consumer) && (!deadline || (now < deadline))) {
+				(void) usleep (STREAM_CONSUMER_WAIT_STEP * 1000);
+				now = pixzo_frame_time_ns ();
+			}
+
+			// the ones that are left are released when the stream is deleted
+			if (stream_consumer_has_frames (consumer)) retval = 1;
+
+			remaining = deadline ?
+				((now < deadline) ? (unsigned int) ((deadline - now) / 1000000) + 1 : 1) : 0;
+
+			retval |= pipeline_stop (consumer->pipeline, remaining);
+		}
+	}
+
+	return retval;
+
+}
+
+#pragma endregion
+
+// the frames pool & the pre roll are allocated by the capture thread
+// after its affinity has been applied, so they are in the stream's node
+static void stream_thread_allocate (Stream *stream) {
+
+	if (!stream->pre_roll) {
+		stream_pre_roll_create (stream);
+	}
+
+	// frames are decoded at the full captured size
+	// the ones that are held as pre roll come from the pool too
+	if (!stream->frames_pool) {
+		stream->frames_pool = pixzo_frames_pool_create (
+			stream->cam->capture_width, stream->cam->capture_height,
+			DEFAULT_STREAM_FRAMES_POOL_SIZE + stream->pre_roll_size
+		);
+	}
+
+}
+
+// gets a frame from the stream's own pool
+// videos streams might not have one
+// the frame's info is set before it is shared with the consumers
+static PixzoFrame *stream_frame_get (Stream *stream) {
+
+	if (!stream->frames_pool) {
+		stream->frames_pool = pixzo_frames_pool_create (0, 0, 0);
+	}
+
+	PixzoFrame *pixzo_frame = stream->frames_pool ?
+		pixzo_frames_pool_get (stream->frames_pool) : pixzo_frame_get ();
+
+	if (pixzo_frame) {
+		(void) strncpy (
+			pixzo_frame->info.store_id,
+			stream->store->store_id,
+			STORE_ID_SIZE - 1
+		);
+
+		pixzo_frame->info.stream_id = stream->id;
+
+		pixzo_frame->info.width = stream->cam->real_width;
+		pixzo_frame->info.height = stream->cam->real_height;
+	}
+
+	return pixzo_frame;
+
+}
+
+// asks every consumer to drop its oldest waiting frame
+// as only they can remove frames from their rings
+// returns 0 on success, 1 if none of them had a frame left to drop
+static unsigned int stream_thread_drop_oldest (Stream *stream) {
+
+	unsigned int retval = 1;
+
+	for (unsigned int i = 0; i < stream->n_consumers; i++) {
+		if (frames_ring_request_drop (stream->consumers[i].ring)) {
+			retval = 0;
+		}
+	}
+
+	return retval;
 
-		if (stream->store->active) {
-			job = (Job *) job_queue_pull (stream->frames_buffer);
-			if (job) {
-				pixzo_frame = (PixzoFrame *) job->args;
+}
+
+// applies the store's budget policy to a new frame
+// returns true if the frame can be pushed to the consumers
+static bool stream_thread_budget_admit (
+	Stream *stream, PixzoFrame *pixzo_frame
+) {
 
-				// create a scaled version of the frame
-				// resize raw frame to correct size to be used as pose input
-				cv::Mat pose_frame;
-				cv::resize (*pixzo_frame->frame, pose_frame, stream->pose_size);
+	bool admit = true;
+
+	MemoryBudget *budget = stream->store->budget;
+	if (budget) {
+		u64 bytes = pixzo_frame_memory_size (pixzo_frame);
+
+		// the ended actions are evicted first under every policy
+		if (memory_budget_exceeded (budget, bytes)) {
+			(void) actions_memory_evict (stream->memory, bytes);
+		}
 
-				// save frame to current video
-				stream->writer->write (pose_frame);
+		if (memory_budget_exceeded (budget, bytes)) {
+			switch (budget->policy) {
+				// the consumers release their oldest frames
+				// when they take the next one, so the new one is kept
+				// they count the drops once they really happen
+				// the new one is dropped if there was nothing older to drop
+				case MEMORY_BUDGET_POLICY_DROP_OLDEST: {
+					admit = !stream_thread_drop_oldest (stream);
+				} break;
+
+				// the held actions' frames might never be released
+				// while their action is still going on, so it is not
+				// waiting forever for them & the frame is dropped
+				case MEMORY_BUDGET_POLICY_BLOCK: {
+					admit = memory_budget_wait (budget, bytes);
+					for (
+						unsigned int waits = 1;
+						!admit && store_is_active (stream->store)
+						&& (waits < (MEMORY_BUDGET_BLOCK_TIMEOUT / MEMORY_BUDGET_WAIT_TIMEOUT));
+						waits++
+					) {
+						admit = memory_budget_wait (budget, bytes);
+					}
+				} break;
+
+				// decimating was not enough
+				case MEMORY_BUDGET_POLICY_DECIMATE:
+				case MEMORY_BUDGET_POLICY_DROP_NEWEST:
+				default: admit = false; break;
+			}
+		}
+
+		// every other frame is dropped before the budget is exceeded
+		else if (
+			(budget->policy == MEMORY_BUDGET_POLICY_DECIMATE)
+			&& memory_budget_above (budget, bytes, MEMORY_BUDGET_DECIMATE_PERCENT)
+		) {
+			admit = !stream->decimate_skip;
+			stream->decimate_skip = !stream->decimate_skip;
+		}
+
+		else {
+			stream->decimate_skip = false;
+		}
+
+		if (!admit) {
+			(void) __atomic_add_fetch (&stream->n_budget_drops, 1, __ATOMIC_RELAXED);
+			(void) __atomic_add_fetch (&stream->n_frames_bad, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	return admit;
+
+}
 
+static void stream_thread_push_frame (
+	Stream *stream, PixzoFrame *pixzo_frame, u8 result
+) {
+
+	if (!result) {
+		stream->n_frames_read += 1;
+		stream->next_frame_id += 1;
+
+		if (!pixzo_frame_empty (pixzo_frame)) {
+			// every consumer gets the same frame without copies
+			unsigned int n_receivers = stream->n_consumers;
+			if (n_receivers && stream_thread_budget_admit (stream, pixzo_frame)) {
+				pixzo_frame_charge (
+					pixzo_frame, stream->store->budget, &stream->budget_bytes
+				);
+
+				pixzo_frame_set_refs (pixzo_frame, n_receivers);
+
+				// the ring holds the frame until there is room in the pipeline
+				// a consumer that is too far behind misses it
+				unsigned int n_full = 0;
+				for (unsigned int i = 0; i < stream->n_consumers; i++) {
+					if (frames_ring_push (stream->consumers[i].ring, pixzo_frame)) {
+						stream_consumer_kick (&stream->consumers[i]);
+					}
+
+					else {
+						pixzo_frame_release (pixzo_frame);
+						n_full += 1;
+					}
+				}
+
+				if (n_full == n_receivers) {
+					(void) __atomic_add_fetch (&stream->n_frames_bad, 1, __ATOMIC_RELAXED);
+				}
+			}
+
+			else {
 				pixzo_frame_delete (pixzo_frame);
+			}
+		}
+
+		else {
+			#ifdef PIXZO_DEBUG
+			client_log_error (
+				"Pixzo frame %lu is empty in stream %d",
+				pixzo_frame->info.frame_id, stream->id
+			);
+			#endif
+
+			pixzo_frame_delete (pixzo_frame);
+		}
+	}
+
+	else {
+		client_log_error (
+			"Failed to get frame from stream %d",
+			stream->id
+		);
+
+		pixzo_frame_delete (pixzo_frame);
+	}
+
+}
+
+// grabs & retrieves the next frame from the stream's camera
+static void stream_thread_capture (Stream *stream) {
+
+	// get new frame from device
+	PixzoFrame *pixzo_frame = stream_frame_get (stream);
+	if (pixzo_frame) {
+		pixzo_frame->info.frame_id = stream->next_frame_id;
+
+		stream_thread_push_frame (
+			stream, pixzo_frame,
+			camera_get (stream->cam, pixzo_frame)
+		);
+	}
+
+}
+
+// retrieves the frame that was grabbed by the store's capture thread
+// so that decoding happens in this thread while the next tick is grabbed
+static void stream_thread_capture_sync (Stream *stream) {
+
+	u64 tick = store_capture_wait (stream->store, stream->capture_tick);
+	if (tick) {
+		stream->capture_tick = tick;
 
-				job_return (stream->frames_buffer, job);
+		// only streams grabbed in this tick are waited by the capture thread
+		// an older tick's value can be read while the next one is grabbed
+		if (__atomic_load_n (&stream->grabbed_tick, __ATOMIC_RELAXED) == tick) {
+			PixzoFrame *pixzo_frame = stream_frame_get (stream);
+			if (pixzo_frame) {
+				pixzo_frame->info.frame_id = stream->next_frame_id;
+				pixzo_frame->info.capture_tick = tick;
+
+				stream_thread_push_frame (
+					stream, pixzo_frame,
+					camera_retrieve (stream->cam, pixzo_frame)
+				);
 			}
+
+			store_capture_done (stream->store);
 		}
 	}
 
-	// close video file
-	(void) stream_close_video_writer (stream);
+}
 
-	client_log_success ("%s has exited!", thread_name);
+// waits the camera's backoff delay in small steps
+// so that the store can still be stopped meanwhile
+static void stream_thread_reconnect_wait (
+	Stream *stream, unsigned int delay
+) {
 
-	return NULL;
+	unsigned int step = 0;
+	while (delay && store_is_active (stream->store)) {
+		step = (delay < STREAM_RECONNECT_SLEEP_STEP) ? delay : STREAM_RECONNECT_SLEEP_STEP;
+		(void) usleep (step * 1000);
+		delay -= step;
+	}
+
+}
+
+// closes & opens again a disconnected camera
+// the stream's frames pool & queues are left untouched
+static void stream_thread_reconnect (Stream *stream) {
+
+	unsigned int delay = camera_get_reconnect_delay (stream->cam);
+
+	client_log_warning (
+		"Stream %d camera is disconnected - reconnecting in %u ms...",
+		stream->id, delay
+	);
+
+	stream_thread_reconnect_wait (stream, delay);
+
+	if (store_is_active (stream->store)) {
+		if (camera_reconnect (stream->cam)) {
+			client_log_success (
+				"Stream %d camera has been reconnected! (%lu reconnects)",
+				stream->id, stream->cam->n_reconnects
+			);
+		}
+
+		else {
+			client_log_error (
+				"Failed to reconnect stream %d camera!",
+				stream->id
+			);
+		}
+	}
 
 }
 
@@ -798,6 +2022,11 @@ void *stream_thread (void *stream_ptr) {
 	(void) thread_set_name (thread_name);
 	client_log_success ("%s THREAD has started!", thread_name);
 
+	// before any frame is allocated, so they are in the stream's node
+	(void) thread_affinity_apply (&stream->capture_affinity, thread_name);
+
+	stream_thread_allocate (stream);
+
 	// reset stream values
 	stream->movement = false;
 	stream->movement_count = 0;
@@ -807,47 +2036,20 @@ void *stream_thread (void *stream_ptr) {
 	struct timespec start = { 0 };
 	struct timespec end = { 0 };
 
-	PixzoFrame *pixzo_frame = NULL;
-	while (stream->store->active) {
+	while (store_is_active (stream->store)) {
 		(void) clock_gettime (CLOCK_MONOTONIC_RAW, &start);
 
-		// get new frame from device
-		pixzo_frame = pixzo_frame_get ();
-		if (pixzo_frame) {
-			pixzo_frame->info.frame_id = stream->next_frame_id;
-
-			if (!camera_get (stream->cam, pixzo_frame->frame)) {
-				stream->n_frames_read += 1;
-				stream->next_frame_id += 1;
-
-				if (!pixzo_frame->frame->empty ()) {
-					// push to frames buffer
-					(void) job_queue_push (
-						stream->frames_buffer,
-						job_create (NULL, pixzo_frame)
-					);
-				}
-
-				else {
-					#ifdef PIXZO_DEBUG
-					client_log_error (
-						"Pixzo frame %lu is empty in stream %d",
-						pixzo_frame->info.frame_id, stream->id
-					);
-					#endif
-
-					pixzo_frame_delete (pixzo_frame);
-				}
-			}
+		// a disconnected camera is not grabbed again until it is reconnected
+		if (camera_get_state (stream->cam) == CAMERA_STATE_DISCONNECTED) {
+			stream_thread_reconnect (stream);
+		}
 
-			else {
-				client_log_error (
-					"Failed to get frame from stream %d",
-					stream->id
-				);
+		else if (stream->store->sync_capture) {
+			stream_thread_capture_sync (stream);
+		}
 
-				pixzo_frame_delete (pixzo_frame);
-			}
+		else {
+			stream_thread_capture (stream);
 		}
 
 		if (global->config.enable_wait_key) {
@@ -866,9 +2068,39 @@ void *stream_thread (void *stream_ptr) {
 		}
 	}
 
+	// the frames that are still in the pipeline are handled
+	// until the store's shutdown deadline
+	if (stream_pipeline_stop (stream, store_shutdown_remaining (stream->store))) {
+		client_log_warning (
+			"Stream %u pipeline was not drained in time - its last frames were dropped!",
+			stream->id
+		);
+	}
+
+	// the on going action keeps the frames that were drained
+	if (stream->action_id) {
+		stream_thread_action_end (stream);
+	}
+
 	// correctly close any on going video writer
 	(void) stream_close_video_writer (stream);
 
+	if (stream->frames_pool) {
+		client_log_debug (
+			"Stream %d frames pool - size: %u -- high water: %u -- misses: %lu",
+			stream->id, stream->frames_pool->size,
+			stream->frames_pool->high_water, stream->frames_pool->misses
+		);
+	}
+
+	if (stream->store->budget) {
+		client_log_debug (
+			"Stream %d budget - bytes: %lu -- drops: %lu",
+			stream->id, stream->budget_bytes,
+			__atomic_load_n (&stream->n_budget_drops, __ATOMIC_RELAXED)
+		);
+	}
+
 	switch (stream->cam->type) {
 		case CAMERA_TYPE_MEDIA: {
 			client_log_success (
@@ -900,13 +2132,20 @@ static u8 stream_videos_thread_internal_get_frame (
 
 	u8 retval = 1;
 
-	if (stream->cam->capture->read (*pixzo_frame->frame)) {
+	if (stream->cam->capture->read (*pixzo_frame->pixels)) {
+		*pixzo_frame->frame = *pixzo_frame->pixels;
+		pixzo_frame->format = PIXZO_FRAME_FORMAT_BGR;
+		pixzo_frame->decoded = true;
+
+		pixzo_frame->info.capture_ns = pixzo_frame_time_ns ();
+		(void) time (&pixzo_frame->info.timestamp);
+
 		stream->n_frames_read += 1;
 		stream->next_frame_id += 1;
 
 		if (!pixzo_frame->frame->empty ()) {
 			retval = stream_thread_handle_frame (
-				stream, pixzo_frame
+				stream, pixzo_frame, NULL
 			);
 		}
 
@@ -931,8 +2170,9 @@ static void stream_videos_thread_internal (
 		PixzoFrame *pixzo_frame = NULL;
 
 		// get next frame unti the end of the video
-		while (1) {
-			pixzo_frame = pixzo_frame_get ();
+		// or until the store has been closed
+		while (store_is_active (stream->store)) {
+			pixzo_frame = stream_frame_get (stream);
 			if (pixzo_frame) {
 				pixzo_frame->info.frame_id = stream->next_frame_id;
 
@@ -981,9 +2221,14 @@ void *stream_videos_thread (void *stream_ptr) {
 	(void) thread_set_name (thread_name);
 	client_log_success ("%s THREAD has started!", thread_name);
 
+	// before any frame is allocated, so they are in the stream's node
+	(void) thread_affinity_apply (&stream->capture_affinity, thread_name);
+
+	stream_thread_allocate (stream);
+
 	String *filename = NULL;
-	for (unsigned int i = 0; i < global->config.videos_n_loops; i++) {
-		for (ListElement *le = dlist_start (stream->videos); le; le = le->next) {
+	for (unsigned int i = 0; (i < global->config.videos_n_loops) && store_is_active (stream->store); i++) {
+		for (ListElement *le = dlist_start (stream->videos); le && store_is_active (stream->store); le = le->next) {
 			filename = (String *) le->data;
 
 			client_log_debug ("Opening %s in stream %d", filename->str, stream->id);